@@ -120,11 +120,11 @@ size_t vrend_read_from_iovec_cb(const struct iovec *iov, int iovlen,
 
   while (count > 0 && iovlen > 0) {
     if (iov->iov_len > offset) {
-      len = iov->iov_len;
-      
+      len = iov->iov_len - offset;
+
       if (count < iov->iov_len - offset) len = count;
 
-      (*iocb)(cookie, count, (char*)iov->iov_base + offset, len);
+      (*iocb)(cookie, read, (char*)iov->iov_base + offset, len);
       read += len;
 
       count -= len;
@@ -140,3 +140,100 @@ size_t vrend_read_from_iovec_cb(const struct iovec *iov, int iovlen,
 
 
 }
+
+void vrend_iov_cursor_init(struct vrend_iov_cursor *cur,
+                           const struct iovec *iov, int iovlen)
+{
+  cur->iov = iov;
+  cur->iov_cnt = iovlen;
+  cur->index = 0;
+  cur->base = 0;
+}
+
+size_t vrend_iov_cursor_span(struct vrend_iov_cursor *cur, size_t offset,
+                             void **ptr)
+{
+  /* going backwards is rare, start over */
+  if (offset < cur->base) {
+    cur->index = 0;
+    cur->base = 0;
+  }
+
+  while (cur->index < cur->iov_cnt &&
+         offset >= cur->base + cur->iov[cur->index].iov_len) {
+    cur->base += cur->iov[cur->index].iov_len;
+    cur->index++;
+  }
+
+  if (cur->index == cur->iov_cnt)
+    return 0;
+
+  *ptr = (char*)cur->iov[cur->index].iov_base + (offset - cur->base);
+  return cur->base + cur->iov[cur->index].iov_len - offset;
+}
+
+static size_t iov_cursor_copy(struct vrend_iov_cursor *cur, size_t offset,
+                              char *buf, size_t count, int to_iov)
+{
+  size_t copied = 0;
+  size_t len;
+  void *ptr;
+
+  while (count > 0) {
+    len = vrend_iov_cursor_span(cur, offset, &ptr);
+    if (!len)
+      break;
+    if (count < len) len = count;
+
+    if (to_iov)
+      memcpy(ptr, buf, len);
+    else
+      memcpy(buf, ptr, len);
+
+    copied += len;
+    offset += len;
+    buf += len;
+    count -= len;
+  }
+  return copied;
+}
+
+size_t vrend_iov_cursor_read(struct vrend_iov_cursor *cur, size_t offset,
+                             char *buf, size_t count)
+{
+  return iov_cursor_copy(cur, offset, buf, count, 0);
+}
+
+size_t vrend_iov_cursor_write(struct vrend_iov_cursor *cur, size_t offset,
+                              const char *buf, size_t count)
+{
+  return iov_cursor_copy(cur, offset, (char*)buf, count, 1);
+}
+
+size_t vrend_iov_cursor_read_strided(struct vrend_iov_cursor *cur,
+                                     size_t offset, size_t stride,
+                                     char *buf, ptrdiff_t buf_stride,
+                                     size_t size, unsigned count)
+{
+  size_t read = 0;
+  unsigned i;
+
+  for (i = 0; i < count; i++)
+    read += iov_cursor_copy(cur, offset + i * stride, buf + i * buf_stride,
+                            size, 0);
+  return read;
+}
+
+size_t vrend_iov_cursor_write_strided(struct vrend_iov_cursor *cur,
+                                      size_t offset, size_t stride,
+                                      const char *buf, ptrdiff_t buf_stride,
+                                      size_t size, unsigned count)
+{
+  size_t written = 0;
+  unsigned i;
+
+  for (i = 0; i < count; i++)
+    written += iov_cursor_copy(cur, offset + i * stride,
+                               (char*)buf + i * buf_stride, size, 1);
+  return written;
+}
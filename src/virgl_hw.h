@@ -239,6 +239,16 @@ struct virgl_caps_bool_set1 {
         unsigned has_cull:1;
 };
 
+/* capability_bits in capabilities set 2 - every bit has an upstream meaning,
+ * from VIRGL_CAP_TGSI_INVARIANT (1 << 0) to VIRGL_CAP_ARB_BUFFER_STORAGE
+ * (1u << 31), and none of those features are advertised by this host */
+#define VIRGL_CAP_NONE 0
+
+/* capability_bits_v2 in capabilities set 2 */
+#define VIRGL_CAP_V2_TGSI_TOKENS (1u << 31) /* binary shaders, VIRGL_OBJ_SHADER_TYPE_TOKENS */
+
+#define VIRGL_MAX_SHADER_STAGES 6
+
 /* endless expansion capabilites - current gallium has 252 formats */
 struct virgl_supported_format_mask {
         uint32_t bitmask[16];
@@ -290,6 +300,31 @@ struct virgl_caps_v2 {
         int32_t max_texture_gather_offset;
         uint32_t texture_buffer_offset_alignment;
         uint32_t uniform_buffer_offset_alignment;
+        uint32_t shader_buffer_offset_alignment;
+        uint32_t capability_bits;
+        uint32_t sample_locations[8];
+        uint32_t max_vertex_attrib_stride;
+        uint32_t max_shader_buffer_frag_compute;
+        uint32_t max_shader_buffer_other_stages;
+        uint32_t max_shader_image_frag_compute;
+        uint32_t max_shader_image_other_stages;
+        uint32_t max_image_samples;
+        uint32_t max_compute_work_group_invocations;
+        uint32_t max_compute_shared_memory_size;
+        uint32_t max_compute_grid_size[3];
+        uint32_t max_compute_block_size[3];
+        uint32_t max_texture_2d_size;
+        uint32_t max_texture_3d_size;
+        uint32_t max_texture_cube_size;
+        uint32_t max_combined_shader_buffers;
+        uint32_t max_atomic_counters[VIRGL_MAX_SHADER_STAGES];
+        uint32_t max_atomic_counter_buffers[VIRGL_MAX_SHADER_STAGES];
+        uint32_t max_combined_atomic_counters;
+        uint32_t max_combined_atomic_counter_buffers;
+        uint32_t host_feature_check_version;
+        struct virgl_supported_format_mask supported_readback_formats;
+        struct virgl_supported_format_mask scanout;
+        uint32_t capability_bits_v2;
 };
 
 union virgl_caps {
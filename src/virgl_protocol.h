@@ -88,6 +88,7 @@ enum virgl_context_cmd {
    VIRGL_CCMD_SET_SHADER_BUFFERS,
    VIRGL_CCMD_MEMORY_BARRIER,
    VIRGL_CCMD_LAUNCH_GRID,
+   VIRGL_MAX_COMMANDS
 };
 
 /*
@@ -214,6 +215,9 @@ enum virgl_context_cmd {
 #define VIRGL_OBJ_SHADER_HDR_SIZE(nso) (5 + ((nso) ? (2 * nso) + 4 : 0))
 #define VIRGL_OBJ_SHADER_HANDLE 1
 #define VIRGL_OBJ_SHADER_TYPE 2
+/* the shader is sent as a binary tgsi_token array instead of text,
+   only if VIRGL_CAP_V2_TGSI_TOKENS is advertised */
+#define VIRGL_OBJ_SHADER_TYPE_TOKENS (0x1 << 31)
 #define VIRGL_OBJ_SHADER_OFFSET 3
 #define VIRGL_OBJ_SHADER_OFFSET_VAL(x) (((x) & 0x7fffffff) << 0)
 /* start contains full length in VAL - also implies continuations */
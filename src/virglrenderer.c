@@ -22,7 +22,9 @@
  *
  **************************************************************************/
 
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
 #include <epoxy/gl.h>
@@ -35,6 +37,8 @@
 #include "util/u_format.h"
 #include "util/u_math.h"
 #include "vrend_renderer.h"
+#include "vrend_iov.h"
+#include "vrend_trace.h"
 
 #include "virglrenderer.h"
 
@@ -60,11 +64,23 @@ static int use_context = CONTEXT_NONE;
 
 int virgl_renderer_resource_create(struct virgl_renderer_resource_create_args *args, struct iovec *iov, uint32_t num_iovs)
 {
+   if (vrend_trace_enabled()) {
+      struct vrend_trace_res_create rec = {
+         args->handle, args->target, args->format, args->bind,
+         args->width, args->height, args->depth, args->array_size,
+         args->last_level, args->nr_samples, args->flags,
+         iov ? vrend_get_iovec_size(iov, num_iovs) : 0
+      };
+      vrend_trace_record(VREND_TRACE_RES_CREATE, &rec, sizeof(rec), NULL, 0);
+   }
    return vrend_renderer_resource_create((struct vrend_renderer_resource_create_args *)args, iov, num_iovs);
 }
 
 void virgl_renderer_resource_unref(uint32_t res_handle)
 {
+   struct vrend_trace_handle rec = { res_handle };
+
+   vrend_trace_record(VREND_TRACE_RES_UNREF, &rec, sizeof(rec), NULL, 0);
    vrend_renderer_resource_unref(res_handle);
 }
 
@@ -76,11 +92,17 @@ void virgl_renderer_fill_caps(uint32_t set, uint32_t version,
 
 int virgl_renderer_context_create(uint32_t handle, uint32_t nlen, const char *name)
 {
+   struct vrend_trace_ctx_create rec = { handle, nlen };
+
+   vrend_trace_record(VREND_TRACE_CTX_CREATE, &rec, sizeof(rec), name, nlen);
    return vrend_renderer_context_create(handle, nlen, name);
 }
 
 void virgl_renderer_context_destroy(uint32_t handle)
 {
+   struct vrend_trace_handle rec = { handle };
+
+   vrend_trace_record(VREND_TRACE_CTX_DESTROY, &rec, sizeof(rec), NULL, 0);
    vrend_renderer_context_destroy(handle);
 }
 
@@ -88,6 +110,10 @@ int virgl_renderer_submit_cmd(void *buffer,
                               int ctx_id,
                               int ndw)
 {
+   struct vrend_trace_submit_cmd rec = { ctx_id, ndw };
+
+   vrend_trace_record(VREND_TRACE_SUBMIT_CMD, &rec, sizeof(rec),
+                      buffer, ndw * sizeof(uint32_t));
    return vrend_decode_block(ctx_id, buffer, ndw);
 }
 
@@ -141,16 +167,28 @@ int virgl_renderer_transfer_read_iov(uint32_t handle, uint32_t ctx_id,
 int virgl_renderer_resource_attach_iov(int res_handle, struct iovec *iov,
                                        int num_iovs)
 {
+   if (vrend_trace_enabled()) {
+      struct vrend_trace_attach_iov rec = {
+         res_handle, vrend_get_iovec_size(iov, num_iovs)
+      };
+      vrend_trace_record(VREND_TRACE_RES_ATTACH_IOV, &rec, sizeof(rec), NULL, 0);
+   }
    return vrend_renderer_resource_attach_iov(res_handle, iov, num_iovs);
 }
 
 void virgl_renderer_resource_detach_iov(int res_handle, struct iovec **iov_p, int *num_iovs_p)
 {
+   struct vrend_trace_handle rec = { res_handle };
+
+   vrend_trace_record(VREND_TRACE_RES_DETACH_IOV, &rec, sizeof(rec), NULL, 0);
    return vrend_renderer_resource_detach_iov(res_handle, iov_p, num_iovs_p);
 }
 
 int virgl_renderer_create_fence(int client_fence_id, uint32_t ctx_id)
 {
+   struct vrend_trace_fence rec = { client_fence_id, ctx_id };
+
+   vrend_trace_record(VREND_TRACE_CREATE_FENCE, &rec, sizeof(rec), NULL, 0);
    return vrend_renderer_create_fence(client_fence_id, ctx_id);
 }
 
@@ -161,11 +199,17 @@ void virgl_renderer_force_ctx_0(void)
 
 void virgl_renderer_ctx_attach_resource(int ctx_id, int res_handle)
 {
+   struct vrend_trace_ctx_res rec = { ctx_id, res_handle };
+
+   vrend_trace_record(VREND_TRACE_CTX_ATTACH_RES, &rec, sizeof(rec), NULL, 0);
    vrend_renderer_attach_res_ctx(ctx_id, res_handle);
 }
 
 void virgl_renderer_ctx_detach_resource(int ctx_id, int res_handle)
 {
+   struct vrend_trace_ctx_res rec = { ctx_id, res_handle };
+
+   vrend_trace_record(VREND_TRACE_CTX_DETACH_RES, &rec, sizeof(rec), NULL, 0);
    vrend_renderer_detach_res_ctx(ctx_id, res_handle);
 }
 
@@ -272,6 +316,7 @@ void virgl_renderer_poll(void)
 void virgl_renderer_cleanup(void *cookie)
 {
    vrend_renderer_fini();
+   vrend_trace_fini();
 #ifdef HAVE_EPOXY_EGL_H
    if (use_context == CONTEXT_EGL) {
       virgl_egl_destroy(egl_info);
@@ -291,6 +336,7 @@ void virgl_renderer_cleanup(void *cookie)
 int virgl_renderer_init(void *cookie, int flags, struct virgl_renderer_callbacks *cbs)
 {
    uint32_t renderer_flags = 0;
+   const char *trace_file;
    if (!cookie || !cbs)
       return -1;
 
@@ -324,6 +370,12 @@ int virgl_renderer_init(void *cookie, int flags, struct virgl_renderer_callbacks
 
    if (flags & VIRGL_RENDERER_THREAD_SYNC)
       renderer_flags |= VREND_USE_THREAD_SYNC;
+   if (flags & VIRGL_RENDERER_ASYNC_READBACK)
+      renderer_flags |= VREND_USE_ASYNC_READBACK;
+
+   trace_file = getenv("VIRGL_TRACE_FILE");
+   if (trace_file && trace_file[0])
+      vrend_trace_init(trace_file);
 
    return vrend_renderer_init(&virgl_cbs, renderer_flags);
 }
@@ -339,6 +391,7 @@ int virgl_renderer_get_fd_for_texture(uint32_t tex_id, int *fd)
 
 void virgl_renderer_reset(void)
 {
+   vrend_trace_record(VREND_TRACE_RESET, NULL, 0, NULL, 0);
    vrend_renderer_reset();
 }
 
@@ -346,3 +399,46 @@ int virgl_renderer_get_poll_fd(void)
 {
    return vrend_renderer_get_poll_fd();
 }
+
+/* the internal stats structs are filled in place of the public ones */
+#define STATS_ASSERT_MEMBER(vs, ps, m) \
+   STATIC_ASSERT(offsetof(struct vs, m) == offsetof(struct ps, m) && \
+                 sizeof(((struct vs *)0)->m) == sizeof(((struct ps *)0)->m))
+
+int virgl_renderer_get_stats(uint32_t ctx_id, struct virgl_renderer_stats *stats)
+{
+   STATIC_ASSERT(sizeof(struct vrend_renderer_cmd_stats) ==
+                 sizeof(struct virgl_renderer_cmd_stats));
+   STATS_ASSERT_MEMBER(vrend_renderer_cmd_stats, virgl_renderer_cmd_stats, count);
+   STATS_ASSERT_MEMBER(vrend_renderer_cmd_stats, virgl_renderer_cmd_stats, total_ns);
+   STATS_ASSERT_MEMBER(vrend_renderer_cmd_stats, virgl_renderer_cmd_stats, elided);
+   STATS_ASSERT_MEMBER(vrend_renderer_cmd_stats, virgl_renderer_cmd_stats, histogram);
+
+   STATIC_ASSERT(sizeof(struct vrend_slab_stats) ==
+                 sizeof(struct virgl_renderer_slab_stats));
+   STATS_ASSERT_MEMBER(vrend_slab_stats, virgl_renderer_slab_stats, allocs);
+   STATS_ASSERT_MEMBER(vrend_slab_stats, virgl_renderer_slab_stats, frees);
+   STATS_ASSERT_MEMBER(vrend_slab_stats, virgl_renderer_slab_stats, chunks);
+   STATS_ASSERT_MEMBER(vrend_slab_stats, virgl_renderer_slab_stats, live);
+   STATS_ASSERT_MEMBER(vrend_slab_stats, virgl_renderer_slab_stats, peak);
+   STATS_ASSERT_MEMBER(vrend_slab_stats, virgl_renderer_slab_stats, footprint);
+
+   STATIC_ASSERT(sizeof(struct vrend_renderer_stats) ==
+                 sizeof(struct virgl_renderer_stats));
+   STATS_ASSERT_MEMBER(vrend_renderer_stats, virgl_renderer_stats, cmds);
+   STATS_ASSERT_MEMBER(vrend_renderer_stats, virgl_renderer_stats, objects);
+   STATS_ASSERT_MEMBER(vrend_renderer_stats, virgl_renderer_stats, slabs);
+   STATS_ASSERT_MEMBER(vrend_renderer_stats, virgl_renderer_stats, rs_emits);
+   STATS_ASSERT_MEMBER(vrend_renderer_stats, virgl_renderer_stats, rs_gl_calls);
+
+   /* slabs[] is indexed by the internal slab type */
+   STATIC_ASSERT((int)VREND_SLAB_SURFACE == (int)VIRGL_RENDERER_SLAB_SURFACE);
+   STATIC_ASSERT((int)VREND_SLAB_SAMPLER_VIEW == (int)VIRGL_RENDERER_SLAB_SAMPLER_VIEW);
+   STATIC_ASSERT((int)VREND_SLAB_SAMPLER_STATE == (int)VIRGL_RENDERER_SLAB_SAMPLER_STATE);
+   STATIC_ASSERT((int)VREND_SLAB_QUERY == (int)VIRGL_RENDERER_SLAB_QUERY);
+   STATIC_ASSERT((int)VREND_SLAB_SHADER_SELECTOR == (int)VIRGL_RENDERER_SLAB_SHADER_SELECTOR);
+   STATIC_ASSERT((int)VREND_SLAB_SHADER == (int)VIRGL_RENDERER_SLAB_SHADER);
+   STATIC_ASSERT((int)VREND_SLAB_COUNT == (int)VIRGL_RENDERER_SLAB_COUNT);
+
+   return vrend_renderer_get_stats(ctx_id, (struct vrend_renderer_stats *)stats);
+}
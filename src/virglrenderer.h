@@ -62,6 +62,12 @@ struct virgl_renderer_callbacks {
  */
 #define VIRGL_RENDERER_THREAD_SYNC 2
 #define VIRGL_RENDERER_USE_GLX (1 << 2)
+/*
+ * Texture reads from the attached backing complete asynchronously,
+ * the data is only guaranteed to be there once a fence created after
+ * the transfer has been written.
+ */
+#define VIRGL_RENDERER_ASYNC_READBACK (1 << 3)
 
 VIRGL_EXPORT int virgl_renderer_init(void *cookie, int flags, struct virgl_renderer_callbacks *cb);
 VIRGL_EXPORT void virgl_renderer_poll(void); /* force fences */
@@ -170,4 +176,56 @@ VIRGL_EXPORT void virgl_renderer_reset(void);
 
 VIRGL_EXPORT int virgl_renderer_get_poll_fd(void);
 
+/* per context command decode statistics, only collected when the
+   VIRGL_DECODE_STATS environment variable is set */
+#define VIRGL_RENDERER_STATS_MAX_CMDS 64
+#define VIRGL_RENDERER_STATS_MAX_OBJECTS 32
+#define VIRGL_RENDERER_STATS_BUCKETS 32
+#define VIRGL_RENDERER_STATS_MAX_SLABS 8
+
+enum virgl_renderer_slab_type {
+   VIRGL_RENDERER_SLAB_SURFACE,
+   VIRGL_RENDERER_SLAB_SAMPLER_VIEW,
+   VIRGL_RENDERER_SLAB_SAMPLER_STATE,
+   VIRGL_RENDERER_SLAB_QUERY,
+   VIRGL_RENDERER_SLAB_SHADER_SELECTOR,
+   VIRGL_RENDERER_SLAB_SHADER,
+   VIRGL_RENDERER_SLAB_COUNT,
+};
+
+struct virgl_renderer_cmd_stats {
+   uint64_t count;
+   uint64_t total_ns;
+   /* commands dropped because they repeated the current state */
+   uint64_t elided;
+   /* bucket i counts commands that took [2^i, 2^(i+1)) ns */
+   uint64_t histogram[VIRGL_RENDERER_STATS_BUCKETS];
+};
+
+struct virgl_renderer_slab_stats {
+   uint64_t allocs;
+   uint64_t frees;
+   /* backing allocations, the malloc traffic that is left */
+   uint64_t chunks;
+   uint32_t live;
+   uint32_t peak;
+   /* bytes held by the allocator, used or not */
+   uint64_t footprint;
+};
+
+struct virgl_renderer_stats {
+   /* indexed by command type */
+   struct virgl_renderer_cmd_stats cmds[VIRGL_RENDERER_STATS_MAX_CMDS];
+   /* object creation, indexed by object type */
+   struct virgl_renderer_cmd_stats objects[VIRGL_RENDERER_STATS_MAX_OBJECTS];
+   /* per context object allocators, indexed by virgl_renderer_slab_type */
+   struct virgl_renderer_slab_stats slabs[VIRGL_RENDERER_STATS_MAX_SLABS];
+   /* rasterizer state binds, and the GL calls needed to apply them */
+   uint64_t rs_emits;
+   uint64_t rs_gl_calls;
+};
+
+VIRGL_EXPORT int virgl_renderer_get_stats(uint32_t ctx_id,
+                                          struct virgl_renderer_stats *stats);
+
 #endif
@@ -25,6 +25,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 #include <epoxy/gl.h>
 
 #include "util/u_memory.h"
@@ -46,9 +47,11 @@ struct vrend_decoder_state {
 struct vrend_decode_ctx {
    struct vrend_decoder_state ids, *ds;
    struct vrend_context *grctx;
+   /* only allocated when command statistics are enabled */
+   struct vrend_renderer_stats *stats;
 };
-#define VREND_MAX_CTX 64
 static struct vrend_decode_ctx *dec_ctx[VREND_MAX_CTX];
+static bool decode_stats_enabled;
 
 static inline uint32_t get_buf_entry(struct vrend_decode_ctx *ctx, uint32_t offset)
 {
@@ -61,6 +64,19 @@ static inline void *get_buf_ptr(struct vrend_decode_ctx *ctx,
    return &ctx->ds->buf[ctx->ds->buf_offset + offset];
 }
 
+/* true if the payload of cmd repeats the state that is already set */
+static inline bool vrend_decode_is_redundant(struct vrend_decode_ctx *ctx,
+                                             enum vrend_state_shadow_type type,
+                                             uint32_t cmd, int length)
+{
+   if (!vrend_state_is_redundant(ctx->grctx, type, get_buf_ptr(ctx, 1), length))
+      return false;
+
+   if (unlikely(ctx->stats))
+      ctx->stats->cmds[cmd].elided++;
+   return true;
+}
+
 static int vrend_decode_create_shader(struct vrend_decode_ctx *ctx,
                                       uint32_t handle,
                                       uint16_t length)
@@ -71,11 +87,14 @@ static int vrend_decode_create_shader(struct vrend_decode_ctx *ctx,
    unsigned num_tokens, num_so_outputs, offlen;
    uint8_t *shd_text;
    uint32_t type;
+   bool binary_tokens;
 
    if (length < 5)
       return EINVAL;
 
    type = get_buf_entry(ctx, VIRGL_OBJ_SHADER_TYPE);
+   binary_tokens = (type & VIRGL_OBJ_SHADER_TYPE_TOKENS) ? true : false;
+   type &= ~VIRGL_OBJ_SHADER_TYPE_TOKENS;
    num_tokens = get_buf_entry(ctx, VIRGL_OBJ_SHADER_NUM_TOKENS);
    offlen = get_buf_entry(ctx, VIRGL_OBJ_SHADER_OFFSET);
    num_so_outputs = get_buf_entry(ctx, VIRGL_OBJ_SHADER_SO_NUM_OUTPUTS);
@@ -106,7 +125,7 @@ static int vrend_decode_create_shader(struct vrend_decode_ctx *ctx,
      memset(&so_info, 0, sizeof(so_info));
 
    shd_text = get_buf_ptr(ctx, shader_offset);
-   ret = vrend_create_shader(ctx->grctx, handle, &so_info, (const char *)shd_text, offlen, num_tokens, type, length - shader_offset + 1);
+   ret = vrend_create_shader(ctx->grctx, handle, &so_info, (const char *)shd_text, offlen, num_tokens, type, binary_tokens, length - shader_offset + 1);
 
    return ret;
 }
@@ -128,18 +147,12 @@ static int vrend_decode_create_stream_output_target(struct vrend_decode_ctx *ctx
 
 static int vrend_decode_set_framebuffer_state(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length < 2)
-      return EINVAL;
-
    uint32_t nr_cbufs = get_buf_entry(ctx, VIRGL_SET_FRAMEBUFFER_STATE_NR_CBUFS);
    uint32_t zsurf_handle = get_buf_entry(ctx, VIRGL_SET_FRAMEBUFFER_STATE_NR_ZSURF_HANDLE);
    uint32_t surf_handle[8];
    int i;
 
-   if (length != (2 + nr_cbufs))
-      return EINVAL;
-
-   if (nr_cbufs > 8)
+   if (length != VIRGL_SET_FRAMEBUFFER_STATE_SIZE(nr_cbufs))
       return EINVAL;
 
    for (i = 0; i < nr_cbufs; i++)
@@ -155,8 +168,6 @@ static int vrend_decode_clear(struct vrend_decode_ctx *ctx, int length)
    unsigned stencil, buffers;
    int i;
 
-   if (length != VIRGL_OBJ_CLEAR_SIZE)
-      return EINVAL;
    buffers = get_buf_entry(ctx, VIRGL_OBJ_CLEAR_BUFFERS);
    for (i = 0; i < 4; i++)
       color.ui[i] = get_buf_entry(ctx, VIRGL_OBJ_CLEAR_COLOR_0 + i);
@@ -179,8 +190,6 @@ static int vrend_decode_set_viewport_state(struct vrend_decode_ctx *ctx, int len
    struct pipe_viewport_state vps[PIPE_MAX_VIEWPORTS];
    int i, v;
    uint32_t num_viewports, start_slot;
-   if (length < 1)
-      return EINVAL;
 
    if ((length - 1) % 6)
       return EINVAL;
@@ -188,10 +197,13 @@ static int vrend_decode_set_viewport_state(struct vrend_decode_ctx *ctx, int len
    num_viewports = (length - 1) / 6;
    start_slot = get_buf_entry(ctx, VIRGL_SET_VIEWPORT_START_SLOT);
 
-   if (num_viewports > PIPE_MAX_VIEWPORTS ||
-       start_slot > (PIPE_MAX_VIEWPORTS - num_viewports))
+   if (start_slot > (PIPE_MAX_VIEWPORTS - num_viewports))
       return EINVAL;
 
+   if (vrend_decode_is_redundant(ctx, VREND_SHADOW_VIEWPORT,
+                                 VIRGL_CCMD_SET_VIEWPORT_STATE, length))
+      return 0;
+
    for (v = 0; v < num_viewports; v++) {
       for (i = 0; i < 3; i++)
          vps[v].scale[i] = uif(get_buf_entry(ctx, VIRGL_SET_VIEWPORT_STATE_SCALE_0(v) + i));
@@ -205,7 +217,7 @@ static int vrend_decode_set_viewport_state(struct vrend_decode_ctx *ctx, int len
 
 static int vrend_decode_set_index_buffer(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 1 && length != 3)
+   if (length == 2)
       return EINVAL;
    vrend_set_index_buffer(ctx->grctx,
                           get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_HANDLE),
@@ -214,15 +226,12 @@ static int vrend_decode_set_index_buffer(struct vrend_decode_ctx *ctx, int lengt
    return 0;
 }
 
-static int vrend_decode_set_constant_buffer(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_set_constant_buffer(struct vrend_decode_ctx *ctx, int length)
 {
    uint32_t shader;
    uint32_t index;
    int nc = (length - 2);
 
-   if (length < 2)
-      return EINVAL;
-
    shader = get_buf_entry(ctx, VIRGL_SET_CONSTANT_BUFFER_SHADER_TYPE);
    index = get_buf_entry(ctx, VIRGL_SET_CONSTANT_BUFFER_INDEX);
 
@@ -235,9 +244,6 @@ static int vrend_decode_set_constant_buffer(struct vrend_decode_ctx *ctx, uint16
 
 static int vrend_decode_set_uniform_buffer(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != VIRGL_SET_UNIFORM_BUFFER_SIZE)
-      return EINVAL;
-
    uint32_t shader = get_buf_entry(ctx, VIRGL_SET_UNIFORM_BUFFER_SHADER_TYPE);
    uint32_t index = get_buf_entry(ctx, VIRGL_SET_UNIFORM_BUFFER_INDEX);
    uint32_t offset = get_buf_entry(ctx, VIRGL_SET_UNIFORM_BUFFER_OFFSET);
@@ -254,7 +260,7 @@ static int vrend_decode_set_uniform_buffer(struct vrend_decode_ctx *ctx, int len
    return 0;
 }
 
-static int vrend_decode_set_vertex_buffers(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_set_vertex_buffers(struct vrend_decode_ctx *ctx, int length)
 {
    int num_vbo;
    int i;
@@ -264,9 +270,6 @@ static int vrend_decode_set_vertex_buffers(struct vrend_decode_ctx *ctx, uint16_
       return EINVAL;
 
    num_vbo = (length / 3);
-   if (num_vbo > PIPE_MAX_ATTRIBS)
-      return EINVAL;
-
    for (i = 0; i < num_vbo; i++) {
       vrend_set_single_vbo(ctx->grctx, i,
                            get_buf_entry(ctx, VIRGL_SET_VERTEX_BUFFER_STRIDE(i)),
@@ -277,14 +280,12 @@ static int vrend_decode_set_vertex_buffers(struct vrend_decode_ctx *ctx, uint16_
    return 0;
 }
 
-static int vrend_decode_set_sampler_views(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_set_sampler_views(struct vrend_decode_ctx *ctx, int length)
 {
    int num_samps;
    int i;
    uint32_t shader_type, start_slot;
 
-   if (length < 2)
-      return EINVAL;
    num_samps = length - 2;
    shader_type = get_buf_entry(ctx, VIRGL_SET_SAMPLER_VIEWS_SHADER_TYPE);
    start_slot = get_buf_entry(ctx, VIRGL_SET_SAMPLER_VIEWS_START_SLOT);
@@ -292,8 +293,7 @@ static int vrend_decode_set_sampler_views(struct vrend_decode_ctx *ctx, uint16_t
    if (shader_type >= PIPE_SHADER_TYPES)
       return EINVAL;
 
-   if (num_samps > PIPE_MAX_SHADER_SAMPLER_VIEWS ||
-       start_slot > (PIPE_MAX_SHADER_SAMPLER_VIEWS - num_samps))
+   if (start_slot > (PIPE_MAX_SHADER_SAMPLER_VIEWS - num_samps))
       return EINVAL;
 
    for (i = 0; i < num_samps; i++) {
@@ -304,7 +304,7 @@ static int vrend_decode_set_sampler_views(struct vrend_decode_ctx *ctx, uint16_t
    return 0;
 }
 
-static int vrend_decode_resource_inline_write(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_resource_inline_write(struct vrend_decode_ctx *ctx, int length)
 {
    struct vrend_transfer_info info;
    struct pipe_box box;
@@ -313,12 +313,6 @@ static int vrend_decode_resource_inline_write(struct vrend_decode_ctx *ctx, uint
    struct iovec dataiovec;
    void *data;
 
-   if (length < 12)
-      return EINVAL;
-
-   if (length + ctx->ds->buf_offset > ctx->ds->buf_total)
-      return EINVAL;
-
    res_handle = get_buf_entry(ctx, VIRGL_RESOURCE_IW_RES_HANDLE);
    data_len = (length - 11) * 4;
    level = get_buf_entry(ctx, VIRGL_RESOURCE_IW_LEVEL);
@@ -350,45 +344,95 @@ static int vrend_decode_resource_inline_write(struct vrend_decode_ctx *ctx, uint
    return vrend_transfer_inline_write(ctx->grctx, &info, usage);
 }
 
+static void vrend_decode_draw_info(struct vrend_decode_ctx *ctx, int length,
+                                   struct pipe_draw_info *info)
+{
+   memset(info, 0, sizeof(struct pipe_draw_info));
+
+   info->start = get_buf_entry(ctx, VIRGL_DRAW_VBO_START);
+   info->count = get_buf_entry(ctx, VIRGL_DRAW_VBO_COUNT);
+   info->mode = get_buf_entry(ctx, VIRGL_DRAW_VBO_MODE);
+   info->indexed = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDEXED);
+   info->instance_count = get_buf_entry(ctx, VIRGL_DRAW_VBO_INSTANCE_COUNT);
+   info->index_bias = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDEX_BIAS);
+   info->start_instance = get_buf_entry(ctx, VIRGL_DRAW_VBO_START_INSTANCE);
+   info->primitive_restart = get_buf_entry(ctx, VIRGL_DRAW_VBO_PRIMITIVE_RESTART);
+   info->restart_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_RESTART_INDEX);
+   info->min_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_MIN_INDEX);
+   info->max_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_MAX_INDEX);
+
+   if (length >= VIRGL_DRAW_VBO_SIZE_TESS) {
+      info->vertices_per_patch = get_buf_entry(ctx, VIRGL_DRAW_VBO_VERTICES_PER_PATCH);
+      info->drawid = get_buf_entry(ctx, VIRGL_DRAW_VBO_DRAWID);
+   }
+}
+
+/* draws can go into one multi draw call if only their ranges differ */
+static bool vrend_decode_draws_compatible(const struct pipe_draw_info *a,
+                                          const struct pipe_draw_info *b)
+{
+   return a->mode == b->mode &&
+      a->indexed == b->indexed &&
+      a->instance_count <= 1 && b->instance_count <= 1 &&
+      a->primitive_restart == b->primitive_restart &&
+      (!a->primitive_restart || a->restart_index == b->restart_index) &&
+      a->vertices_per_patch == b->vertices_per_patch;
+}
+
 static int vrend_decode_draw_vbo(struct vrend_decode_ctx *ctx, int length)
 {
-   struct pipe_draw_info info;
+   struct pipe_draw_info infos[VREND_MAX_DRAW_BATCH];
+   struct pipe_draw_info *info = &infos[0];
    uint32_t cso;
    uint32_t handle = 0, indirect_draw_count_handle = 0;
+   uint32_t num_draws = 1;
+
    if (length != VIRGL_DRAW_VBO_SIZE && length != VIRGL_DRAW_VBO_SIZE_TESS &&
        length != VIRGL_DRAW_VBO_SIZE_INDIRECT)
       return EINVAL;
-   memset(&info, 0, sizeof(struct pipe_draw_info));
-
-   info.start = get_buf_entry(ctx, VIRGL_DRAW_VBO_START);
-   info.count = get_buf_entry(ctx, VIRGL_DRAW_VBO_COUNT);
-   info.mode = get_buf_entry(ctx, VIRGL_DRAW_VBO_MODE);
-   info.indexed = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDEXED);
-   info.instance_count = get_buf_entry(ctx, VIRGL_DRAW_VBO_INSTANCE_COUNT);
-   info.index_bias = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDEX_BIAS);
-   info.start_instance = get_buf_entry(ctx, VIRGL_DRAW_VBO_START_INSTANCE);
-   info.primitive_restart = get_buf_entry(ctx, VIRGL_DRAW_VBO_PRIMITIVE_RESTART);
-   info.restart_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_RESTART_INDEX);
-   info.min_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_MIN_INDEX);
-   info.max_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_MAX_INDEX);
 
-   if (length >= VIRGL_DRAW_VBO_SIZE_TESS) {
-      info.vertices_per_patch = get_buf_entry(ctx, VIRGL_DRAW_VBO_VERTICES_PER_PATCH);
-      info.drawid = get_buf_entry(ctx, VIRGL_DRAW_VBO_DRAWID);
-   }
+   vrend_decode_draw_info(ctx, length, info);
 
    if (length == VIRGL_DRAW_VBO_SIZE_INDIRECT) {
       handle = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_HANDLE);
-      info.indirect.offset = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_OFFSET);
-      info.indirect.stride = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_STRIDE);
-      info.indirect.draw_count = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT);
-      info.indirect.indirect_draw_count_offset = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT_OFFSET);
+      info->indirect.offset = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_OFFSET);
+      info->indirect.stride = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_STRIDE);
+      info->indirect.draw_count = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT);
+      info->indirect.indirect_draw_count_offset = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT_OFFSET);
       indirect_draw_count_handle = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT_HANDLE);
    }
 
    cso = get_buf_entry(ctx, VIRGL_DRAW_VBO_COUNT_FROM_SO);
 
-   vrend_draw_vbo(ctx->grctx, &info, cso, handle, indirect_draw_count_handle);
+   if (length == VIRGL_DRAW_VBO_SIZE_INDIRECT || cso ||
+       info->instance_count > 1) {
+      vrend_draw_vbo(ctx->grctx, info, cso, handle, indirect_draw_count_handle);
+      return 0;
+   }
+
+   /* Pull in the directly following draws that can share the state setup.
+      They must have the same header, so that the length the caller uses
+      to step over this command is still right when buf_offset is left at
+      the last one that was merged. */
+   while (num_draws < VREND_MAX_DRAW_BATCH) {
+      uint32_t cur = ctx->ds->buf_offset;
+      uint32_t next = cur + length + 1;
+
+      if (next + length + 1 > ctx->ds->buf_total ||
+          ctx->ds->buf[next] != ctx->ds->buf[cur] ||
+          ctx->ds->buf[next + VIRGL_DRAW_VBO_COUNT_FROM_SO])
+         break;
+
+      ctx->ds->buf_offset = next;
+      vrend_decode_draw_info(ctx, length, &infos[num_draws]);
+      if (!vrend_decode_draws_compatible(info, &infos[num_draws])) {
+         ctx->ds->buf_offset = cur;
+         break;
+      }
+      num_draws++;
+   }
+
+   vrend_draw_vbo_multi(ctx->grctx, infos, num_draws);
    return 0;
 }
 
@@ -671,9 +715,6 @@ static int vrend_decode_create_query(struct vrend_decode_ctx *ctx, uint32_t hand
 
 static int vrend_decode_create_object(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length < 1)
-      return EINVAL;
-
    uint32_t header = get_buf_entry(ctx, VIRGL_OBJ_CREATE_HEADER);
    uint32_t handle = get_buf_entry(ctx, VIRGL_OBJ_CREATE_HANDLE);
    uint8_t obj_type = (header >> 8) & 0xff;
@@ -720,11 +761,8 @@ static int vrend_decode_create_object(struct vrend_decode_ctx *ctx, int length)
    return ret;
 }
 
-static int vrend_decode_bind_object(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_bind_object(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 1)
-      return EINVAL;
-
    uint32_t header = get_buf_entry(ctx, VIRGL_OBJ_BIND_HEADER);
    uint32_t handle = get_buf_entry(ctx, VIRGL_OBJ_BIND_HANDLE);
    uint8_t obj_type = (header >> 8) & 0xff;
@@ -751,9 +789,6 @@ static int vrend_decode_bind_object(struct vrend_decode_ctx *ctx, uint16_t lengt
 
 static int vrend_decode_destroy_object(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 1)
-      return EINVAL;
-
    uint32_t handle = get_buf_entry(ctx, VIRGL_OBJ_DESTROY_HANDLE);
 
    vrend_renderer_object_destroy(ctx->grctx, handle);
@@ -762,12 +797,13 @@ static int vrend_decode_destroy_object(struct vrend_decode_ctx *ctx, int length)
 
 static int vrend_decode_set_stencil_ref(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != VIRGL_SET_STENCIL_REF_SIZE)
-      return EINVAL;
-
    struct pipe_stencil_ref ref;
    uint32_t val = get_buf_entry(ctx, VIRGL_SET_STENCIL_REF);
 
+   if (vrend_decode_is_redundant(ctx, VREND_SHADOW_STENCIL_REF,
+                                 VIRGL_CCMD_SET_STENCIL_REF, length))
+      return 0;
+
    ref.ref_value[0] = val & 0xff;
    ref.ref_value[1] = (val >> 8) & 0xff;
    vrend_set_stencil_ref(ctx->grctx, &ref);
@@ -779,8 +815,9 @@ static int vrend_decode_set_blend_color(struct vrend_decode_ctx *ctx, int length
    struct pipe_blend_color color;
    int i;
 
-   if (length != VIRGL_SET_BLEND_COLOR_SIZE)
-      return EINVAL;
+   if (vrend_decode_is_redundant(ctx, VREND_SHADOW_BLEND_COLOR,
+                                 VIRGL_CCMD_SET_BLEND_COLOR, length))
+      return 0;
 
    for (i = 0; i < 4; i++)
       color.color[i] = uif(get_buf_entry(ctx, VIRGL_SET_BLEND_COLOR(i)));
@@ -795,17 +832,19 @@ static int vrend_decode_set_scissor_state(struct vrend_decode_ctx *ctx, int leng
    uint32_t temp;
    uint32_t num_scissor, start_slot;
    int s;
-   if (length < 1)
-      return EINVAL;
 
    if ((length - 1) % 2)
       return EINVAL;
 
    num_scissor = (length - 1) / 2;
-   if (num_scissor > PIPE_MAX_VIEWPORTS)
+   start_slot = get_buf_entry(ctx, VIRGL_SET_SCISSOR_START_SLOT);
+
+   if (start_slot > (PIPE_MAX_VIEWPORTS - num_scissor))
       return EINVAL;
 
-   start_slot = get_buf_entry(ctx, VIRGL_SET_SCISSOR_START_SLOT);
+   if (vrend_decode_is_redundant(ctx, VREND_SHADOW_SCISSOR,
+                                 VIRGL_CCMD_SET_SCISSOR_STATE, length))
+      return 0;
 
    for (s = 0; s < num_scissor; s++) {
       temp = get_buf_entry(ctx, VIRGL_SET_SCISSOR_MINX_MINY(s));
@@ -826,9 +865,6 @@ static int vrend_decode_set_polygon_stipple(struct vrend_decode_ctx *ctx, int le
    struct pipe_poly_stipple ps;
    int i;
 
-   if (length != VIRGL_POLYGON_STIPPLE_SIZE)
-      return EINVAL;
-
    for (i = 0; i < 32; i++)
       ps.stipple[i] = get_buf_entry(ctx, VIRGL_POLYGON_STIPPLE_P0 + i);
 
@@ -841,8 +877,9 @@ static int vrend_decode_set_clip_state(struct vrend_decode_ctx *ctx, int length)
    struct pipe_clip_state clip;
    int i, j;
 
-   if (length != VIRGL_SET_CLIP_STATE_SIZE)
-      return EINVAL;
+   if (vrend_decode_is_redundant(ctx, VREND_SHADOW_CLIP,
+                                 VIRGL_CCMD_SET_CLIP_STATE, length))
+      return 0;
 
    for (i = 0; i < 8; i++)
       for (j = 0; j < 4; j++)
@@ -855,8 +892,10 @@ static int vrend_decode_set_sample_mask(struct vrend_decode_ctx *ctx, int length
 {
    unsigned mask;
 
-   if (length != VIRGL_SET_SAMPLE_MASK_SIZE)
-      return EINVAL;
+   if (vrend_decode_is_redundant(ctx, VREND_SHADOW_SAMPLE_MASK,
+                                 VIRGL_CCMD_SET_SAMPLE_MASK, length))
+      return 0;
+
    mask = get_buf_entry(ctx, VIRGL_SET_SAMPLE_MASK_MASK);
    vrend_set_sample_mask(ctx->grctx, mask);
    return 0;
@@ -869,9 +908,6 @@ static int vrend_decode_resource_copy_region(struct vrend_decode_ctx *ctx, int l
    uint32_t dst_level, dstx, dsty, dstz;
    uint32_t src_level;
 
-   if (length != VIRGL_CMD_RESOURCE_COPY_REGION_SIZE)
-      return EINVAL;
-
    dst_handle = get_buf_entry(ctx, VIRGL_CMD_RCR_DST_RES_HANDLE);
    dst_level = get_buf_entry(ctx, VIRGL_CMD_RCR_DST_LEVEL);
    dstx = get_buf_entry(ctx, VIRGL_CMD_RCR_DST_X);
@@ -899,8 +935,6 @@ static int vrend_decode_blit(struct vrend_decode_ctx *ctx, int length)
    struct pipe_blit_info info;
    uint32_t dst_handle, src_handle, temp;
 
-   if (length != VIRGL_CMD_BLIT_SIZE)
-      return EINVAL;
    temp = get_buf_entry(ctx, VIRGL_CMD_BLIT_S0);
    info.mask = temp & 0xff;
    info.filter = (temp >> 8) & 0x3;
@@ -939,9 +973,6 @@ static int vrend_decode_blit(struct vrend_decode_ctx *ctx, int length)
 
 static int vrend_decode_bind_sampler_states(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length < 2)
-      return EINVAL;
-
    uint32_t shader_type = get_buf_entry(ctx, VIRGL_BIND_SAMPLER_STATES_SHADER_TYPE);
    uint32_t start_slot = get_buf_entry(ctx, VIRGL_BIND_SAMPLER_STATES_START_SLOT);
    uint32_t num_states = length - 2;
@@ -956,9 +987,6 @@ static int vrend_decode_bind_sampler_states(struct vrend_decode_ctx *ctx, int le
 
 static int vrend_decode_begin_query(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 1)
-      return EINVAL;
-
    uint32_t handle = get_buf_entry(ctx, VIRGL_QUERY_BEGIN_HANDLE);
 
    vrend_begin_query(ctx->grctx, handle);
@@ -967,9 +995,6 @@ static int vrend_decode_begin_query(struct vrend_decode_ctx *ctx, int length)
 
 static int vrend_decode_end_query(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 1)
-      return EINVAL;
-
    uint32_t handle = get_buf_entry(ctx, VIRGL_QUERY_END_HANDLE);
 
    vrend_end_query(ctx->grctx, handle);
@@ -978,9 +1003,6 @@ static int vrend_decode_end_query(struct vrend_decode_ctx *ctx, int length)
 
 static int vrend_decode_get_query_result(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 2)
-      return EINVAL;
-
    uint32_t handle = get_buf_entry(ctx, VIRGL_QUERY_RESULT_HANDLE);
    uint32_t wait = get_buf_entry(ctx, VIRGL_QUERY_RESULT_WAIT);
 
@@ -990,9 +1012,6 @@ static int vrend_decode_get_query_result(struct vrend_decode_ctx *ctx, int lengt
 
 static int vrend_decode_set_render_condition(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != VIRGL_RENDER_CONDITION_SIZE)
-      return EINVAL;
-
    uint32_t handle = get_buf_entry(ctx, VIRGL_RENDER_CONDITION_HANDLE);
    bool condition = get_buf_entry(ctx, VIRGL_RENDER_CONDITION_CONDITION) & 1;
    uint mode = get_buf_entry(ctx, VIRGL_RENDER_CONDITION_MODE);
@@ -1003,9 +1022,6 @@ static int vrend_decode_set_render_condition(struct vrend_decode_ctx *ctx, int l
 
 static int vrend_decode_set_sub_ctx(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 1)
-      return EINVAL;
-
    uint32_t ctx_sub_id = get_buf_entry(ctx, 1);
 
    vrend_renderer_set_sub_ctx(ctx->grctx, ctx_sub_id);
@@ -1014,9 +1030,6 @@ static int vrend_decode_set_sub_ctx(struct vrend_decode_ctx *ctx, int length)
 
 static int vrend_decode_create_sub_ctx(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 1)
-      return EINVAL;
-
    uint32_t ctx_sub_id = get_buf_entry(ctx, 1);
 
    vrend_renderer_create_sub_ctx(ctx->grctx, ctx_sub_id);
@@ -1025,9 +1038,6 @@ static int vrend_decode_create_sub_ctx(struct vrend_decode_ctx *ctx, int length)
 
 static int vrend_decode_destroy_sub_ctx(struct vrend_decode_ctx *ctx, int length)
 {
-   if (length != 1)
-      return EINVAL;
-
    uint32_t ctx_sub_id = get_buf_entry(ctx, 1);
 
    vrend_renderer_destroy_sub_ctx(ctx->grctx, ctx_sub_id);
@@ -1037,8 +1047,6 @@ static int vrend_decode_destroy_sub_ctx(struct vrend_decode_ctx *ctx, int length
 static int vrend_decode_bind_shader(struct vrend_decode_ctx *ctx, int length)
 {
    uint32_t handle, type;
-   if (length != VIRGL_BIND_SHADER_SIZE)
-      return EINVAL;
 
    handle = get_buf_entry(ctx, VIRGL_BIND_SHADER_HANDLE);
    type = get_buf_entry(ctx, VIRGL_BIND_SHADER_TYPE);
@@ -1047,14 +1055,11 @@ static int vrend_decode_bind_shader(struct vrend_decode_ctx *ctx, int length)
    return 0;
 }
 
-static int vrend_decode_set_shader_buffers(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_set_shader_buffers(struct vrend_decode_ctx *ctx, int length)
 {
    int num_ssbo;
    uint32_t shader_type, start_slot;
 
-   if (length < 2)
-      return EINVAL;
-
    num_ssbo = (length - 2) / VIRGL_SET_SHADER_BUFFER_ELEMENT_SIZE;
    shader_type = get_buf_entry(ctx, VIRGL_SET_SHADER_BUFFER_SHADER_TYPE);
    start_slot = get_buf_entry(ctx, VIRGL_SET_SHADER_BUFFER_START_SLOT);
@@ -1080,12 +1085,10 @@ static int vrend_decode_set_shader_buffers(struct vrend_decode_ctx *ctx, uint16_
    return 0;
 }
 
-static int vrend_decode_set_shader_images(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_set_shader_images(struct vrend_decode_ctx *ctx, int length)
 {
    int num_images;
    uint32_t shader_type, start_slot;
-   if (length < 2)
-      return EINVAL;
 
    num_images = (length - 2) / VIRGL_SET_SHADER_IMAGE_ELEMENT_SIZE;
    shader_type = get_buf_entry(ctx, VIRGL_SET_SHADER_IMAGE_SHADER_TYPE);
@@ -1113,23 +1116,17 @@ static int vrend_decode_set_shader_images(struct vrend_decode_ctx *ctx, uint16_t
    return 0;
 }
 
-static int vrend_decode_memory_barrier(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_memory_barrier(struct vrend_decode_ctx *ctx, int length)
 {
-
-   if (length != 1)
-      return EINVAL;
-
    unsigned flags = get_buf_entry(ctx, VIRGL_MEMORY_BARRIER_FLAGS);
    vrend_memory_barrier(ctx->grctx, flags);
    return 0;
 }
 
-static int vrend_decode_launch_grid(struct vrend_decode_ctx *ctx, uint16_t length)
+static int vrend_decode_launch_grid(struct vrend_decode_ctx *ctx, int length)
 {
    uint32_t block[3], grid[3];
    uint32_t indirect_handle, indirect_offset;
-   if (length != VIRGL_LAUNCH_GRID_SIZE)
-      return EINVAL;
 
    block[0] = get_buf_entry(ctx, VIRGL_LAUNCH_BLOCK_X);
    block[1] = get_buf_entry(ctx, VIRGL_LAUNCH_BLOCK_Y);
@@ -1143,19 +1140,16 @@ static int vrend_decode_launch_grid(struct vrend_decode_ctx *ctx, uint16_t lengt
    return 0;
 }
 
+#define VREND_MAX_SO_TARGET_HANDLES 16
+
 static int vrend_decode_set_streamout_targets(struct vrend_decode_ctx *ctx,
-                                              uint16_t length)
+                                              int length)
 {
-   uint32_t handles[16];
+   uint32_t handles[VREND_MAX_SO_TARGET_HANDLES];
    uint32_t num_handles = length - 1;
    uint32_t append_bitmask;
    int i;
 
-   if (length < 1)
-      return EINVAL;
-   if (num_handles > ARRAY_SIZE(handles))
-      return EINVAL;
-
    append_bitmask = get_buf_entry(ctx, VIRGL_SET_STREAMOUT_TARGETS_APPEND_BITMASK);
    for (i = 0; i < num_handles; i++)
       handles[i] = get_buf_entry(ctx, VIRGL_SET_STREAMOUT_TARGETS_H0 + i);
@@ -1186,6 +1180,9 @@ void vrend_renderer_context_create_internal(uint32_t handle, uint32_t nlen,
    }
 
    dctx->ds = &dctx->ids;
+   dctx->stats = NULL;
+   if (decode_stats_enabled)
+      dctx->stats = CALLOC_STRUCT(vrend_renderer_stats);
 
    dec_ctx[handle] = dctx;
 }
@@ -1221,12 +1218,31 @@ void vrend_renderer_context_destroy(uint32_t handle)
       return;
    dec_ctx[handle] = NULL;
    ret = vrend_destroy_context(ctx->grctx);
+   free(ctx->stats);
    free(ctx);
    /* switch to ctx 0 */
    if (ret && handle != 0)
       vrend_hw_switch_context(dec_ctx[0]->grctx, true);
 }
 
+void vrend_decode_enable_stats(bool enable)
+{
+   decode_stats_enabled = enable;
+}
+
+int vrend_renderer_get_stats(uint32_t ctx_id, struct vrend_renderer_stats *stats)
+{
+   if (ctx_id >= VREND_MAX_CTX || !stats)
+      return EINVAL;
+
+   if (!dec_ctx[ctx_id] || !dec_ctx[ctx_id]->stats)
+      return EINVAL;
+
+   memcpy(stats, dec_ctx[ctx_id]->stats, sizeof(*stats));
+   vrend_renderer_fill_stats(dec_ctx[ctx_id]->grctx, stats);
+   return 0;
+}
+
 struct vrend_context *vrend_lookup_renderer_ctx(uint32_t ctx_id)
 {
    if (ctx_id >= VREND_MAX_CTX)
@@ -1238,6 +1254,132 @@ struct vrend_context *vrend_lookup_renderer_ctx(uint32_t ctx_id)
    return dec_ctx[ctx_id]->grctx;
 }
 
+struct vrend_decode_cmd {
+   int (*decode)(struct vrend_decode_ctx *ctx, int length);
+   /* payload length in dwords, not counting the header */
+   uint16_t min_length;
+   uint16_t max_length;
+};
+
+#define VREND_DECODE_ANY_LENGTH 0xffff
+
+#define DECODE_CMD(cmd, func, min, max) \
+   [VIRGL_CCMD_##cmd] = { vrend_decode_##func, (min), (max) }
+#define DECODE_CMD_FIXED(cmd, func, len) DECODE_CMD(cmd, func, len, len)
+
+/* The length is validated here once against the bounds of each command,
+   so that handlers of fixed size commands don't have to check it, and
+   handlers of variable size commands only need to check the layout. */
+static const struct vrend_decode_cmd decode_table[VIRGL_MAX_COMMANDS] = {
+   DECODE_CMD(CREATE_OBJECT, create_object, 1, VREND_DECODE_ANY_LENGTH),
+   DECODE_CMD_FIXED(BIND_OBJECT, bind_object, 1),
+   DECODE_CMD_FIXED(DESTROY_OBJECT, destroy_object, 1),
+   DECODE_CMD(SET_VIEWPORT_STATE, set_viewport_state,
+              VIRGL_SET_VIEWPORT_STATE_SIZE(0),
+              VIRGL_SET_VIEWPORT_STATE_SIZE(PIPE_MAX_VIEWPORTS)),
+   DECODE_CMD(SET_FRAMEBUFFER_STATE, set_framebuffer_state,
+              VIRGL_SET_FRAMEBUFFER_STATE_SIZE(0),
+              VIRGL_SET_FRAMEBUFFER_STATE_SIZE(PIPE_MAX_COLOR_BUFS)),
+   DECODE_CMD(SET_VERTEX_BUFFERS, set_vertex_buffers,
+              VIRGL_SET_VERTEX_BUFFERS_SIZE(0),
+              VIRGL_SET_VERTEX_BUFFERS_SIZE(PIPE_MAX_ATTRIBS)),
+   DECODE_CMD_FIXED(CLEAR, clear, VIRGL_OBJ_CLEAR_SIZE),
+   DECODE_CMD(DRAW_VBO, draw_vbo, VIRGL_DRAW_VBO_SIZE,
+              VIRGL_DRAW_VBO_SIZE_INDIRECT),
+   DECODE_CMD(RESOURCE_INLINE_WRITE, resource_inline_write, 12,
+              VREND_DECODE_ANY_LENGTH),
+   DECODE_CMD(SET_SAMPLER_VIEWS, set_sampler_views,
+              VIRGL_SET_SAMPLER_VIEWS_SIZE(0),
+              VIRGL_SET_SAMPLER_VIEWS_SIZE(PIPE_MAX_SHADER_SAMPLER_VIEWS)),
+   DECODE_CMD(SET_INDEX_BUFFER, set_index_buffer,
+              VIRGL_SET_INDEX_BUFFER_SIZE(0), VIRGL_SET_INDEX_BUFFER_SIZE(1)),
+   DECODE_CMD(SET_CONSTANT_BUFFER, set_constant_buffer, 2,
+              VREND_DECODE_ANY_LENGTH),
+   DECODE_CMD_FIXED(SET_STENCIL_REF, set_stencil_ref,
+                    VIRGL_SET_STENCIL_REF_SIZE),
+   DECODE_CMD_FIXED(SET_BLEND_COLOR, set_blend_color,
+                    VIRGL_SET_BLEND_COLOR_SIZE),
+   DECODE_CMD(SET_SCISSOR_STATE, set_scissor_state,
+              VIRGL_SET_SCISSOR_STATE_SIZE(0),
+              VIRGL_SET_SCISSOR_STATE_SIZE(PIPE_MAX_VIEWPORTS)),
+   DECODE_CMD_FIXED(BLIT, blit, VIRGL_CMD_BLIT_SIZE),
+   DECODE_CMD_FIXED(RESOURCE_COPY_REGION, resource_copy_region,
+                    VIRGL_CMD_RESOURCE_COPY_REGION_SIZE),
+   DECODE_CMD(BIND_SAMPLER_STATES, bind_sampler_states, 2,
+              VREND_DECODE_ANY_LENGTH),
+   DECODE_CMD_FIXED(BEGIN_QUERY, begin_query, 1),
+   DECODE_CMD_FIXED(END_QUERY, end_query, 1),
+   DECODE_CMD_FIXED(GET_QUERY_RESULT, get_query_result, 2),
+   DECODE_CMD_FIXED(SET_POLYGON_STIPPLE, set_polygon_stipple,
+                    VIRGL_POLYGON_STIPPLE_SIZE),
+   DECODE_CMD_FIXED(SET_CLIP_STATE, set_clip_state,
+                    VIRGL_SET_CLIP_STATE_SIZE),
+   DECODE_CMD_FIXED(SET_SAMPLE_MASK, set_sample_mask,
+                    VIRGL_SET_SAMPLE_MASK_SIZE),
+   DECODE_CMD(SET_STREAMOUT_TARGETS, set_streamout_targets, 1,
+              1 + VREND_MAX_SO_TARGET_HANDLES),
+   DECODE_CMD_FIXED(SET_RENDER_CONDITION, set_render_condition,
+                    VIRGL_RENDER_CONDITION_SIZE),
+   DECODE_CMD_FIXED(SET_UNIFORM_BUFFER, set_uniform_buffer,
+                    VIRGL_SET_UNIFORM_BUFFER_SIZE),
+   DECODE_CMD_FIXED(SET_SUB_CTX, set_sub_ctx, 1),
+   DECODE_CMD_FIXED(CREATE_SUB_CTX, create_sub_ctx, 1),
+   DECODE_CMD_FIXED(DESTROY_SUB_CTX, destroy_sub_ctx, 1),
+   DECODE_CMD_FIXED(BIND_SHADER, bind_shader, VIRGL_BIND_SHADER_SIZE),
+   DECODE_CMD(SET_SHADER_BUFFERS, set_shader_buffers, 2,
+              VREND_DECODE_ANY_LENGTH),
+   DECODE_CMD(SET_SHADER_IMAGES, set_shader_images, 2,
+              VREND_DECODE_ANY_LENGTH),
+   DECODE_CMD_FIXED(MEMORY_BARRIER, memory_barrier, 1),
+   DECODE_CMD_FIXED(LAUNCH_GRID, launch_grid, VIRGL_LAUNCH_GRID_SIZE),
+};
+
+static inline int vrend_decode_command(struct vrend_decode_ctx *ctx,
+                                       uint32_t header, uint32_t len)
+{
+   uint32_t cmd = header & 0xff;
+   const struct vrend_decode_cmd *entry;
+
+   if (cmd >= VIRGL_MAX_COMMANDS)
+      return EINVAL;
+
+   entry = &decode_table[cmd];
+   if (!entry->decode || len < entry->min_length || len > entry->max_length)
+      return EINVAL;
+
+   return entry->decode(ctx, len);
+}
+
+static inline uint64_t vrend_decode_time_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void vrend_decode_stat_add(struct vrend_renderer_cmd_stats *stat,
+                                  uint64_t ns)
+{
+   /* bucket i counts commands that took [2^i, 2^(i+1)) ns */
+   unsigned bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+   stat->count++;
+   stat->total_ns += ns;
+   stat->histogram[MIN2(bucket, VREND_STATS_BUCKETS - 1)]++;
+}
+
+static void vrend_decode_account(struct vrend_renderer_stats *stats,
+                                 uint32_t header, uint64_t ns)
+{
+   uint32_t cmd = header & 0xff;
+   uint32_t obj_type = (header >> 8) & 0xff;
+
+   if (cmd < VREND_STATS_MAX_CMDS)
+      vrend_decode_stat_add(&stats->cmds[cmd], ns);
+   if (cmd == VIRGL_CCMD_CREATE_OBJECT && obj_type < VREND_STATS_MAX_OBJECTS)
+      vrend_decode_stat_add(&stats->objects[obj_type], ns);
+}
+
 int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
 {
    struct vrend_decode_ctx *gdctx;
@@ -1271,115 +1413,13 @@ int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
       }
 //      fprintf(stderr,"[%d] cmd is %d (obj %d) len %d\n", gdctx->ds->buf_offset, header & 0xff, (header >> 8 & 0xff), (len));
 
-      switch (header & 0xff) {
-      case VIRGL_CCMD_CREATE_OBJECT:
-         ret = vrend_decode_create_object(gdctx, len);
-         break;
-      case VIRGL_CCMD_BIND_OBJECT:
-         ret = vrend_decode_bind_object(gdctx, len);
-         break;
-      case VIRGL_CCMD_DESTROY_OBJECT:
-         ret = vrend_decode_destroy_object(gdctx, len);
-         break;
-      case VIRGL_CCMD_CLEAR:
-         ret = vrend_decode_clear(gdctx, len);
-         break;
-      case VIRGL_CCMD_DRAW_VBO:
-         ret = vrend_decode_draw_vbo(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_FRAMEBUFFER_STATE:
-         ret = vrend_decode_set_framebuffer_state(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_VERTEX_BUFFERS:
-         ret = vrend_decode_set_vertex_buffers(gdctx, len);
-         break;
-      case VIRGL_CCMD_RESOURCE_INLINE_WRITE:
-         ret = vrend_decode_resource_inline_write(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_VIEWPORT_STATE:
-         ret = vrend_decode_set_viewport_state(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_SAMPLER_VIEWS:
-         ret = vrend_decode_set_sampler_views(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_INDEX_BUFFER:
-         ret = vrend_decode_set_index_buffer(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_CONSTANT_BUFFER:
-         ret = vrend_decode_set_constant_buffer(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_STENCIL_REF:
-         ret = vrend_decode_set_stencil_ref(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_BLEND_COLOR:
-         ret = vrend_decode_set_blend_color(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_SCISSOR_STATE:
-         ret = vrend_decode_set_scissor_state(gdctx, len);
-         break;
-      case VIRGL_CCMD_BLIT:
-         ret = vrend_decode_blit(gdctx, len);
-         break;
-      case VIRGL_CCMD_RESOURCE_COPY_REGION:
-         ret = vrend_decode_resource_copy_region(gdctx, len);
-         break;
-      case VIRGL_CCMD_BIND_SAMPLER_STATES:
-         ret = vrend_decode_bind_sampler_states(gdctx, len);
-         break;
-      case VIRGL_CCMD_BEGIN_QUERY:
-         ret = vrend_decode_begin_query(gdctx, len);
-         break;
-      case VIRGL_CCMD_END_QUERY:
-         ret = vrend_decode_end_query(gdctx, len);
-         break;
-      case VIRGL_CCMD_GET_QUERY_RESULT:
-         ret = vrend_decode_get_query_result(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_POLYGON_STIPPLE:
-         ret = vrend_decode_set_polygon_stipple(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_CLIP_STATE:
-         ret = vrend_decode_set_clip_state(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_SAMPLE_MASK:
-         ret = vrend_decode_set_sample_mask(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_STREAMOUT_TARGETS:
-         ret = vrend_decode_set_streamout_targets(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_RENDER_CONDITION:
-         ret = vrend_decode_set_render_condition(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_UNIFORM_BUFFER:
-         ret = vrend_decode_set_uniform_buffer(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_SUB_CTX:
-         ret = vrend_decode_set_sub_ctx(gdctx, len);
-         break;
-      case VIRGL_CCMD_CREATE_SUB_CTX:
-         ret = vrend_decode_create_sub_ctx(gdctx, len);
-         break;
-      case VIRGL_CCMD_DESTROY_SUB_CTX:
-         ret = vrend_decode_destroy_sub_ctx(gdctx, len);
-         break;
-      case VIRGL_CCMD_BIND_SHADER:
-         ret = vrend_decode_bind_shader(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_SHADER_IMAGES:
-         ret = vrend_decode_set_shader_images(gdctx, len);
-         break;
-      case VIRGL_CCMD_SET_SHADER_BUFFERS:
-         ret = vrend_decode_set_shader_buffers(gdctx, len);
-         break;
-      case VIRGL_CCMD_MEMORY_BARRIER:
-         ret = vrend_decode_memory_barrier(gdctx, len);
-         break;
-      case VIRGL_CCMD_LAUNCH_GRID:
-	 ret = vrend_decode_launch_grid(gdctx, len);
-	 break;
-      default:
-         ret = EINVAL;
-      }
+      if (unlikely(gdctx->stats)) {
+         uint64_t start = vrend_decode_time_ns();
+         ret = vrend_decode_command(gdctx, header, len);
+         vrend_decode_account(gdctx->stats, header,
+                              vrend_decode_time_ns() - start);
+      } else
+         ret = vrend_decode_command(gdctx, header, len);
 
       if (ret == EINVAL) {
          vrend_report_buffer_error(gdctx->grctx, header);
@@ -1409,11 +1449,13 @@ void vrend_decode_reset(bool ctx_0_only)
             continue;
 
          vrend_destroy_context(dec_ctx[i]->grctx);
+         free(dec_ctx[i]->stats);
          free(dec_ctx[i]);
          dec_ctx[i] = NULL;
       }
    } else {
       vrend_destroy_context(dec_ctx[0]->grctx);
+      free(dec_ctx[0]->stats);
       free(dec_ctx[0]);
       dec_ctx[0] = NULL;
    }
@@ -26,6 +26,8 @@
 
 #include "config.h"
 
+#include <stddef.h>
+
 #ifdef HAVE_SYS_UIO_H
 #include <sys/uio.h>
 #else
@@ -46,4 +48,35 @@ size_t vrend_write_to_iovec(const struct iovec *iov, int iov_cnt,
 size_t vrend_read_from_iovec_cb(const struct iovec *iov, int iov_cnt,
                           size_t offset, size_t bytes, iov_cb iocb, void *cookie);
 
+/* remembers which iov the last access landed in, so a series of accesses
+ * at growing offsets walks the iovec only once */
+struct vrend_iov_cursor {
+  const struct iovec *iov;
+  int iov_cnt;
+  int index;
+  size_t base; /* offset of iov[index] */
+};
+
+void vrend_iov_cursor_init(struct vrend_iov_cursor *cur,
+                           const struct iovec *iov, int iov_cnt);
+/* pointer to offset and the number of bytes contiguous from there, 0 past
+ * the end */
+size_t vrend_iov_cursor_span(struct vrend_iov_cursor *cur, size_t offset,
+                             void **ptr);
+size_t vrend_iov_cursor_read(struct vrend_iov_cursor *cur, size_t offset,
+                             char *buf, size_t bytes);
+size_t vrend_iov_cursor_write(struct vrend_iov_cursor *cur, size_t offset,
+                              const char *buf, size_t bytes);
+
+/* copy count blocks of size bytes, spaced stride apart in the iovec and
+ * buf_stride apart in buf */
+size_t vrend_iov_cursor_read_strided(struct vrend_iov_cursor *cur,
+                                     size_t offset, size_t stride,
+                                     char *buf, ptrdiff_t buf_stride,
+                                     size_t size, unsigned count);
+size_t vrend_iov_cursor_write_strided(struct vrend_iov_cursor *cur,
+                                      size_t offset, size_t stride,
+                                      const char *buf, ptrdiff_t buf_stride,
+                                      size_t size, unsigned count);
+
 #endif
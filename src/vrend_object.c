@@ -22,9 +22,7 @@
  *
  **************************************************************************/
 
-#include "util/u_pointer.h"
 #include "util/u_memory.h"
-#include "util/u_hash_table.h"
 
 #include "vrend_object.h"
 
@@ -44,159 +42,276 @@ void vrend_resource_set_destroy_callback(void (*cb)(void *))
    resource_unref = cb;
 }
 
-static unsigned
-hash_func(void *key)
-{
-   intptr_t ip = pointer_to_intptr(key);
-   return (unsigned)(ip & 0xffffffff);
-}
+/*
+ * Objects live in a three level radix tree indexed by the handle: the top
+ * 11 bits pick a directory, the next 11 bits a page in it and the low 10
+ * bits the slot. The guest hands out small, increasing handles, so most
+ * pages are dense. The depth is fixed, so any handle only costs the nodes
+ * on its own path. Directories and pages are allocated on first use and
+ * dropped again once they are empty, so a long running guest that keeps
+ * bumping its handles doesn't accumulate dead nodes.
+ */
+#define VREND_OBJECT_PAGE_SHIFT 10
+#define VREND_OBJECT_PAGE_SIZE (1 << VREND_OBJECT_PAGE_SHIFT)
+#define VREND_OBJECT_PAGE_MASK (VREND_OBJECT_PAGE_SIZE - 1)
+#define VREND_OBJECT_DIR_SHIFT 11
+#define VREND_OBJECT_DIR_SIZE (1 << VREND_OBJECT_DIR_SHIFT)
+#define VREND_OBJECT_DIR_MASK (VREND_OBJECT_DIR_SIZE - 1)
+
+#define VREND_OBJECT_DIR_INDEX(handle) \
+   ((handle) >> (VREND_OBJECT_PAGE_SHIFT + VREND_OBJECT_DIR_SHIFT))
+#define VREND_OBJECT_PAGE_INDEX(handle) \
+   (((handle) >> VREND_OBJECT_PAGE_SHIFT) & VREND_OBJECT_DIR_MASK)
+
+struct vrend_object_slot {
+   void *data;
+   uint8_t type;
+   bool used;
+   bool free_data;
+};
 
-static int
-compare(void *key1, void *key2)
-{
-   if (key1 < key2)
-      return -1;
-   if (key1 > key2)
-      return 1;
-   else
-      return 0;
-}
+struct vrend_object_page {
+   uint32_t num_used;
+   struct vrend_object_slot slots[VREND_OBJECT_PAGE_SIZE];
+};
 
-static struct util_hash_table *res_hash;
+struct vrend_object_dir {
+   uint32_t num_used;
+   struct vrend_object_page *pages[VREND_OBJECT_DIR_SIZE];
+};
 
-struct vrend_object {
-   enum virgl_object_type type;
-   uint32_t handle;
-   void *data;
-   bool free_data;
+struct vrend_object_table {
+   struct vrend_object_dir *dirs[VREND_OBJECT_DIR_SIZE];
+   /* overrides the per type callbacks, used for the resource table */
+   void (*destroy)(void *);
 };
 
-static void free_object(void *value)
-{
-   struct vrend_object *obj = value;
+/* resources are global, and attached to contexts with the bits in
+   the resource itself */
+static struct vrend_object_table *res_table;
 
-   if (obj->free_data) {
-      if (obj_types[obj->type].unref)
-         obj_types[obj->type].unref(obj->data);
+static void free_slot(struct vrend_object_table *table,
+                      struct vrend_object_slot *slot)
+{
+   if (slot->free_data) {
+      if (table->destroy)
+         table->destroy(slot->data);
+      else if (obj_types[slot->type].unref)
+         obj_types[slot->type].unref(slot->data);
       else {
          /* for objects with no callback just free them */
-         free(obj->data);
+         free(slot->data);
       }
    }
-   free(obj);
+   slot->used = false;
+   slot->data = NULL;
 }
 
-struct util_hash_table *vrend_object_init_ctx_table(void)
+static inline struct vrend_object_slot *
+vrend_object_table_slot(struct vrend_object_table *table, uint32_t handle)
 {
-   struct util_hash_table *ctx_hash;
-   ctx_hash = util_hash_table_create(hash_func, compare, free_object);
-   return ctx_hash;
+   struct vrend_object_dir *dir = table->dirs[VREND_OBJECT_DIR_INDEX(handle)];
+   struct vrend_object_page *page;
+
+   if (!dir)
+      return NULL;
+   page = dir->pages[VREND_OBJECT_PAGE_INDEX(handle)];
+   if (!page)
+      return NULL;
+   return &page->slots[handle & VREND_OBJECT_PAGE_MASK];
+}
+
+struct vrend_object_table *vrend_object_init_ctx_table(void)
+{
+   return CALLOC_STRUCT(vrend_object_table);
 }
 
-void vrend_object_fini_ctx_table(struct util_hash_table *ctx_hash)
+void vrend_object_fini_ctx_table(struct vrend_object_table *table)
 {
-   if (!ctx_hash)
+   uint32_t d, i, j;
+
+   if (!table)
       return;
 
-   util_hash_table_destroy(ctx_hash);
+   for (d = 0; d < VREND_OBJECT_DIR_SIZE; d++) {
+      struct vrend_object_dir *dir = table->dirs[d];
+
+      if (!dir)
+         continue;
+
+      for (i = 0; i < VREND_OBJECT_DIR_SIZE && dir->num_used; i++) {
+         struct vrend_object_page *page = dir->pages[i];
+
+         if (!page)
+            continue;
+
+         for (j = 0; j < VREND_OBJECT_PAGE_SIZE && page->num_used; j++) {
+            if (page->slots[j].used) {
+               free_slot(table, &page->slots[j]);
+               page->num_used--;
+            }
+         }
+         FREE(page);
+         dir->num_used--;
+      }
+      FREE(dir);
+   }
+   FREE(table);
 }
 
 static void free_res(void *value)
 {
-   struct vrend_object *obj = value;
-   (*resource_unref)(obj->data);
-   free(obj);
+   (*resource_unref)(value);
 }
 
 void
 vrend_object_init_resource_table(void)
 {
-   if (!res_hash)
-      res_hash = util_hash_table_create(hash_func, compare, free_res);
+   if (res_table)
+      return;
+
+   res_table = vrend_object_init_ctx_table();
+   if (res_table)
+      res_table->destroy = free_res;
 }
 
 void vrend_object_fini_resource_table(void)
 {
-   if (res_hash) {
-      util_hash_table_destroy(res_hash);
-   }
-   res_hash = NULL;
+   vrend_object_fini_ctx_table(res_table);
+   res_table = NULL;
 }
 
 uint32_t
-vrend_object_insert_nofree(struct util_hash_table *handle_hash,
+vrend_object_insert_nofree(struct vrend_object_table *table,
                            void *data, uint32_t length, uint32_t handle, enum virgl_object_type type, bool free_data)
 {
-   struct vrend_object *obj = CALLOC_STRUCT(vrend_object);
+   uint32_t dir_idx = VREND_OBJECT_DIR_INDEX(handle);
+   uint32_t page_idx = VREND_OBJECT_PAGE_INDEX(handle);
+   struct vrend_object_dir *dir;
+   struct vrend_object_page *page;
+   struct vrend_object_slot *slot;
+
+   dir = table->dirs[dir_idx];
+   if (!dir) {
+      dir = CALLOC_STRUCT(vrend_object_dir);
+      if (!dir)
+         return 0;
+      table->dirs[dir_idx] = dir;
+   }
 
-   if (!obj)
-      return 0;
-   obj->handle = handle;
-   obj->data = data;
-   obj->type = type;
-   obj->free_data = free_data;
-   util_hash_table_set(handle_hash, intptr_to_pointer(obj->handle), obj);
-   return obj->handle;
+   page = dir->pages[page_idx];
+   if (!page) {
+      page = CALLOC_STRUCT(vrend_object_page);
+      if (!page) {
+         if (!dir->num_used) {
+            FREE(dir);
+            table->dirs[dir_idx] = NULL;
+         }
+         return 0;
+      }
+      dir->pages[page_idx] = page;
+      dir->num_used++;
+   }
+
+   slot = &page->slots[handle & VREND_OBJECT_PAGE_MASK];
+   if (slot->used)
+      free_slot(table, slot);
+   else
+      page->num_used++;
+
+   slot->data = data;
+   slot->type = type;
+   slot->used = true;
+   slot->free_data = free_data;
+   return handle;
 }
 
 uint32_t
-vrend_object_insert(struct util_hash_table *handle_hash,
+vrend_object_insert(struct vrend_object_table *table,
                     void *data, uint32_t length, uint32_t handle, enum virgl_object_type type)
 {
-   return vrend_object_insert_nofree(handle_hash, data, length,
+   return vrend_object_insert_nofree(table, data, length,
                                      handle, type, true);
 }
 
 void
-vrend_object_remove(struct util_hash_table *handle_hash,
+vrend_object_remove(struct vrend_object_table *table,
                     uint32_t handle, enum virgl_object_type type)
 {
-   util_hash_table_remove(handle_hash, intptr_to_pointer(handle));
+   uint32_t dir_idx = VREND_OBJECT_DIR_INDEX(handle);
+   uint32_t page_idx = VREND_OBJECT_PAGE_INDEX(handle);
+   struct vrend_object_dir *dir;
+   struct vrend_object_slot *slot;
 
+   slot = vrend_object_table_slot(table, handle);
+   if (!slot || !slot->used)
+      return;
+
+   free_slot(table, slot);
+   dir = table->dirs[dir_idx];
+   if (--dir->pages[page_idx]->num_used == 0) {
+      FREE(dir->pages[page_idx]);
+      dir->pages[page_idx] = NULL;
+      if (--dir->num_used == 0) {
+         FREE(dir);
+         table->dirs[dir_idx] = NULL;
+      }
+   }
 }
 
-void *vrend_object_lookup(struct util_hash_table *handle_hash,
+void *vrend_object_lookup(struct vrend_object_table *table,
                           uint32_t handle, enum virgl_object_type type)
 {
-   struct vrend_object *obj;
+   struct vrend_object_slot *slot;
 
-   obj = util_hash_table_get(handle_hash, intptr_to_pointer(handle));
-   if (!obj) {
+   slot = vrend_object_table_slot(table, handle);
+   if (!slot || !slot->used || slot->type != type)
       return NULL;
-   }
-
-   if (obj->type != type)
-      return NULL;
-   return obj->data;
+   return slot->data;
 }
 
 int vrend_resource_insert(void *data, uint32_t handle)
 {
-   struct vrend_object *obj;
-
    if (!handle)
       return 0;
 
-   obj = CALLOC_STRUCT(vrend_object);
-   if (!obj)
-      return 0;
-
-   obj->handle = handle;
-   obj->data = data;
-   util_hash_table_set(res_hash, intptr_to_pointer(obj->handle), obj);
-   return obj->handle;
+   return vrend_object_insert(res_table, data, 0, handle, VIRGL_OBJECT_NULL);
 }
 
 void vrend_resource_remove(uint32_t handle)
 {
-   util_hash_table_remove(res_hash, intptr_to_pointer(handle));
+   vrend_object_remove(res_table, handle, VIRGL_OBJECT_NULL);
 }
 
 void *vrend_resource_lookup(uint32_t handle, uint32_t ctx_id)
 {
-   struct vrend_object *obj;
-   obj = util_hash_table_get(res_hash, intptr_to_pointer(handle));
-   if (!obj)
-      return NULL;
-   return obj->data;
+   return vrend_object_lookup(res_table, handle, VIRGL_OBJECT_NULL);
+}
+
+void vrend_resource_foreach(void (*cb)(void *data, void *closure),
+                            void *closure)
+{
+   uint32_t d, i, j;
+
+   if (!res_table)
+      return;
+
+   for (d = 0; d < VREND_OBJECT_DIR_SIZE; d++) {
+      struct vrend_object_dir *dir = res_table->dirs[d];
+
+      if (!dir)
+         continue;
+
+      for (i = 0; i < VREND_OBJECT_DIR_SIZE; i++) {
+         struct vrend_object_page *page = dir->pages[i];
+
+         if (!page)
+            continue;
+
+         for (j = 0; j < VREND_OBJECT_PAGE_SIZE; j++) {
+            if (page->slots[j].used)
+               cb(page->slots[j].data, closure);
+         }
+      }
+   }
 }
@@ -30,13 +30,15 @@
 void vrend_object_init_resource_table(void);
 void vrend_object_fini_resource_table(void);
 
-struct util_hash_table *vrend_object_init_ctx_table(void);
-void vrend_object_fini_ctx_table(struct util_hash_table *ctx_hash);
+struct vrend_object_table;
 
-void vrend_object_remove(struct util_hash_table *handle_hash, uint32_t handle, enum virgl_object_type obj);
-void *vrend_object_lookup(struct util_hash_table *handle_hash, uint32_t handle, enum virgl_object_type obj);
-uint32_t vrend_object_insert(struct util_hash_table *handle_hash, void *data, uint32_t length, uint32_t handle, enum virgl_object_type type);
-uint32_t vrend_object_insert_nofree(struct util_hash_table *handle_hash,
+struct vrend_object_table *vrend_object_init_ctx_table(void);
+void vrend_object_fini_ctx_table(struct vrend_object_table *table);
+
+void vrend_object_remove(struct vrend_object_table *table, uint32_t handle, enum virgl_object_type obj);
+void *vrend_object_lookup(struct vrend_object_table *table, uint32_t handle, enum virgl_object_type obj);
+uint32_t vrend_object_insert(struct vrend_object_table *table, void *data, uint32_t length, uint32_t handle, enum virgl_object_type type);
+uint32_t vrend_object_insert_nofree(struct vrend_object_table *table,
                                     void *data, uint32_t length,
                                     uint32_t handle,
                                     enum virgl_object_type type,
@@ -46,6 +48,9 @@ int vrend_resource_insert(void *data, uint32_t handle);
 
 void vrend_resource_remove(uint32_t handle);
 void *vrend_resource_lookup(uint32_t handle, uint32_t ctx_id);
+/* cb must not insert or remove resources */
+void vrend_resource_foreach(void (*cb)(void *data, void *closure),
+                            void *closure);
 
 void vrend_object_set_destroy_callback(int type, void (*cb)(void *));
 void vrend_resource_set_destroy_callback(void (*cb)(void *));
@@ -0,0 +1,384 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "util/u_math.h"
+#include "vrend_program_cache.h"
+
+#define VREND_PROGRAM_CACHE_MAGIC 0x56504331 /* VPC1 */
+#define VREND_PROGRAM_CACHE_DEFAULT_SIZE_MB 64
+
+struct vrend_program_cache_header {
+   uint32_t magic;
+   uint32_t key_size;
+   uint32_t format;
+   uint32_t binary_size;
+};
+
+struct vrend_program_cache {
+   bool enabled;
+   char *dir;
+   char *driver_id;
+   uint32_t driver_id_len;
+   uint64_t max_size;
+   uint64_t cur_size;
+};
+
+static struct vrend_program_cache cache;
+
+static uint64_t fnv1a_64(uint64_t hash, const void *data, uint32_t len)
+{
+   const uint8_t *p = data;
+   uint32_t i;
+
+   for (i = 0; i < len; i++) {
+      hash ^= p[i];
+      hash *= 0x100000001b3ull;
+   }
+   return hash;
+}
+
+static void cache_entry_path(char *path, size_t path_len,
+                             const void *key, uint32_t key_size)
+{
+   uint64_t hash = 0xcbf29ce484222325ull;
+
+   hash = fnv1a_64(hash, cache.driver_id, cache.driver_id_len);
+   hash = fnv1a_64(hash, key, key_size);
+   snprintf(path, path_len, "%s/%016llx", cache.dir, (unsigned long long)hash);
+}
+
+static bool is_cache_entry(const char *name)
+{
+   return strlen(name) == 16 && strspn(name, "0123456789abcdef") == 16;
+}
+
+static uint64_t cache_dir_size(void)
+{
+   DIR *dir;
+   struct dirent *ent;
+   struct stat st;
+   char path[PATH_MAX];
+   uint64_t size = 0;
+
+   dir = opendir(cache.dir);
+   if (!dir)
+      return 0;
+
+   while ((ent = readdir(dir))) {
+      if (!is_cache_entry(ent->d_name))
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", cache.dir, ent->d_name);
+      if (stat(path, &st) == 0)
+         size += st.st_size;
+   }
+   closedir(dir);
+   return size;
+}
+
+struct cache_entry_info {
+   char name[17];
+   struct timespec mtime;
+   off_t size;
+};
+
+static int cache_entry_compare(const void *a, const void *b)
+{
+   const struct cache_entry_info *ea = a, *eb = b;
+
+   if (ea->mtime.tv_sec != eb->mtime.tv_sec)
+      return ea->mtime.tv_sec < eb->mtime.tv_sec ? -1 : 1;
+   if (ea->mtime.tv_nsec != eb->mtime.tv_nsec)
+      return ea->mtime.tv_nsec < eb->mtime.tv_nsec ? -1 : 1;
+   return 0;
+}
+
+/* drop the least recently used entries until needed bytes fit under the
+ * cap, hits touch the mtime of their entry so it orders by last use */
+static void cache_make_room(uint64_t needed, const char *keep)
+{
+   DIR *dir;
+   struct dirent *ent;
+   struct stat st;
+   char path[PATH_MAX];
+   struct cache_entry_info *entries = NULL, *tmp;
+   size_t num_entries = 0, max_entries = 0, i;
+   uint64_t size = 0;
+
+   if (cache.cur_size + needed <= cache.max_size)
+      return;
+
+   dir = opendir(cache.dir);
+   if (!dir)
+      return;
+
+   while ((ent = readdir(dir))) {
+      if (!is_cache_entry(ent->d_name))
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", cache.dir, ent->d_name);
+      if (stat(path, &st) != 0)
+         continue;
+      size += st.st_size;
+      if (!strcmp(ent->d_name, keep))
+         continue;
+
+      if (num_entries == max_entries) {
+         max_entries = max_entries ? max_entries * 2 : 64;
+         tmp = realloc(entries, max_entries * sizeof(*entries));
+         if (!tmp)
+            break;
+         entries = tmp;
+      }
+      strcpy(entries[num_entries].name, ent->d_name);
+      entries[num_entries].mtime = st.st_mtim;
+      entries[num_entries].size = st.st_size;
+      num_entries++;
+   }
+   closedir(dir);
+
+   /* resync with what is actually on disk, other processes may share it */
+   cache.cur_size = size;
+
+   qsort(entries, num_entries, sizeof(*entries), cache_entry_compare);
+   for (i = 0; i < num_entries && cache.cur_size + needed > cache.max_size; i++) {
+      snprintf(path, sizeof(path), "%s/%s", cache.dir, entries[i].name);
+      if (unlink(path) != 0)
+         continue;
+      cache.cur_size -= MIN2(cache.cur_size, (uint64_t)entries[i].size);
+   }
+   free(entries);
+}
+
+bool vrend_program_cache_init(const char *driver_id)
+{
+   const char *dir = getenv("VIRGL_PROGRAM_CACHE_DIR");
+   const char *size = getenv("VIRGL_PROGRAM_CACHE_SIZE");
+   struct stat st;
+
+   vrend_program_cache_fini();
+
+   if (!dir || !dir[0] || getenv("VIRGL_DISABLE_PROGRAM_CACHE"))
+      return false;
+
+   if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+      fprintf(stderr, "program cache: failed to create %s: %s\n", dir, strerror(errno));
+      return false;
+   }
+   if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+      fprintf(stderr, "program cache: %s is not a directory\n", dir);
+      return false;
+   }
+
+   cache.dir = strdup(dir);
+   cache.driver_id = strdup(driver_id ? driver_id : "");
+   if (!cache.dir || !cache.driver_id) {
+      vrend_program_cache_fini();
+      return false;
+   }
+   cache.driver_id_len = strlen(cache.driver_id);
+
+   cache.max_size = (uint64_t)VREND_PROGRAM_CACHE_DEFAULT_SIZE_MB << 20;
+   if (size)
+      cache.max_size = strtoull(size, NULL, 10) << 20;
+   if (!cache.max_size) {
+      vrend_program_cache_fini();
+      return false;
+   }
+
+   cache.cur_size = cache_dir_size();
+   cache.enabled = true;
+   return true;
+}
+
+void vrend_program_cache_fini(void)
+{
+   free(cache.dir);
+   free(cache.driver_id);
+   memset(&cache, 0, sizeof(cache));
+}
+
+bool vrend_program_cache_enabled(void)
+{
+   return cache.enabled;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+   char *p = buf;
+   ssize_t ret;
+
+   while (len) {
+      ret = read(fd, p, len);
+      if (ret < 0 && errno == EINTR)
+         continue;
+      if (ret <= 0)
+         return false;
+      p += ret;
+      len -= ret;
+   }
+   return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+   const char *p = buf;
+   ssize_t ret;
+
+   while (len) {
+      ret = write(fd, p, len);
+      if (ret < 0 && errno == EINTR)
+         continue;
+      if (ret <= 0)
+         return false;
+      p += ret;
+      len -= ret;
+   }
+   return true;
+}
+
+void *vrend_program_cache_load(const void *key, uint32_t key_size,
+                               uint32_t *format, uint32_t *size)
+{
+   struct vrend_program_cache_header hdr;
+   char path[PATH_MAX];
+   char *entry_key = NULL;
+   void *binary = NULL;
+   int fd;
+
+   if (!cache.enabled)
+      return NULL;
+
+   cache_entry_path(path, sizeof(path), key, key_size);
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      return NULL;
+
+   if (!read_all(fd, &hdr, sizeof(hdr)))
+      goto fail;
+
+   /* the full key is stored so that hash collisions can't hand back
+      the binary of a different program */
+   if (hdr.magic != VREND_PROGRAM_CACHE_MAGIC ||
+       hdr.key_size != key_size + cache.driver_id_len ||
+       hdr.binary_size == 0)
+      goto fail;
+
+   entry_key = malloc(hdr.key_size);
+   binary = malloc(hdr.binary_size);
+   if (!entry_key || !binary)
+      goto fail;
+
+   if (!read_all(fd, entry_key, hdr.key_size) ||
+       memcmp(entry_key, cache.driver_id, cache.driver_id_len) ||
+       memcmp(entry_key + cache.driver_id_len, key, key_size))
+      goto fail;
+
+   if (!read_all(fd, binary, hdr.binary_size))
+      goto fail;
+
+   /* mark the entry as recently used for eviction */
+   futimens(fd, NULL);
+   close(fd);
+   free(entry_key);
+   *format = hdr.format;
+   *size = hdr.binary_size;
+   return binary;
+
+fail:
+   close(fd);
+   free(entry_key);
+   free(binary);
+   return NULL;
+}
+
+void vrend_program_cache_store(const void *key, uint32_t key_size,
+                               uint32_t format, const void *binary,
+                               uint32_t size)
+{
+   struct vrend_program_cache_header hdr;
+   char path[PATH_MAX], tmp_path[PATH_MAX];
+   uint64_t entry_size;
+   struct stat st;
+   off_t old_size = 0;
+   int fd;
+
+   if (!cache.enabled || !size)
+      return;
+
+   hdr.magic = VREND_PROGRAM_CACHE_MAGIC;
+   hdr.key_size = key_size + cache.driver_id_len;
+   hdr.format = format;
+   hdr.binary_size = size;
+
+   entry_size = sizeof(hdr) + hdr.key_size + size;
+   if (entry_size > cache.max_size)
+      return;
+
+   cache_entry_path(path, sizeof(path), key, key_size);
+
+   /* an entry replaced in place frees its own space */
+   if (stat(path, &st) == 0)
+      old_size = st.st_size;
+   if (entry_size > (uint64_t)old_size)
+      cache_make_room(entry_size - old_size, strrchr(path, '/') + 1);
+   snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid());
+
+   /* write to a private file and rename it in place, so concurrent
+      readers only ever see complete entries */
+   fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+   if (fd < 0)
+      return;
+
+   if (!write_all(fd, &hdr, sizeof(hdr)) ||
+       !write_all(fd, cache.driver_id, cache.driver_id_len) ||
+       !write_all(fd, key, key_size) ||
+       !write_all(fd, binary, size)) {
+      close(fd);
+      unlink(tmp_path);
+      return;
+   }
+   close(fd);
+
+   old_size = stat(path, &st) == 0 ? st.st_size : 0;
+   if (rename(tmp_path, path) != 0) {
+      unlink(tmp_path);
+      return;
+   }
+   cache.cur_size -= MIN2(cache.cur_size, (uint64_t)old_size);
+   cache.cur_size += entry_size;
+}
@@ -0,0 +1,42 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+#ifndef VREND_PROGRAM_CACHE_H
+#define VREND_PROGRAM_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* on-disk cache of linked program binaries, enabled by pointing
+   VIRGL_PROGRAM_CACHE_DIR at a writable directory */
+bool vrend_program_cache_init(const char *driver_id);
+void vrend_program_cache_fini(void);
+bool vrend_program_cache_enabled(void);
+
+/* returns a malloc'ed binary that matches key, or NULL */
+void *vrend_program_cache_load(const void *key, uint32_t key_size,
+                               uint32_t *format, uint32_t *size);
+void vrend_program_cache_store(const void *key, uint32_t key_size,
+                               uint32_t format, const void *binary,
+                               uint32_t size);
+#endif
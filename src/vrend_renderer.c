@@ -39,6 +39,7 @@
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
 #include "util/u_dual_blend.h"
+#include "util/u_hash_table.h"
 
 #include "os/os_thread.h"
 #include "util/u_double_list.h"
@@ -46,13 +47,18 @@
 #include "tgsi/tgsi_parse.h"
 
 #include "vrend_object.h"
+#include "vrend_slab.h"
 #include "vrend_shader.h"
+#include "vrend_program_cache.h"
+#include "vrend_trace.h"
 
 #include "vrend_renderer.h"
 
 #include "virgl_hw.h"
 
 #include "tgsi/tgsi_text.h"
+#include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_sanity.h"
 
 #ifdef HAVE_EVENTFD
 #include <sys/eventfd.h>
@@ -71,6 +77,57 @@ struct vrend_fence {
    uint32_t ctx_id;
    GLsync syncobj;
    struct list_head fences;
+   /* last readback issued before this fence */
+   uint64_t readback_seq;
+};
+
+#define VREND_UPLOAD_RING_SIZE (8 * 1024 * 1024)
+#define VREND_UPLOAD_RING_ALIGN 64
+
+/* a stretch of the upload ring the GPU may still be reading from */
+struct vrend_upload_fence {
+   struct list_head head;
+   GLsync syncobj;
+   uint32_t start;
+};
+
+/* pixel unpack buffer texture uploads are staged through, regions are
+ * handed out in order and reclaimed once their fence has signalled */
+struct vrend_upload_ring {
+   GLuint id;
+   /* persistent mapping, NULL when each upload maps its own range */
+   char *map;
+   uint32_t head;
+   uint32_t pending_start;
+   struct list_head fences;
+};
+
+#define VREND_READBACK_MAX_PENDING 32
+#define VREND_READBACK_MAX_FREE_PBOS 8
+
+struct vrend_pbo {
+   struct list_head head;
+   GLuint id;
+   uint32_t size;
+};
+
+/* a texture read into a pixel pack buffer that still has to be copied
+ * into the guest backing once the GPU is done with it */
+struct vrend_readback {
+   struct list_head head;
+   uint64_t seq;
+   GLsync syncobj;
+   struct vrend_pbo *pbo;
+   struct vrend_resource *res;
+   struct iovec *iov;
+   int num_iovs;
+   struct pipe_box box;
+   uint32_t level;
+   uint32_t stride;
+   uint64_t offset;
+   uint32_t size;
+   uint32_t data_offset;
+   bool invert;
 };
 
 struct vrend_query {
@@ -116,6 +173,12 @@ struct global_renderer_state {
    bool have_tf2;
    bool have_stencil_texturing;
    bool have_sample_shading;
+   bool have_program_binary;
+   bool have_parallel_shader_compile;
+   bool have_multi_draw;
+   bool have_multi_draw_base_vertex;
+   bool have_buffer_storage;
+   bool use_persistent_buffers;
 
    /* these appeared broken on at least one driver */
    bool use_explicit_locations;
@@ -133,15 +196,53 @@ struct global_renderer_state {
 
    pipe_thread sync_thread;
    virgl_gl_context sync_context;
+
+   /* threaded shader compile */
+   bool use_async_shader_compile;
+   bool stop_compile_thread;
+   pipe_mutex compile_mutex;
+   pipe_condvar compile_cond;
+   pipe_condvar compile_done_cond;
+   struct list_head compile_list;
+
+   pipe_thread compile_thread;
+   virgl_gl_context compile_context;
+
+   /* asynchronous readback */
+   bool use_async_readback;
+   uint64_t readback_seq;
+   int num_readbacks;
+   int num_free_pbos;
+   struct list_head readback_list;
+   struct list_head free_pbo_list;
+
+   /* streaming texture uploads */
+   bool use_upload_ring;
+   struct vrend_upload_ring upload_ring;
 };
 
 static struct global_renderer_state vrend_state;
 
+/* maximum number of linked programs kept per sub context before the least
+   recently used ones get deleted */
+#define VREND_PROGRAM_CACHE_SIZE 1024
+
+struct vrend_linked_shader_program_key {
+   GLuint vs_id;
+   GLuint fs_id;
+   GLuint gs_id;
+   GLuint cs_id;
+   uint32_t dual_src;
+};
+
 struct vrend_linked_shader_program {
    struct list_head head;
    struct list_head sl[PIPE_SHADER_TYPES];
    GLuint id;
 
+   struct vrend_linked_shader_program_key key;
+   struct vrend_sub_context *sub_ctx;
+
    bool dual_src_linked;
    struct vrend_shader *ss[PIPE_SHADER_TYPES];
 
@@ -151,7 +252,10 @@ struct vrend_linked_shader_program {
    GLuint *shadow_samp_mask_locs[PIPE_SHADER_TYPES];
    GLuint *shadow_samp_add_locs[PIPE_SHADER_TYPES];
 
-   GLuint *const_locs[PIPE_SHADER_TYPES];
+   /* location of element 0 of the constant array, -1 if unused */
+   GLint const_location[PIPE_SHADER_TYPES];
+   /* the linker may drop trailing elements that are never read */
+   GLint const_array_size[PIPE_SHADER_TYPES];
 
    GLuint *attrib_locs;
    uint32_t shadow_samp_mask[PIPE_SHADER_TYPES];
@@ -169,15 +273,32 @@ struct vrend_linked_shader_program {
    GLuint *ssbo_locs[PIPE_SHADER_TYPES];
 };
 
+enum vrend_compile_state {
+   VREND_COMPILE_DONE,      /* compile status was checked and is good */
+   VREND_COMPILE_FAILED,    /* compile status was checked and is bad */
+   VREND_COMPILE_QUEUED,    /* waiting for the compile thread */
+   VREND_COMPILE_RUNNING,   /* the compile thread is working on it */
+   VREND_COMPILE_SUBMITTED, /* glCompileShader was called, status not checked yet */
+};
+
+/* shader variants of a selector are hashed by their key */
+#define VREND_SHADER_VARIANT_BUCKETS 16
+
 struct vrend_shader {
-   struct vrend_shader *next_variant;
+   struct vrend_shader *next_variant; /* in the same hash bucket */
    struct vrend_shader_selector *sel;
 
    GLchar *glsl_prog;
    GLuint id;
    GLuint compiled_fs_id;
    struct vrend_shader_key key;
+   uint32_t key_hash;
    struct list_head programs;
+
+   /* compile_state and compile_head are protected by the compile_mutex
+      while the compile thread is running */
+   enum vrend_compile_state compile_state;
+   struct list_head compile_head;
 };
 
 struct vrend_shader_selector {
@@ -188,11 +309,14 @@ struct vrend_shader_selector {
    struct vrend_shader_info sinfo;
 
    struct vrend_shader *current;
+   struct vrend_shader *variants[VREND_SHADER_VARIANT_BUCKETS];
    struct tgsi_token *tokens;
 
    char *tmp_buf;
    uint32_t buf_len;
    uint32_t buf_offset;
+   /* set by the first packet, continuations have to match it */
+   bool binary_tokens;
 };
 
 struct vrend_texture {
@@ -212,6 +336,30 @@ struct vrend_surface {
    GLuint format;
    GLuint val0, val1;
    struct vrend_resource *texture;
+   /* cached framebuffers that attach this surface */
+   struct list_head fbos;
+};
+
+#define VREND_FBO_CACHE_SIZE 16
+/* index of the depth/stencil surface in vrend_fbo::links */
+#define VREND_FBO_ZSURF PIPE_MAX_COLOR_BUFS
+
+struct vrend_fbo_link {
+   struct list_head head;
+   struct vrend_fbo *fbo;
+};
+
+struct vrend_fbo {
+   struct list_head head;
+   struct vrend_sub_context *sub;
+   GLuint id;
+   int nr_cbufs;
+   /* not referenced, destroying a surface drops the entries that use it
+    * instead, so cached entries don't keep dead render targets around */
+   struct vrend_surface *surf[PIPE_MAX_COLOR_BUFS];
+   struct vrend_surface *zsurf;
+   /* entries in the fbos list of each attached surface */
+   struct vrend_fbo_link links[PIPE_MAX_COLOR_BUFS + 1];
 };
 
 struct vrend_sampler_state {
@@ -283,6 +431,9 @@ struct vrend_vertex_element_array {
 struct vrend_constants {
    unsigned int *consts;
    uint32_t num_consts;
+   uint32_t num_allocated_consts;
+   /* vec4s changed since the last upload, empty if start == end */
+   uint32_t dirty_start, dirty_end;
 };
 
 struct vrend_shader_view {
@@ -323,8 +474,15 @@ struct vrend_sub_context {
    GLuint vaoid;
    uint32_t enabled_attribs_bitmask;
 
+   /* linked programs in LRU order, most recently used at the tail */
    struct list_head programs;
-   struct util_hash_table *object_hash;
+   struct util_hash_table *program_hash;
+   uint32_t num_programs;
+   uint32_t program_cache_hits;
+   uint32_t program_cache_misses;
+   uint32_t program_cache_evictions;
+
+   struct vrend_object_table *object_table;
 
    struct vrend_vertex_element_array *ve;
    int num_vbos;
@@ -336,6 +494,8 @@ struct vrend_sub_context {
    uint32_t index_buffer_res_id;
 
    bool vbo_dirty;
+   /* set when a bound shader or the state feeding the shader keys
+      changed, the variants and the program are only selected then */
    bool shader_dirty;
    bool cs_shader_dirty;
    bool sampler_state_dirty;
@@ -350,7 +510,6 @@ struct vrend_sub_context {
    struct vrend_shader_view views[PIPE_SHADER_TYPES];
 
    struct vrend_constants consts[PIPE_SHADER_TYPES];
-   bool const_dirty[PIPE_SHADER_TYPES];
    struct vrend_sampler_state *sampler_state[PIPE_SHADER_TYPES][PIPE_MAX_SAMPLERS];
 
    struct pipe_constant_buffer cbs[PIPE_SHADER_TYPES][PIPE_MAX_CONSTANT_BUFFERS];
@@ -358,8 +517,16 @@ struct vrend_sub_context {
 
    int num_sampler_states[PIPE_SHADER_TYPES];
 
+   /* the bound framebuffer, either fb_empty_id or one from fbo_cache */
    uint32_t fb_id;
+   uint32_t fb_empty_id;
+   /* complete framebuffers by attachment set, most recently used first */
+   struct list_head fbo_cache;
+   int num_cached_fbos;
    int nr_cbufs, old_nr_cbufs;
+   /* color buffer properties that go into the shader keys */
+   uint32_t cbufs_are_a8_bitmask;
+   bool cbufs_have_pure_integer;
    struct vrend_surface *zsurf;
    struct vrend_surface *surf[PIPE_MAX_COLOR_BUFS];
 
@@ -397,7 +564,9 @@ struct vrend_sub_context {
    GLuint program_id;
    int last_shader_idx;
 
+   /* rasterizer state as last emitted, only valid after the first bind */
    struct pipe_rasterizer_state hw_rs_state;
+   bool hw_rs_state_valid;
    struct pipe_blend_state hw_blend_state;
 
    struct list_head streamout_list;
@@ -405,6 +574,11 @@ struct vrend_sub_context {
 
    struct pipe_blend_color blend_color;
 
+   struct {
+      uint32_t length;
+      uint32_t data[VREND_STATE_SHADOW_MAX_DWORDS];
+   } state_shadow[VREND_SHADOW_COUNT];
+
    uint32_t cond_render_q_id;
    GLenum cond_render_gl_mode;
 
@@ -433,13 +607,16 @@ struct vrend_context {
 
    enum virgl_ctx_errors last_error;
 
-   /* resource bounds to this context */
-   struct util_hash_table *res_hash;
-
    struct list_head active_nontimer_query_list;
    struct list_head ctx_entry;
 
    struct vrend_shader_cfg shader_cfg;
+
+   /* allocators for the small objects the guest churns through */
+   struct vrend_slab *slabs[VREND_SLAB_COUNT];
+
+   uint64_t rs_emits;
+   uint64_t rs_gl_calls;
 };
 
 static struct vrend_resource *vrend_renderer_ctx_res_lookup(struct vrend_context *ctx, int res_handle);
@@ -452,8 +629,12 @@ static void vrend_patch_blend_state(struct vrend_context *ctx);
 static void vrend_update_frontface_state(struct vrend_context *ctx);
 static void vrender_get_glsl_version(int *glsl_version);
 static void vrend_destroy_resource_object(void *obj_ptr);
-static void vrend_renderer_detach_res_ctx_p(struct vrend_context *ctx, int res_handle);
+static void vrend_renderer_detach_res_cb(void *data, void *closure);
 static void vrend_destroy_program(struct vrend_linked_shader_program *ent);
+static void vrend_readback_flush_resource(struct vrend_resource *res);
+static void vrend_readback_fini(void);
+static void vrend_fbo_destroy(struct vrend_fbo *fbo);
+static void vrend_upload_ring_fini(void);
 static void vrend_apply_sampler_state(struct vrend_context *ctx,
                                       struct vrend_resource *res,
                                       uint32_t shader_type,
@@ -586,8 +767,10 @@ static inline bool should_invert_viewport(struct vrend_context *ctx)
 
 static void vrend_destroy_surface(struct vrend_surface *surf)
 {
+   while (!LIST_IS_EMPTY(&surf->fbos))
+      vrend_fbo_destroy(LIST_ENTRY(struct vrend_fbo_link, surf->fbos.next, head)->fbo);
    vrend_resource_reference(&surf->texture, NULL);
-   free(surf);
+   vrend_slab_free(surf);
 }
 
 static inline void
@@ -603,7 +786,7 @@ vrend_surface_reference(struct vrend_surface **ptr, struct vrend_surface *surf)
 static void vrend_destroy_sampler_view(struct vrend_sampler_view *samp)
 {
    vrend_resource_reference(&samp->texture, NULL);
-   free(samp);
+   vrend_slab_free(samp);
 }
 
 static inline void
@@ -632,6 +815,8 @@ vrend_so_target_reference(struct vrend_so_target **ptr, struct vrend_so_target *
    *ptr = target;
 }
 
+static bool vrend_shader_dequeue_compile(struct vrend_shader *shader);
+
 static void vrend_shader_destroy(struct vrend_shader *shader)
 {
    struct vrend_linked_shader_program *ent, *tmp;
@@ -640,19 +825,26 @@ static void vrend_shader_destroy(struct vrend_shader *shader)
       vrend_destroy_program(ent);
    }
 
+   /* nobody is going to use the result, just keep the thread off it */
+   vrend_shader_dequeue_compile(shader);
+
    glDeleteShader(shader->id);
    free(shader->glsl_prog);
-   free(shader);
+   vrend_slab_free(shader);
 }
 
 static void vrend_destroy_shader_selector(struct vrend_shader_selector *sel)
 {
-   struct vrend_shader *p = sel->current, *c;
+   struct vrend_shader *p, *c;
    int i;
-   while (p) {
-      c = p->next_variant;
-      vrend_shader_destroy(p);
-      p = c;
+
+   for (i = 0; i < VREND_SHADER_VARIANT_BUCKETS; i++) {
+      p = sel->variants[i];
+      while (p) {
+         c = p->next_variant;
+         vrend_shader_destroy(p);
+         p = c;
+      }
    }
    if (sel->sinfo.so_names)
       for (i = 0; i < sel->sinfo.so_info.num_outputs; i++)
@@ -662,15 +854,13 @@ static void vrend_destroy_shader_selector(struct vrend_shader_selector *sel)
    free(sel->sinfo.interpinfo);
    free(sel->sinfo.sampler_arrays);
    free(sel->tokens);
-   free(sel);
+   vrend_slab_free(sel);
 }
 
-static bool vrend_compile_shader(struct vrend_context *ctx,
-                                 struct vrend_shader *shader)
+static bool vrend_check_shader_compiled(struct vrend_context *ctx,
+                                        struct vrend_shader *shader)
 {
    GLint param;
-   glShaderSource(shader->id, 1, (const char **)&shader->glsl_prog, NULL);
-   glCompileShader(shader->id);
    glGetShaderiv(shader->id, GL_COMPILE_STATUS, &param);
    if (param == GL_FALSE) {
       char infolog[65536];
@@ -679,11 +869,100 @@ static bool vrend_compile_shader(struct vrend_context *ctx,
       report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, 0);
       fprintf(stderr,"shader failed to compile\n%s\n", infolog);
       fprintf(stderr,"GLSL:\n%s\n", shader->glsl_prog);
+      shader->compile_state = VREND_COMPILE_FAILED;
       return false;
    }
+   shader->compile_state = VREND_COMPILE_DONE;
    return true;
 }
 
+static bool vrend_compile_shader(struct vrend_context *ctx,
+                                 struct vrend_shader *shader)
+{
+   glShaderSource(shader->id, 1, (const char **)&shader->glsl_prog, NULL);
+   glCompileShader(shader->id);
+   return vrend_check_shader_compiled(ctx, shader);
+}
+
+/* Start compiling a shader without waiting for the result. With
+ * parallel_shader_compile the driver compiles in the background until
+ * the status is queried, otherwise the compile thread picks the shader up.
+ * vrend_wait_shader_compiled must be called before the shader is used.
+ */
+static bool vrend_compile_shader_deferred(struct vrend_context *ctx,
+                                          struct vrend_shader *shader)
+{
+   if (vrend_state.compile_thread) {
+      pipe_mutex_lock(vrend_state.compile_mutex);
+      shader->compile_state = VREND_COMPILE_QUEUED;
+      list_addtail(&shader->compile_head, &vrend_state.compile_list);
+      pipe_mutex_unlock(vrend_state.compile_mutex);
+      pipe_condvar_signal(vrend_state.compile_cond);
+      return true;
+   }
+
+   if (vrend_state.have_parallel_shader_compile) {
+      glShaderSource(shader->id, 1, (const char **)&shader->glsl_prog, NULL);
+      glCompileShader(shader->id);
+      shader->compile_state = VREND_COMPILE_SUBMITTED;
+      return true;
+   }
+
+   return vrend_compile_shader(ctx, shader);
+}
+
+/* Make sure the compile thread no longer touches the shader: take it off
+ * the queue if it is still waiting there, or wait for the thread if it is
+ * compiling it right now. Returns true when the shader was taken off the
+ * queue and so never got compiled.
+ */
+static bool vrend_shader_dequeue_compile(struct vrend_shader *shader)
+{
+   bool dequeued = false;
+
+   if (!vrend_state.compile_thread)
+      return false;
+
+   pipe_mutex_lock(vrend_state.compile_mutex);
+   if (shader->compile_state == VREND_COMPILE_QUEUED) {
+      list_delinit(&shader->compile_head);
+      dequeued = true;
+   }
+   while (shader->compile_state == VREND_COMPILE_RUNNING)
+      pipe_condvar_wait(vrend_state.compile_done_cond, vrend_state.compile_mutex);
+   pipe_mutex_unlock(vrend_state.compile_mutex);
+   return dequeued;
+}
+
+/* A shader that is still queued is compiled right here instead of waiting
+ * for the thread to get to it.
+ */
+static void vrend_shader_finish_compile(struct vrend_shader *shader)
+{
+   if (vrend_shader_dequeue_compile(shader)) {
+      glShaderSource(shader->id, 1, (const char **)&shader->glsl_prog, NULL);
+      glCompileShader(shader->id);
+      shader->compile_state = VREND_COMPILE_SUBMITTED;
+   }
+}
+
+static bool vrend_wait_shader_compiled(struct vrend_context *ctx,
+                                       struct vrend_shader *shader)
+{
+   switch (shader->compile_state) {
+   case VREND_COMPILE_DONE:
+      return true;
+   case VREND_COMPILE_FAILED:
+      report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, 0);
+      return false;
+   default:
+      break;
+   }
+
+   vrend_shader_finish_compile(shader);
+   return vrend_check_shader_compiled(ctx, shader);
+}
+
 static inline void
 vrend_shader_state_reference(struct vrend_shader_selector **ptr, struct vrend_shader_selector *shader)
 {
@@ -963,34 +1242,238 @@ static void bind_image_locs(struct vrend_context *ctx, int id,
 
 }
 
+static unsigned program_hash_func(void *key)
+{
+   struct vrend_linked_shader_program_key *k = key;
+   unsigned hash = 2166136261u;
+
+   hash = (hash ^ k->vs_id) * 16777619u;
+   hash = (hash ^ k->fs_id) * 16777619u;
+   hash = (hash ^ k->gs_id) * 16777619u;
+   hash = (hash ^ k->cs_id) * 16777619u;
+   hash = (hash ^ k->dual_src) * 16777619u;
+   return hash;
+}
+
+static int program_compare(void *key1, void *key2)
+{
+   return memcmp(key1, key2, sizeof(struct vrend_linked_shader_program_key));
+}
+
+static void program_hash_destroy(void *value)
+{
+   /* programs are owned by the sub context program list */
+}
+
+static void vrend_program_cache_insert(struct vrend_sub_context *sub,
+                                       struct vrend_linked_shader_program *sprog)
+{
+   struct vrend_linked_shader_program *ent, *tmp;
+
+   if (sub->num_programs >= VREND_PROGRAM_CACHE_SIZE) {
+      LIST_FOR_EACH_ENTRY_SAFE(ent, tmp, &sub->programs, head) {
+         /* never pull the bound program from under the sub context */
+         if (ent == sub->prog)
+            continue;
+         vrend_destroy_program(ent);
+         sub->program_cache_evictions++;
+         break;
+      }
+   }
+
+   sprog->sub_ctx = sub;
+   list_addtail(&sprog->head, &sub->programs);
+   util_hash_table_set(sub->program_hash, &sprog->key, sprog);
+   sub->num_programs++;
+}
+
+static struct vrend_linked_shader_program *
+vrend_program_cache_lookup(struct vrend_sub_context *sub,
+                           struct vrend_linked_shader_program_key *key)
+{
+   struct vrend_linked_shader_program *ent;
+
+   ent = util_hash_table_get(sub->program_hash, key);
+   if (!ent) {
+      sub->program_cache_misses++;
+      return NULL;
+   }
+
+   sub->program_cache_hits++;
+   list_del(&ent->head);
+   list_addtail(&ent->head, &sub->programs);
+   return ent;
+}
+
+static void program_key_append(uint8_t *buf, uint32_t *offset,
+                               const void *data, uint32_t len)
+{
+   if (buf)
+      memcpy(buf + *offset, data, len);
+   *offset += len;
+}
+
+static uint32_t program_key_fill(struct vrend_context *ctx,
+                                 struct vrend_shader **shaders,
+                                 bool dual_src, uint8_t *buf)
+{
+   uint32_t offset = 0;
+   uint32_t val;
+   int i, j;
+
+   for (i = 0; i < PIPE_SHADER_TYPES; i++) {
+      struct pipe_stream_output_info *so;
+
+      if (!shaders[i])
+         continue;
+
+      so = &shaders[i]->sel->sinfo.so_info;
+      val = i;
+      program_key_append(buf, &offset, &val, sizeof(val));
+      val = tgsi_num_tokens(shaders[i]->sel->tokens);
+      program_key_append(buf, &offset, &val, sizeof(val));
+      program_key_append(buf, &offset, shaders[i]->sel->tokens, val * sizeof(struct tgsi_token));
+      program_key_append(buf, &offset, &shaders[i]->key, sizeof(shaders[i]->key));
+
+      /* stream out state is baked into the program at link time */
+      val = so->num_outputs;
+      program_key_append(buf, &offset, &val, sizeof(val));
+      program_key_append(buf, &offset, so->stride, sizeof(so->stride));
+      for (j = 0; j < so->num_outputs; j++) {
+         val = so->output[j].register_index |
+            so->output[j].start_component << 8 |
+            so->output[j].num_components << 10 |
+            so->output[j].output_buffer << 13 |
+            so->output[j].dst_offset << 16;
+         program_key_append(buf, &offset, &val, sizeof(val));
+         val = so->output[j].stream;
+         program_key_append(buf, &offset, &val, sizeof(val));
+      }
+   }
+
+   val = ctx->shader_cfg.glsl_version;
+   program_key_append(buf, &offset, &val, sizeof(val));
+   val = ctx->shader_cfg.use_gles | ctx->shader_cfg.use_core_profile << 1 |
+      ctx->shader_cfg.use_explicit_locations << 2 |
+      vrend_state.have_vertex_attrib_binding << 3 | dual_src << 4;
+   program_key_append(buf, &offset, &val, sizeof(val));
+   return offset;
+}
+
+static uint8_t *vrend_program_cache_key(struct vrend_context *ctx,
+                                        struct vrend_shader **shaders,
+                                        bool dual_src, uint32_t *key_size)
+{
+   uint8_t *key;
+
+   if (!vrend_program_cache_enabled())
+      return NULL;
+
+   *key_size = program_key_fill(ctx, shaders, dual_src, NULL);
+   key = malloc(*key_size);
+   if (key)
+      program_key_fill(ctx, shaders, dual_src, key);
+   return key;
+}
+
+static bool vrend_program_cache_load_binary(GLuint prog_id, uint8_t *key,
+                                            uint32_t key_size)
+{
+   uint32_t format, size;
+   void *binary;
+   GLint lret;
+
+   if (!key)
+      return false;
+
+   binary = vrend_program_cache_load(key, key_size, &format, &size);
+   if (!binary)
+      return false;
+
+   glProgramBinary(prog_id, format, binary, size);
+   free(binary);
+
+   /* a driver update can reject old binaries, just link from source then */
+   glGetProgramiv(prog_id, GL_LINK_STATUS, &lret);
+   return lret == GL_TRUE;
+}
+
+static void vrend_program_cache_store_binary(GLuint prog_id, uint8_t *key,
+                                             uint32_t key_size)
+{
+   GLint size = 0;
+   GLenum format;
+   void *binary;
+
+   if (!key)
+      return;
+
+   glGetProgramiv(prog_id, GL_PROGRAM_BINARY_LENGTH, &size);
+   if (size <= 0)
+      return;
+
+   binary = malloc(size);
+   if (!binary)
+      return;
+
+   glGetProgramBinary(prog_id, size, &size, &format, binary);
+   if (size > 0)
+      vrend_program_cache_store(key, key_size, format, binary, size);
+   free(binary);
+}
+
 static struct vrend_linked_shader_program *add_cs_shader_program(struct vrend_context *ctx,
 								 struct vrend_shader *cs)
 {
    struct vrend_linked_shader_program *sprog = CALLOC_STRUCT(vrend_linked_shader_program);
+   struct vrend_shader *shaders[PIPE_SHADER_TYPES] = { NULL };
+   uint8_t *cache_key;
+   uint32_t cache_key_size = 0;
    GLuint prog_id;
    GLint lret;
-   prog_id = glCreateProgram();
-   glAttachShader(prog_id, cs->id);
-   glLinkProgram(prog_id);
 
-   glGetProgramiv(prog_id, GL_LINK_STATUS, &lret);
-   if (lret == GL_FALSE) {
-      char infolog[65536];
-      int len;
-      glGetProgramInfoLog(prog_id, 65536, &len, infolog);
-      fprintf(stderr,"got error linking\n%s\n", infolog);
-      /* dump shaders */
-      report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, 0);
-      fprintf(stderr,"compute shader: %d GLSL\n%s\n", cs->id, cs->glsl_prog);
-      glDeleteProgram(prog_id);
-      free(sprog);
+   if (!sprog)
       return NULL;
+
+   shaders[PIPE_SHADER_COMPUTE] = cs;
+   cache_key = vrend_program_cache_key(ctx, shaders, false, &cache_key_size);
+
+   prog_id = glCreateProgram();
+   if (!vrend_program_cache_load_binary(prog_id, cache_key, cache_key_size)) {
+      if (!vrend_wait_shader_compiled(ctx, cs)) {
+         glDeleteProgram(prog_id);
+         free(cache_key);
+         free(sprog);
+         return NULL;
+      }
+      glAttachShader(prog_id, cs->id);
+      if (cache_key)
+         glProgramParameteri(prog_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+      glLinkProgram(prog_id);
+
+      glGetProgramiv(prog_id, GL_LINK_STATUS, &lret);
+      if (lret == GL_FALSE) {
+         char infolog[65536];
+         int len;
+         glGetProgramInfoLog(prog_id, 65536, &len, infolog);
+         fprintf(stderr,"got error linking\n%s\n", infolog);
+         /* dump shaders */
+         report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, 0);
+         fprintf(stderr,"compute shader: %d GLSL\n%s\n", cs->id, cs->glsl_prog);
+         glDeleteProgram(prog_id);
+         free(cache_key);
+         free(sprog);
+         return NULL;
+      }
+      vrend_program_cache_store_binary(prog_id, cache_key, cache_key_size);
    }
+   free(cache_key);
    sprog->ss[PIPE_SHADER_COMPUTE] = cs;
 
    list_add(&sprog->sl[PIPE_SHADER_COMPUTE], &cs->programs);
    sprog->id = prog_id;
-   list_addtail(&sprog->head, &ctx->sub->programs);
+   sprog->key.cs_id = cs->id;
+   vrend_program_cache_insert(ctx->sub, sprog);
 
    bind_ssbo_locs(ctx, PIPE_SHADER_COMPUTE, sprog);
    bind_image_locs(ctx, PIPE_SHADER_COMPUTE, sprog);
@@ -1003,15 +1486,39 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
                                                               struct vrend_shader *gs)
 {
    struct vrend_linked_shader_program *sprog = CALLOC_STRUCT(vrend_linked_shader_program);
+   struct vrend_shader *shaders[PIPE_SHADER_TYPES] = { NULL };
    char name[64];
    int i;
    GLuint prog_id;
    GLint lret;
    int id;
    int last_shader;
+   bool dual_src = util_blend_state_is_dual(&ctx->sub->blend_state, 0);
+   uint8_t *cache_key;
+   uint32_t cache_key_size = 0;
    if (!sprog)
       return NULL;
 
+   sprog->dual_src_linked = fs->sel->sinfo.num_outputs > 1 && dual_src;
+
+   shaders[PIPE_SHADER_VERTEX] = vs;
+   shaders[PIPE_SHADER_FRAGMENT] = fs;
+   shaders[PIPE_SHADER_GEOMETRY] = gs;
+   cache_key = vrend_program_cache_key(ctx, shaders, dual_src, &cache_key_size);
+
+   prog_id = glCreateProgram();
+   if (vrend_program_cache_load_binary(prog_id, cache_key, cache_key_size))
+      goto linked;
+
+   if (!vrend_wait_shader_compiled(ctx, vs) ||
+       !vrend_wait_shader_compiled(ctx, fs) ||
+       (gs && !vrend_wait_shader_compiled(ctx, gs))) {
+      glDeleteProgram(prog_id);
+      free(cache_key);
+      free(sprog);
+      return NULL;
+   }
+
    /* need to rewrite VS code to add interpolation params */
    if ((gs && gs->compiled_fs_id != fs->id) ||
        (!gs && vs->compiled_fs_id != fs->id)) {
@@ -1028,6 +1535,8 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
       ret = vrend_compile_shader(ctx, gs ? gs : vs);
       if (ret == false) {
          glDeleteShader(gs ? gs->id : vs->id);
+         glDeleteProgram(prog_id);
+         free(cache_key);
          free(sprog);
          return NULL;
       }
@@ -1037,7 +1546,6 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
          vs->compiled_fs_id = fs->id;
    }
 
-   prog_id = glCreateProgram();
    glAttachShader(prog_id, vs->id);
    if (gs) {
       if (gs->id > 0)
@@ -1049,17 +1557,14 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
    glAttachShader(prog_id, fs->id);
 
    if (fs->sel->sinfo.num_outputs > 1) {
-      if (util_blend_state_is_dual(&ctx->sub->blend_state, 0)) {
+      if (dual_src) {
          glBindFragDataLocationIndexed(prog_id, 0, 0, "fsout_c0");
          glBindFragDataLocationIndexed(prog_id, 0, 1, "fsout_c1");
-         sprog->dual_src_linked = true;
       } else {
          glBindFragDataLocationIndexed(prog_id, 0, 0, "fsout_c0");
          glBindFragDataLocationIndexed(prog_id, 1, 0, "fsout_c1");
-         sprog->dual_src_linked = false;
       }
-   } else
-      sprog->dual_src_linked = false;
+   }
 
    if (vrend_state.have_vertex_attrib_binding) {
       uint32_t mask = vs->sel->sinfo.attrib_input_mask;
@@ -1070,6 +1575,8 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
       }
    }
 
+   if (cache_key)
+      glProgramParameteri(prog_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
    glLinkProgram(prog_id);
 
    glGetProgramiv(prog_id, GL_LINK_STATUS, &lret);
@@ -1085,9 +1592,14 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
          fprintf(stderr,"geom shader: %d GLSL\n%s\n", gs->id, gs->glsl_prog);
       fprintf(stderr,"frag shader: %d GLSL\n%s\n", fs->id, fs->glsl_prog);
       glDeleteProgram(prog_id);
+      free(cache_key);
       free(sprog);
       return NULL;
    }
+   vrend_program_cache_store_binary(prog_id, cache_key, cache_key_size);
+
+linked:
+   free(cache_key);
 
    sprog->ss[PIPE_SHADER_VERTEX] = vs;
    sprog->ss[PIPE_SHADER_FRAGMENT] = fs;
@@ -1101,7 +1613,11 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
    last_shader = gs ? PIPE_SHADER_GEOMETRY : PIPE_SHADER_FRAGMENT;
    sprog->id = prog_id;
 
-   list_addtail(&sprog->head, &ctx->sub->programs);
+   sprog->key.vs_id = vs->id;
+   sprog->key.fs_id = fs->id;
+   sprog->key.gs_id = gs ? gs->id : 0;
+   sprog->key.dual_src = util_blend_state_is_dual(&ctx->sub->blend_state, 0);
+   vrend_program_cache_insert(ctx->sub, sprog);
 
    if (fs->key.pstipple_tex)
       sprog->fs_stipple_loc = glGetUniformLocation(prog_id, "pstipple_sampler");
@@ -1156,16 +1672,20 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
 
    for (id = PIPE_SHADER_VERTEX; id <= last_shader; id++) {
       if (sprog->ss[id]->sel->sinfo.num_consts) {
-         sprog->const_locs[id] = calloc(sprog->ss[id]->sel->sinfo.num_consts, sizeof(uint32_t));
-         if (sprog->const_locs[id]) {
-            const char *prefix = pipe_shader_to_prefix(id);
-            for (i = 0; i < sprog->ss[id]->sel->sinfo.num_consts; i++) {
-               snprintf(name, 32, "%sconst0[%d]", prefix, i);
-               sprog->const_locs[id][i] = glGetUniformLocation(prog_id, name);
-            }
-         }
+         const GLchar *names[1] = { name };
+         GLuint index;
+
+         /* the elements of an array have consecutive locations */
+         snprintf(name, 32, "%sconst0[0]", pipe_shader_to_prefix(id));
+         sprog->const_location[id] = glGetUniformLocation(prog_id, name);
+         glGetUniformIndices(prog_id, 1, names, &index);
+         if (index != GL_INVALID_INDEX)
+            glGetActiveUniformsiv(prog_id, 1, &index, GL_UNIFORM_SIZE,
+                                  &sprog->const_array_size[id]);
+         else
+            sprog->const_location[id] = -1;
       } else
-         sprog->const_locs[id] = NULL;
+         sprog->const_location[id] = -1;
    }
 
    if (!vrend_state.have_vertex_attrib_binding) {
@@ -1201,34 +1721,24 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
 static struct vrend_linked_shader_program *lookup_cs_shader_program(struct vrend_context *ctx,
 								    GLuint cs_id)
 {
-   struct vrend_linked_shader_program *ent;
-   LIST_FOR_EACH_ENTRY(ent, &ctx->sub->programs, head) {
-      if (!ent->ss[PIPE_SHADER_COMPUTE])
-	 continue;
-      if (ent->ss[PIPE_SHADER_COMPUTE]->id == cs_id)
-	 return ent;
-   }
-   return NULL;
+   struct vrend_linked_shader_program_key key;
+
+   memset(&key, 0, sizeof(key));
+   key.cs_id = cs_id;
+   return vrend_program_cache_lookup(ctx->sub, &key);
 }
 
 static struct vrend_linked_shader_program *lookup_shader_program(struct vrend_context *ctx,
                                                                  GLuint vs_id, GLuint fs_id, GLuint gs_id, bool dual_src)
 {
-   struct vrend_linked_shader_program *ent;
-   LIST_FOR_EACH_ENTRY(ent, &ctx->sub->programs, head) {
-      if (ent->dual_src_linked != dual_src)
-         continue;
-      if (!ent->ss[PIPE_SHADER_VERTEX] || !ent->ss[PIPE_SHADER_FRAGMENT])
-         continue;
+   struct vrend_linked_shader_program_key key;
 
-      if (ent->ss[PIPE_SHADER_VERTEX]->id == vs_id && ent->ss[PIPE_SHADER_FRAGMENT]->id == fs_id) {
-         if (!ent->ss[PIPE_SHADER_GEOMETRY] && gs_id == 0)
-            return ent;
-         if (ent->ss[PIPE_SHADER_GEOMETRY] && ent->ss[PIPE_SHADER_GEOMETRY]->id == gs_id)
-            return ent;
-      }
-   }
-   return NULL;
+   memset(&key, 0, sizeof(key));
+   key.vs_id = vs_id;
+   key.fs_id = fs_id;
+   key.gs_id = gs_id;
+   key.dual_src = dual_src;
+   return vrend_program_cache_lookup(ctx->sub, &key);
 }
 
 static void vrend_destroy_program(struct vrend_linked_shader_program *ent)
@@ -1236,6 +1746,15 @@ static void vrend_destroy_program(struct vrend_linked_shader_program *ent)
    int i;
    glDeleteProgram(ent->id);
    list_del(&ent->head);
+   if (ent->sub_ctx) {
+      util_hash_table_remove(ent->sub_ctx->program_hash, &ent->key);
+      ent->sub_ctx->num_programs--;
+      if (ent->sub_ctx->prog == ent) {
+         ent->sub_ctx->prog = NULL;
+         memset(ent->sub_ctx->prog_ids, 0, sizeof(ent->sub_ctx->prog_ids));
+         ent->sub_ctx->shader_dirty = true;
+      }
+   }
 
    for (i = PIPE_SHADER_VERTEX; i <= PIPE_SHADER_COMPUTE; i++) {
       if (ent->ss[i])
@@ -1244,7 +1763,6 @@ static void vrend_destroy_program(struct vrend_linked_shader_program *ent)
       free(ent->shadow_samp_add_locs[i]);
       free(ent->samp_locs[i]);
       free(ent->img_locs[i]);
-      free(ent->const_locs[i]);
       free(ent->ubo_locs[i]);
    }
    free(ent->attrib_locs);
@@ -1258,6 +1776,11 @@ static void vrend_free_programs(struct vrend_sub_context *sub)
    if (LIST_IS_EMPTY(&sub->programs))
       return;
 
+   if (vrend_dump_shaders)
+      fprintf(stderr, "program cache: %u programs, %u hits, %u misses, %u evictions\n",
+              sub->num_programs, sub->program_cache_hits,
+              sub->program_cache_misses, sub->program_cache_evictions);
+
    LIST_FOR_EACH_ENTRY_SAFE(ent, tmp, &sub->programs, head) {
       vrend_destroy_program(ent);
    }
@@ -1293,7 +1816,7 @@ int vrend_create_surface(struct vrend_context *ctx,
       return EINVAL;
    }
 
-   surf = CALLOC_STRUCT(vrend_surface);
+   surf = vrend_slab_alloc(ctx->slabs[VREND_SLAB_SURFACE]);
    if (!surf)
       return ENOMEM;
 
@@ -1301,13 +1824,15 @@ int vrend_create_surface(struct vrend_context *ctx,
    surf->format = format;
    surf->val0 = val0;
    surf->val1 = val1;
+   list_inithead(&surf->fbos);
    pipe_reference_init(&surf->reference, 1);
 
    vrend_resource_reference(&surf->texture, res);
 
    ret_handle = vrend_renderer_object_insert(ctx, surf, sizeof(*surf), handle, VIRGL_OBJECT_SURFACE);
    if (ret_handle == 0) {
-      FREE(surf);
+      vrend_resource_reference(&surf->texture, NULL);
+      vrend_slab_free(surf);
       return ENOMEM;
    }
    return 0;
@@ -1375,7 +1900,7 @@ static void vrend_destroy_sampler_state_object(void *obj_ptr)
    struct vrend_sampler_state *state = obj_ptr;
 
    glDeleteSamplers(1, &state->id);
-   FREE(state);
+   vrend_slab_free(state);
 }
 
 static GLuint convert_wrap(int wrap)
@@ -1427,7 +1952,7 @@ int vrend_create_sampler_state(struct vrend_context *ctx,
                                uint32_t handle,
                                struct pipe_sampler_state *templ)
 {
-   struct vrend_sampler_state *state = CALLOC_STRUCT(vrend_sampler_state);
+   struct vrend_sampler_state *state = vrend_slab_alloc(ctx->slabs[VREND_SLAB_SAMPLER_STATE]);
    int ret_handle;
 
    if (!state)
@@ -1463,7 +1988,7 @@ int vrend_create_sampler_state(struct vrend_context *ctx,
    if (!ret_handle) {
       if (vrend_state.have_samplers)
          glDeleteSamplers(1, &state->id);
-      FREE(state);
+      vrend_slab_free(state);
       return ENOMEM;
    }
    return 0;
@@ -1500,7 +2025,7 @@ int vrend_create_sampler_view(struct vrend_context *ctx,
       return EINVAL;
    }
 
-   view = CALLOC_STRUCT(vrend_sampler_view);
+   view = vrend_slab_alloc(ctx->slabs[VREND_SLAB_SAMPLER_VIEW]);
    if (!view)
       return ENOMEM;
 
@@ -1554,7 +2079,8 @@ int vrend_create_sampler_view(struct vrend_context *ctx,
 
    ret_handle = vrend_renderer_object_insert(ctx, view, sizeof(*view), handle, VIRGL_OBJECT_SAMPLER_VIEW);
    if (ret_handle == 0) {
-      FREE(view);
+      vrend_resource_reference(&view->texture, NULL);
+      vrend_slab_free(view);
       return ENOMEM;
    }
    return 0;
@@ -1721,60 +2247,198 @@ static void vrend_hw_emit_framebuffer_state(struct vrend_context *ctx)
    glDrawBuffers(ctx->sub->nr_cbufs, buffers);
 }
 
-void vrend_set_framebuffer_state(struct vrend_context *ctx,
-                                 uint32_t nr_cbufs, uint32_t surf_handle[PIPE_MAX_COLOR_BUFS],
-                                 uint32_t zsurf_handle)
+static void vrend_update_cbuf_key_state(struct vrend_context *ctx)
 {
-   struct vrend_surface *surf, *zsurf;
+   uint32_t a8_bitmask = 0;
+   bool have_pure_integer = false;
    int i;
-   int old_num;
-   GLenum status;
-   GLint new_height = -1;
-   bool new_ibf = false;
-
-   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, ctx->sub->fb_id);
 
-   if (zsurf_handle) {
-      zsurf = vrend_object_lookup(ctx->sub->object_hash, zsurf_handle, VIRGL_OBJECT_SURFACE);
-      if (!zsurf) {
-         report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SURFACE, zsurf_handle);
-         return;
-      }
-   } else
-      zsurf = NULL;
+   for (i = 0; i < ctx->sub->nr_cbufs; i++) {
+      if (!ctx->sub->surf[i])
+         continue;
+      if (vrend_format_is_emulated_alpha(ctx->sub->surf[i]->format))
+         a8_bitmask |= (1 << i);
+      if (util_format_is_pure_integer(ctx->sub->surf[i]->format))
+         have_pure_integer = true;
+   }
 
-   if (ctx->sub->zsurf != zsurf) {
-      vrend_surface_reference(&ctx->sub->zsurf, zsurf);
-      vrend_hw_set_zsurf_texture(ctx);
+   if (ctx->sub->cbufs_are_a8_bitmask != a8_bitmask ||
+       ctx->sub->cbufs_have_pure_integer != have_pure_integer) {
+      ctx->sub->cbufs_are_a8_bitmask = a8_bitmask;
+      ctx->sub->cbufs_have_pure_integer = have_pure_integer;
+      ctx->sub->shader_dirty = true;
    }
+}
 
-   old_num = ctx->sub->nr_cbufs;
-   ctx->sub->nr_cbufs = nr_cbufs;
-   ctx->sub->old_nr_cbufs = old_num;
+/* surfaces that attach the same image are interchangeable here */
+static bool vrend_fbo_surface_equal(const struct vrend_surface *a,
+                                    const struct vrend_surface *b)
+{
+   if (a == b)
+      return true;
+   if (!a || !b)
+      return false;
+   return a->texture == b->texture && a->val0 == b->val0 &&
+          a->val1 == b->val1;
+}
 
-   for (i = 0; i < nr_cbufs; i++) {
-      if (surf_handle[i] != 0) {
-         surf = vrend_object_lookup(ctx->sub->object_hash, surf_handle[i], VIRGL_OBJECT_SURFACE);
-         if (!surf) {
-            report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SURFACE, surf_handle[i]);
-            return;
-         }
-      } else
-         surf = NULL;
+static bool vrend_fbo_matches(const struct vrend_fbo *fbo,
+                              const struct vrend_sub_context *sub)
+{
+   int i;
 
-      if (ctx->sub->surf[i] != surf) {
-         vrend_surface_reference(&ctx->sub->surf[i], surf);
-         vrend_hw_set_color_surface(ctx, i);
-      }
+   if (fbo->nr_cbufs != sub->nr_cbufs ||
+       !vrend_fbo_surface_equal(fbo->zsurf, sub->zsurf))
+      return false;
+
+   for (i = 0; i < sub->nr_cbufs; i++) {
+      if (!vrend_fbo_surface_equal(fbo->surf[i], sub->surf[i]))
+         return false;
+   }
+   return true;
+}
+
+static void vrend_fbo_set_surface(struct vrend_fbo *fbo, int idx,
+                                  struct vrend_surface *surf)
+{
+   struct vrend_surface **slot = idx == VREND_FBO_ZSURF ? &fbo->zsurf : &fbo->surf[idx];
+
+   if (*slot == surf)
+      return;
+   if (*slot)
+      list_del(&fbo->links[idx].head);
+   *slot = surf;
+   if (surf)
+      list_addtail(&fbo->links[idx].head, &surf->fbos);
+}
+
+static void vrend_fbo_destroy(struct vrend_fbo *fbo)
+{
+   int i;
+
+   glDeleteFramebuffers(1, &fbo->id);
+   for (i = 0; i < fbo->nr_cbufs; i++)
+      vrend_fbo_set_surface(fbo, i, NULL);
+   vrend_fbo_set_surface(fbo, VREND_FBO_ZSURF, NULL);
+   list_del(&fbo->head);
+   fbo->sub->num_cached_fbos--;
+   FREE(fbo);
+}
+
+/* point the entry at the surfaces currently bound, they attach the same
+ * images, and the bound ones are kept alive by the sub context */
+static void vrend_fbo_update_surfaces(struct vrend_fbo *fbo,
+                                      const struct vrend_sub_context *sub)
+{
+   int i;
+
+   for (i = 0; i < fbo->nr_cbufs; i++)
+      vrend_fbo_set_surface(fbo, i, sub->surf[i]);
+   vrend_fbo_set_surface(fbo, VREND_FBO_ZSURF, sub->zsurf);
+}
+
+/* Returns a complete framebuffer for the current attachments of the sub
+ * context. Attaching and the completeness check only happen the first time
+ * an attachment set is seen, after that it is a cache hit until the entry
+ * falls out of the LRU.
+ */
+static GLuint vrend_fbo_cache_get(struct vrend_context *ctx)
+{
+   struct vrend_sub_context *sub = ctx->sub;
+   struct vrend_fbo *fbo;
+   GLenum status;
+   int i;
+
+   if (sub->nr_cbufs == 0 && !sub->zsurf)
+      return sub->fb_empty_id;
+
+   LIST_FOR_EACH_ENTRY(fbo, &sub->fbo_cache, head) {
+      if (vrend_fbo_matches(fbo, sub)) {
+         list_del(&fbo->head);
+         list_add(&fbo->head, &sub->fbo_cache);
+         vrend_fbo_update_surfaces(fbo, sub);
+         return fbo->id;
+      }
    }
 
-   if (old_num > ctx->sub->nr_cbufs) {
-      for (i = ctx->sub->nr_cbufs; i < old_num; i++) {
-         vrend_surface_reference(&ctx->sub->surf[i], NULL);
+   if (sub->num_cached_fbos == VREND_FBO_CACHE_SIZE)
+      vrend_fbo_destroy(LIST_ENTRY(struct vrend_fbo, sub->fbo_cache.prev, head));
+
+   fbo = CALLOC_STRUCT(vrend_fbo);
+   if (!fbo) {
+      fprintf(stderr, "failed to allocate framebuffer %s\n", ctx->debug_name);
+      return sub->fb_empty_id;
+   }
+   fbo->sub = sub;
+   for (i = 0; i <= VREND_FBO_ZSURF; i++)
+      fbo->links[i].fbo = fbo;
+
+   glGenFramebuffers(1, &fbo->id);
+   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo->id);
+
+   if (sub->zsurf)
+      vrend_hw_set_zsurf_texture(ctx);
+   fbo->nr_cbufs = sub->nr_cbufs;
+   for (i = 0; i < sub->nr_cbufs; i++) {
+      if (sub->surf[i])
          vrend_hw_set_color_surface(ctx, i);
+   }
+   vrend_fbo_update_surfaces(fbo, sub);
+
+   status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+   if (status != GL_FRAMEBUFFER_COMPLETE)
+      fprintf(stderr,"failed to complete framebuffer 0x%x %s\n", status, ctx->debug_name);
+
+   list_add(&fbo->head, &sub->fbo_cache);
+   sub->num_cached_fbos++;
+   return fbo->id;
+}
+
+void vrend_set_framebuffer_state(struct vrend_context *ctx,
+                                 uint32_t nr_cbufs, uint32_t surf_handle[PIPE_MAX_COLOR_BUFS],
+                                 uint32_t zsurf_handle)
+{
+   struct vrend_surface *surf, *zsurf;
+   struct vrend_surface *surfs[PIPE_MAX_COLOR_BUFS];
+   int i;
+   int old_num;
+   GLint new_height = -1;
+   bool new_ibf = false;
+   bool old_ibf = ctx->sub->inverted_fbo_content;
+
+   if (zsurf_handle) {
+      zsurf = vrend_object_lookup(ctx->sub->object_table, zsurf_handle, VIRGL_OBJECT_SURFACE);
+      if (!zsurf) {
+         report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SURFACE, zsurf_handle);
+         return;
       }
+   } else
+      zsurf = NULL;
+
+   for (i = 0; i < nr_cbufs; i++) {
+      if (surf_handle[i] != 0) {
+         surfs[i] = vrend_object_lookup(ctx->sub->object_table, surf_handle[i], VIRGL_OBJECT_SURFACE);
+         if (!surfs[i]) {
+            report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SURFACE, surf_handle[i]);
+            return;
+         }
+      } else
+         surfs[i] = NULL;
    }
 
+   vrend_surface_reference(&ctx->sub->zsurf, zsurf);
+
+   old_num = ctx->sub->nr_cbufs;
+   ctx->sub->nr_cbufs = nr_cbufs;
+   ctx->sub->old_nr_cbufs = old_num;
+
+   for (i = 0; i < nr_cbufs; i++)
+      vrend_surface_reference(&ctx->sub->surf[i], surfs[i]);
+   for (i = nr_cbufs; i < old_num; i++)
+      vrend_surface_reference(&ctx->sub->surf[i], NULL);
+
+   ctx->sub->fb_id = vrend_fbo_cache_get(ctx);
+
    /* find a buffer to set fb_height from */
    if (ctx->sub->nr_cbufs == 0 && !ctx->sub->zsurf) {
       new_height = 0;
@@ -1810,12 +2474,9 @@ void vrend_set_framebuffer_state(struct vrend_context *ctx,
 
    vrend_hw_emit_framebuffer_state(ctx);
 
-   if (ctx->sub->nr_cbufs > 0 || ctx->sub->zsurf) {
-      status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-      if (status != GL_FRAMEBUFFER_COMPLETE)
-         fprintf(stderr,"failed to complete framebuffer 0x%x %s\n", status, ctx->debug_name);
-   }
-   ctx->sub->shader_dirty = true;
+   if (old_ibf != ctx->sub->inverted_fbo_content)
+      ctx->sub->shader_dirty = true;
+   vrend_update_cbuf_key_state(ctx);
 }
 
 /*
@@ -2007,7 +2668,7 @@ void vrend_bind_vertex_elements_state(struct vrend_context *ctx,
       ctx->sub->ve = NULL;
       return;
    }
-   v = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_VERTEX_ELEMENTS);
+   v = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_VERTEX_ELEMENTS);
    if (!v) {
       report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_HANDLE, handle);
       return;
@@ -2025,18 +2686,44 @@ void vrend_set_constants(struct vrend_context *ctx,
                          float *data)
 {
    struct vrend_constants *consts;
-   int i;
+   const unsigned int *values = (const unsigned int *)data;
+   uint32_t num_common, first, last;
 
    consts = &ctx->sub->consts[shader];
-   ctx->sub->const_dirty[shader] = true;
 
-   consts->consts = realloc(consts->consts, num_constant * sizeof(float));
-   if (!consts->consts)
-      return;
+   /* keep the storage at its high-water mark */
+   if (num_constant > consts->num_allocated_consts) {
+      unsigned int *new_consts = realloc(consts->consts, num_constant * sizeof(unsigned int));
+      if (!new_consts)
+         return;
+      consts->consts = new_consts;
+      consts->num_allocated_consts = num_constant;
+   }
+
+   /* guests send the whole buffer, only what changed has to be uploaded */
+   num_common = MIN2(consts->num_consts, num_constant);
+   first = 0;
+   while (first < num_common && consts->consts[first] == values[first])
+      first++;
+   last = num_constant;
+   if (num_constant <= consts->num_consts) {
+      while (last > first && consts->consts[last - 1] == values[last - 1])
+         last--;
+   }
+
+   if (first < last) {
+      uint32_t start = first / 4, end = (last + 3) / 4;
 
+      if (consts->dirty_start == consts->dirty_end) {
+         consts->dirty_start = start;
+         consts->dirty_end = end;
+      } else {
+         consts->dirty_start = MIN2(consts->dirty_start, start);
+         consts->dirty_end = MAX2(consts->dirty_end, end);
+      }
+      memcpy(consts->consts + first, values + first, (last - first) * sizeof(unsigned int));
+   }
    consts->num_consts = num_constant;
-   for (i = 0; i < num_constant; i++)
-      consts->consts[i] = ((unsigned int *)data)[i];
 }
 
 void vrend_set_uniform_buffer(struct vrend_context *ctx,
@@ -2154,7 +2841,7 @@ void vrend_set_single_sampler_view(struct vrend_context *ctx,
    struct vrend_texture *tex;
 
    if (handle) {
-      view = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_SAMPLER_VIEW);
+      view = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_SAMPLER_VIEW);
       if (!view) {
          ctx->sub->views[shader_type].views[index] = NULL;
          report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_HANDLE, handle);
@@ -2336,18 +3023,8 @@ static inline void vrend_fill_shader_key(struct vrend_context *ctx,
                                          struct vrend_shader_key *key)
 {
    if (vrend_state.use_core_profile == true) {
-      int i;
-      bool add_alpha_test = true;
-      key->cbufs_are_a8_bitmask = 0;
-      for (i = 0; i < ctx->sub->nr_cbufs; i++) {
-         if (!ctx->sub->surf[i])
-            continue;
-         if (vrend_format_is_emulated_alpha(ctx->sub->surf[i]->format))
-            key->cbufs_are_a8_bitmask |= (1 << i);
-         if (util_format_is_pure_integer(ctx->sub->surf[i]->format))
-            add_alpha_test = false;
-      }
-      if (add_alpha_test) {
+      key->cbufs_are_a8_bitmask = ctx->sub->cbufs_are_a8_bitmask;
+      if (!ctx->sub->cbufs_have_pure_integer) {
          key->add_alpha_test = ctx->sub->dsa_state.alpha.enabled;
          key->alpha_test = ctx->sub->dsa_state.alpha.func;
          key->alpha_ref_val = ctx->sub->dsa_state.alpha.ref_value;
@@ -2409,7 +3086,7 @@ static int vrend_shader_create(struct vrend_context *ctx,
    if (1) {//shader->sel->type == PIPE_SHADER_FRAGMENT || shader->sel->type == PIPE_SHADER_GEOMETRY) {
       bool ret;
 
-      ret = vrend_compile_shader(ctx, shader);
+      ret = vrend_compile_shader_deferred(ctx, shader);
       if (ret == false) {
          glDeleteShader(shader->id);
          free(shader->glsl_prog);
@@ -2419,49 +3096,64 @@ static int vrend_shader_create(struct vrend_context *ctx,
    return 0;
 }
 
+static uint32_t vrend_shader_key_hash(const struct vrend_shader_key *key)
+{
+   const uint8_t *p = (const uint8_t *)key;
+   uint32_t hash = 2166136261u;
+   unsigned i;
+
+   /* keys are memset before they are filled, so padding is zero */
+   for (i = 0; i < sizeof(*key); i++)
+      hash = (hash ^ p[i]) * 16777619u;
+   return hash;
+}
+
 static int vrend_shader_select(struct vrend_context *ctx,
                                struct vrend_shader_selector *sel,
                                bool *dirty)
 {
    struct vrend_shader_key key;
-   struct vrend_shader *shader = NULL;
+   struct vrend_shader *shader;
+   uint32_t hash;
+   unsigned bucket;
    int r;
 
    memset(&key, 0, sizeof(key));
    vrend_fill_shader_key(ctx, sel->type, &key);
+   hash = vrend_shader_key_hash(&key);
 
-   if (sel->current && !memcmp(&sel->current->key, &key, sizeof(key)))
+   if (sel->current && sel->current->key_hash == hash &&
+       !memcmp(&sel->current->key, &key, sizeof(key)))
       return 0;
 
-   if (sel->num_shaders > 1) {
-      struct vrend_shader *p = sel->current, *c = p->next_variant;
-      while (c && memcmp(&c->key, &key, sizeof(key)) != 0) {
-         p = c;
-         c = c->next_variant;
-      }
-      if (c) {
-         p->next_variant = c->next_variant;
-         shader = c;
-      }
+   bucket = hash % VREND_SHADER_VARIANT_BUCKETS;
+   for (shader = sel->variants[bucket]; shader; shader = shader->next_variant) {
+      if (shader->key_hash == hash && !memcmp(&shader->key, &key, sizeof(key)))
+         break;
    }
 
    if (!shader) {
-      shader = CALLOC_STRUCT(vrend_shader);
+      shader = vrend_slab_alloc(ctx->slabs[VREND_SLAB_SHADER]);
+      if (!shader)
+         return ENOMEM;
       shader->sel = sel;
       list_inithead(&shader->programs);
+      list_inithead(&shader->compile_head);
 
       r = vrend_shader_create(ctx, shader, key);
       if (r) {
          sel->current = NULL;
-         FREE(shader);
+         vrend_slab_free(shader);
          return r;
       }
+      shader->key_hash = hash;
+      shader->next_variant = sel->variants[bucket];
+      sel->variants[bucket] = shader;
       sel->num_shaders++;
    }
    if (dirty)
       *dirty = true;
 
-   shader->next_variant = sel->current;
    sel->current = shader;
    return 0;
 }
@@ -2470,7 +3162,7 @@ static void *vrend_create_shader_state(struct vrend_context *ctx,
                                        const struct pipe_stream_output_info *so_info,
                                        unsigned pipe_shader_type)
 {
-   struct vrend_shader_selector *sel = CALLOC_STRUCT(vrend_shader_selector);
+   struct vrend_shader_selector *sel = vrend_slab_alloc(ctx->slabs[VREND_SLAB_SHADER_SELECTOR]);
 
    if (!sel)
       return NULL;
@@ -2497,11 +3189,143 @@ static int vrend_finish_shader(struct vrend_context *ctx,
    return 0;
 }
 
+static int tgsi_processor_to_pipe_shader(unsigned processor)
+{
+   switch (processor) {
+   case TGSI_PROCESSOR_VERTEX: return PIPE_SHADER_VERTEX;
+   case TGSI_PROCESSOR_FRAGMENT: return PIPE_SHADER_FRAGMENT;
+   case TGSI_PROCESSOR_GEOMETRY: return PIPE_SHADER_GEOMETRY;
+   case TGSI_PROCESSOR_COMPUTE: return PIPE_SHADER_COMPUTE;
+   default:
+      return -1;
+   }
+}
+
+/* Size of the top level token at pos, or 0 if the token would make the
+ * gallium parser overflow one of its fixed size arrays. The parser trusts
+ * the token stream, guest provided shaders have to be checked first.
+ */
+static uint32_t vrend_shader_token_size(const struct tgsi_token *tokens,
+                                        uint32_t pos, uint32_t end)
+{
+   const struct tgsi_token *token = &tokens[pos];
+   uint32_t size;
+
+   switch (token->Type) {
+   case TGSI_TOKEN_TYPE_DECLARATION:
+      size = token->NrTokens;
+      break;
+   case TGSI_TOKEN_TYPE_IMMEDIATE: {
+      const struct tgsi_immediate *imm = (const struct tgsi_immediate *)token;
+      size = imm->NrTokens;
+      if (size < 1 || size - 1 > 4)
+         return 0;
+      break;
+   }
+   case TGSI_TOKEN_TYPE_INSTRUCTION: {
+      const struct tgsi_instruction *inst = (const struct tgsi_instruction *)token;
+      size = inst->NrTokens + 1;
+      if (inst->NumDstRegs > TGSI_FULL_MAX_DST_REGISTERS ||
+          inst->NumSrcRegs > TGSI_FULL_MAX_SRC_REGISTERS)
+         return 0;
+      if (inst->Texture) {
+         uint32_t tex_pos = pos + 1 + inst->Label;
+         const struct tgsi_instruction_texture *tex;
+
+         if (tex_pos >= end)
+            return 0;
+         tex = (const struct tgsi_instruction_texture *)&tokens[tex_pos];
+         if (tex->NumOffsets > TGSI_FULL_MAX_TEX_OFFSETS)
+            return 0;
+      }
+      break;
+   }
+   case TGSI_TOKEN_TYPE_PROPERTY:
+      size = token->NrTokens;
+      if (size < 1 || size - 1 > 8)
+         return 0;
+      break;
+   default:
+      return 0;
+   }
+
+   if (size > end - pos)
+      return 0;
+   return size;
+}
+
+static bool vrend_check_shader_tokens(const struct tgsi_token *tokens)
+{
+   const struct tgsi_header *header = (const struct tgsi_header *)tokens;
+   uint32_t end = header->HeaderSize + header->BodySize;
+   struct tgsi_parse_context parse;
+   uint32_t pos, size;
+   bool ret = true;
+
+   for (pos = header->HeaderSize; pos < end; pos += size) {
+      size = vrend_shader_token_size(tokens, pos, end);
+      if (!size)
+         return false;
+   }
+
+   /* now the parser can't overflow, make sure it reads what the
+      sizes say so the translator stays within the tokens too */
+   if (tgsi_parse_init(&parse, tokens) != TGSI_PARSE_OK)
+      return false;
+   while (!tgsi_parse_end_of_tokens(&parse)) {
+      pos = parse.Position;
+      tgsi_parse_token(&parse);
+      if (parse.Position != pos + vrend_shader_token_size(tokens, pos, end)) {
+         ret = false;
+         break;
+      }
+   }
+   tgsi_parse_free(&parse);
+   return ret;
+}
+
+/* An instruction whose flags don't match its size can make the parser
+   read past the end of the body, keep some zeroed tokens behind it. */
+#define VREND_SHADER_TOKENS_PADDING 64
+
+/* Copy and validate a binary token array sent by the guest. */
+static struct tgsi_token *vrend_copy_shader_tokens(const char *data, uint32_t size,
+                                                   uint32_t num_tokens, uint32_t type)
+{
+   const struct tgsi_header *header;
+   const struct tgsi_processor *processor;
+   struct tgsi_token *tokens;
+
+   if (num_tokens < 2 || num_tokens > size / sizeof(struct tgsi_token))
+      return NULL;
+
+   header = (const struct tgsi_header *)data;
+   processor = (const struct tgsi_processor *)(data + sizeof(struct tgsi_token));
+   if (header->HeaderSize != 2 ||
+       header->HeaderSize + header->BodySize > num_tokens ||
+       tgsi_processor_to_pipe_shader(processor->Processor) != (int)type) {
+      fprintf(stderr, "got malformed binary shader\n");
+      return NULL;
+   }
+
+   tokens = calloc(num_tokens + VREND_SHADER_TOKENS_PADDING, sizeof(struct tgsi_token));
+   if (!tokens)
+      return NULL;
+   memcpy(tokens, data, num_tokens * sizeof(struct tgsi_token));
+
+   if (!vrend_check_shader_tokens(tokens) || !tgsi_sanity_check(tokens)) {
+      fprintf(stderr, "binary shader failed the sanity check\n");
+      free(tokens);
+      return NULL;
+   }
+   return tokens;
+}
+
 int vrend_create_shader(struct vrend_context *ctx,
                         uint32_t handle,
                         const struct pipe_stream_output_info *so_info,
                         const char *shd_text, uint32_t offlen, uint32_t num_tokens,
-                        uint32_t type, uint32_t pkt_length)
+                        uint32_t type, bool binary_tokens, uint32_t pkt_length)
 {
    struct vrend_shader_selector *sel = NULL;
    int ret_handle;
@@ -2530,6 +3354,7 @@ int vrend_create_shader(struct vrend_context *ctx,
      sel = vrend_create_shader_state(ctx, so_info, type);
      if (sel == NULL)
        return ENOMEM;
+     sel->binary_tokens = binary_tokens;
 
      if (long_shader) {
         sel->buf_len = ((offlen + 3) / 4) * 4; /* round up buffer size */
@@ -2544,13 +3369,20 @@ int vrend_create_shader(struct vrend_context *ctx,
      } else
         finished = true;
    } else {
-      sel = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_SHADER);
+      sel = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_SHADER);
       if (!sel) {
          fprintf(stderr, "got continuation without original shader %d\n", handle);
          ret = EINVAL;
          goto error;
       }
 
+      if (binary_tokens != sel->binary_tokens) {
+         fprintf(stderr, "Got shader continuation %d with different encoding\n",
+                 handle);
+         ret = EINVAL;
+         goto error;
+      }
+
       offlen &= ~VIRGL_OBJ_SHADER_OFFSET_CONT;
       if (offlen != sel->buf_offset) {
          fprintf(stderr, "Got mismatched shader continuation %d vs %d\n",
@@ -2586,18 +3418,30 @@ int vrend_create_shader(struct vrend_context *ctx,
    if (finished) {
       struct tgsi_token *tokens;
 
-      tokens = calloc(num_tokens + 10, sizeof(struct tgsi_token));
-      if (!tokens) {
-         ret = ENOMEM;
-         goto error;
-      }
+      if (sel->binary_tokens) {
+         uint32_t size = long_shader || !new_shader ? sel->buf_len : pkt_length * 4;
 
-      if (vrend_dump_shaders)
-         fprintf(stderr,"shader\n%s\n", shd_text);
-      if (!tgsi_text_translate((const char *)shd_text, tokens, num_tokens + 10)) {
-         free(tokens);
-         ret = EINVAL;
-         goto error;
+         tokens = vrend_copy_shader_tokens(shd_text, size, num_tokens, type);
+         if (!tokens) {
+            ret = EINVAL;
+            goto error;
+         }
+         if (vrend_dump_shaders)
+            tgsi_dump(tokens, 0);
+      } else {
+         tokens = calloc(num_tokens + 10, sizeof(struct tgsi_token));
+         if (!tokens) {
+            ret = ENOMEM;
+            goto error;
+         }
+
+         if (vrend_dump_shaders)
+            fprintf(stderr,"shader\n%s\n", shd_text);
+         if (!tgsi_text_translate((const char *)shd_text, tokens, num_tokens + 10)) {
+            free(tokens);
+            ret = EINVAL;
+            goto error;
+         }
       }
 
       if (vrend_finish_shader(ctx, sel, tokens)) {
@@ -2648,7 +3492,7 @@ void vrend_bind_shader(struct vrend_context *ctx,
       return;
    }
 
-   sel = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_SHADER);
+   sel = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_SHADER);
    if (!sel)
       return;
 
@@ -2941,7 +3785,10 @@ static void vrend_draw_bind_vertex_legacy(struct vrend_context *ctx,
       if (ctx->sub->vbo[vbo_index].stride == 0) {
          void *data;
          /* for 0 stride we are kinda screwed */
-         data = glMapBufferRange(GL_ARRAY_BUFFER, ctx->sub->vbo[vbo_index].buffer_offset, ve->nr_chan * sizeof(GLfloat), GL_MAP_READ_BIT);
+         if (res->mapped)
+            data = res->mapped + ctx->sub->vbo[vbo_index].buffer_offset;
+         else
+            data = glMapBufferRange(GL_ARRAY_BUFFER, ctx->sub->vbo[vbo_index].buffer_offset, ve->nr_chan * sizeof(GLfloat), GL_MAP_READ_BIT);
 
          switch (ve->nr_chan) {
          case 1:
@@ -2958,7 +3805,8 @@ static void vrend_draw_bind_vertex_legacy(struct vrend_context *ctx,
             glVertexAttrib4fv(loc, data);
             break;
          }
-         glUnmapBuffer(GL_ARRAY_BUFFER);
+         if (!res->mapped)
+            glUnmapBuffer(GL_ARRAY_BUFFER);
          disable_bitmask |= (1 << loc);
       } else {
          enable_bitmask |= (1 << loc);
@@ -3184,32 +4032,16 @@ static void vrend_draw_bind_images(struct vrend_context *ctx)
    }
 }
 
-void vrend_draw_vbo(struct vrend_context *ctx,
-                    const struct pipe_draw_info *info,
-                    uint32_t cso, uint32_t indirect_handle,
-                    uint32_t indirect_draw_count_handle)
+/* Validate and bind all the state a draw needs, returns false if the draw
+   has to be dropped. Only the mode, indexed and primitive restart fields
+   of info are used. */
+static bool vrend_draw_prepare(struct vrend_context *ctx,
+                               const struct pipe_draw_info *info,
+                               struct vrend_resource *indirect_res)
 {
    int i;
    bool new_program = false;
    uint32_t shader_type;
-   struct vrend_resource *indirect_res = NULL;
-
-   if (ctx->in_error)
-      return;
-
-   if (indirect_handle) {
-      indirect_res = vrend_renderer_ctx_res_lookup(ctx, indirect_handle);
-      if (!indirect_res) {
-         report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_RESOURCE, indirect_handle);
-         return;
-      }
-   }
-
-   /* this must be zero until we support the feature */
-   if (indirect_draw_count_handle) {
-      report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_RESOURCE, indirect_handle);
-      return;
-   }
 
    if (ctx->ctx_switch_pending)
       vrend_finish_context_switch(ctx);
@@ -3232,7 +4064,7 @@ void vrend_draw_vbo(struct vrend_context *ctx,
       bool same_prog;
       if (!ctx->sub->shaders[PIPE_SHADER_VERTEX] || !ctx->sub->shaders[PIPE_SHADER_FRAGMENT]) {
          fprintf(stderr,"dropping rendering due to missing shaders: %s\n", ctx->debug_name);
-         return;
+         return false;
       }
 
       vrend_shader_select(ctx, ctx->sub->shaders[PIPE_SHADER_FRAGMENT], &fs_dirty);
@@ -3242,14 +4074,14 @@ void vrend_draw_vbo(struct vrend_context *ctx,
 
       if (!ctx->sub->shaders[PIPE_SHADER_VERTEX]->current || !ctx->sub->shaders[PIPE_SHADER_FRAGMENT]->current || (ctx->sub->shaders[PIPE_SHADER_GEOMETRY] && !ctx->sub->shaders[PIPE_SHADER_GEOMETRY]->current)) {
          fprintf(stderr, "failure to compile shader variants: %s\n", ctx->debug_name);
-         return;
+         return false;
       }
       same_prog = true;
       if (ctx->sub->shaders[PIPE_SHADER_VERTEX]->current->id != ctx->sub->prog_ids[PIPE_SHADER_VERTEX])
          same_prog = false;
       if (ctx->sub->shaders[PIPE_SHADER_FRAGMENT]->current->id != ctx->sub->prog_ids[PIPE_SHADER_FRAGMENT])
          same_prog = false;
-      if (ctx->sub->shaders[PIPE_SHADER_GEOMETRY] && ctx->sub->shaders[PIPE_SHADER_GEOMETRY]->current->id != ctx->sub->prog_ids[PIPE_SHADER_GEOMETRY])
+      if ((ctx->sub->shaders[PIPE_SHADER_GEOMETRY] ? ctx->sub->shaders[PIPE_SHADER_GEOMETRY]->current->id : 0) != ctx->sub->prog_ids[PIPE_SHADER_GEOMETRY])
          same_prog = false;
 
       if (!same_prog) {
@@ -3259,7 +4091,7 @@ void vrend_draw_vbo(struct vrend_context *ctx,
                                       ctx->sub->shaders[PIPE_SHADER_VERTEX]->current,
                                       ctx->sub->shaders[PIPE_SHADER_FRAGMENT]->current, ctx->sub->shaders[PIPE_SHADER_GEOMETRY] ? ctx->sub->shaders[PIPE_SHADER_GEOMETRY]->current : NULL);
             if (!prog)
-               return;
+               return false;
          }
 
          ctx->sub->last_shader_idx = ctx->sub->shaders[PIPE_SHADER_GEOMETRY] ? PIPE_SHADER_GEOMETRY : PIPE_SHADER_FRAGMENT;
@@ -3269,28 +4101,39 @@ void vrend_draw_vbo(struct vrend_context *ctx,
          new_program = true;
          ctx->sub->prog_ids[PIPE_SHADER_VERTEX] = ctx->sub->shaders[PIPE_SHADER_VERTEX]->current->id;
          ctx->sub->prog_ids[PIPE_SHADER_FRAGMENT] = ctx->sub->shaders[PIPE_SHADER_FRAGMENT]->current->id;
-         if (ctx->sub->shaders[PIPE_SHADER_GEOMETRY])
-            ctx->sub->prog_ids[PIPE_SHADER_GEOMETRY] = ctx->sub->shaders[PIPE_SHADER_GEOMETRY]->current->id;
+         ctx->sub->prog_ids[PIPE_SHADER_GEOMETRY] = ctx->sub->shaders[PIPE_SHADER_GEOMETRY] ? ctx->sub->shaders[PIPE_SHADER_GEOMETRY]->current->id : 0;
+         ctx->sub->prog_ids[PIPE_SHADER_COMPUTE] = 0;
          ctx->sub->prog = prog;
       }
+      ctx->sub->shader_dirty = false;
    }
    if (!ctx->sub->prog) {
       fprintf(stderr,"dropping rendering due to missing shaders: %s\n", ctx->debug_name);
-      return;
+      return false;
    }
    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, ctx->sub->fb_id);
 
    vrend_use_program(ctx, ctx->sub->prog->id);
 
    for (shader_type = PIPE_SHADER_VERTEX; shader_type <= ctx->sub->last_shader_idx; shader_type++) {
-      if (ctx->sub->consts[shader_type].consts &&
-          ctx->sub->prog->const_locs[shader_type] &&
-          (ctx->sub->const_dirty[shader_type] || new_program)) {
-         for (i = 0; i < ctx->sub->shaders[shader_type]->sinfo.num_consts; i++) {
-            if (ctx->sub->prog->const_locs[shader_type][i] != -1)
-               glUniform4uiv(ctx->sub->prog->const_locs[shader_type][i], 1, &ctx->sub->consts[shader_type].consts[i * 4]);
+      struct vrend_constants *consts = &ctx->sub->consts[shader_type];
+
+      if (consts->consts &&
+          ctx->sub->prog->const_location[shader_type] != -1 &&
+          (consts->dirty_start != consts->dirty_end || new_program)) {
+         uint32_t num_vec4 = MIN2(ctx->sub->prog->const_array_size[shader_type],
+                                  consts->num_consts / 4);
+         uint32_t start = 0, end = num_vec4;
+
+         /* a new program needs all of them, uniforms live in the program */
+         if (!new_program) {
+            start = consts->dirty_start;
+            end = MIN2(consts->dirty_end, num_vec4);
          }
-         ctx->sub->const_dirty[shader_type] = false;
+         if (start < end)
+            glUniform4uiv(ctx->sub->prog->const_location[shader_type] + start, end - start,
+                          &consts->consts[start * 4]);
+         consts->dirty_start = consts->dirty_end = 0;
       }
    }
 
@@ -3303,7 +4146,7 @@ void vrend_draw_vbo(struct vrend_context *ctx,
    vrend_draw_bind_images(ctx);
    if (!ctx->sub->ve) {
       fprintf(stderr,"illegal VE setup - skipping renderering\n");
-      return;
+      return false;
    }
    glUniform1f(ctx->sub->prog->vs_ws_adjust_loc, ctx->sub->viewport_is_negative ? -1.0 : 1.0);
 
@@ -3324,7 +4167,7 @@ void vrend_draw_vbo(struct vrend_context *ctx,
       int vbo_index = ve->base.vertex_buffer_index;
       if (!ctx->sub->vbo[vbo_index].buffer) {
          fprintf(stderr, "VBO missing vertex buffer\n");
-         return;
+         return false;
       }
    }
 
@@ -3362,6 +4205,67 @@ void vrend_draw_vbo(struct vrend_context *ctx,
    else
       glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 
+   return true;
+}
+
+static void vrend_draw_finish(struct vrend_context *ctx,
+                              const struct pipe_draw_info *info)
+{
+   if (info->primitive_restart) {
+      if (vrend_state.have_nv_prim_restart)
+         glDisableClientState(GL_PRIMITIVE_RESTART_NV);
+      else if (vrend_state.have_gl_prim_restart)
+         glDisable(GL_PRIMITIVE_RESTART);
+   }
+
+   if (ctx->sub->current_so && vrend_state.have_tf2) {
+      if (ctx->sub->current_so->xfb_state == XFB_STATE_STARTED) {
+         glPauseTransformFeedback();
+         ctx->sub->current_so->xfb_state = XFB_STATE_PAUSED;
+      }
+   }
+}
+
+static GLenum vrend_draw_index_type(struct vrend_context *ctx)
+{
+   switch (ctx->sub->ib.index_size) {
+   case 1:
+      return GL_UNSIGNED_BYTE;
+   case 2:
+      return GL_UNSIGNED_SHORT;
+   case 4:
+   default:
+      return GL_UNSIGNED_INT;
+   }
+}
+
+void vrend_draw_vbo(struct vrend_context *ctx,
+                    const struct pipe_draw_info *info,
+                    uint32_t cso, uint32_t indirect_handle,
+                    uint32_t indirect_draw_count_handle)
+{
+   struct vrend_resource *indirect_res = NULL;
+
+   if (ctx->in_error)
+      return;
+
+   if (indirect_handle) {
+      indirect_res = vrend_renderer_ctx_res_lookup(ctx, indirect_handle);
+      if (!indirect_res) {
+         report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_RESOURCE, indirect_handle);
+         return;
+      }
+   }
+
+   /* this must be zero until we support the feature */
+   if (indirect_draw_count_handle) {
+      report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_RESOURCE, indirect_handle);
+      return;
+   }
+
+   if (!vrend_draw_prepare(ctx, info, indirect_res))
+      return;
+
    /* set the vertex state up now on a delay */
    if (!info->indexed) {
       GLenum mode = info->mode;
@@ -3377,20 +4281,8 @@ void vrend_draw_vbo(struct vrend_context *ctx,
       else
          glDrawArraysInstancedARB(mode, start, count, info->instance_count);
    } else {
-      GLenum elsz;
+      GLenum elsz = vrend_draw_index_type(ctx);
       GLenum mode = info->mode;
-      switch (ctx->sub->ib.index_size) {
-      case 1:
-         elsz = GL_UNSIGNED_BYTE;
-         break;
-      case 2:
-         elsz = GL_UNSIGNED_SHORT;
-         break;
-      case 4:
-      default:
-         elsz = GL_UNSIGNED_INT;
-         break;
-      }
 
       if (indirect_handle)
          glDrawElementsIndirect(mode, elsz, (GLvoid const *)(unsigned long)info->indirect.offset);
@@ -3409,19 +4301,64 @@ void vrend_draw_vbo(struct vrend_context *ctx,
          glDrawElements(mode, info->count, elsz, (void *)(unsigned long)ctx->sub->ib.offset);
    }
 
-   if (info->primitive_restart) {
-      if (vrend_state.have_nv_prim_restart)
-         glDisableClientState(GL_PRIMITIVE_RESTART_NV);
-      else if (vrend_state.have_gl_prim_restart)
-         glDisable(GL_PRIMITIVE_RESTART);
+   vrend_draw_finish(ctx, info);
+}
+
+void vrend_draw_vbo_multi(struct vrend_context *ctx,
+                          const struct pipe_draw_info *infos,
+                          uint32_t num_draws)
+{
+   GLint first[VREND_MAX_DRAW_BATCH];
+   GLsizei count[VREND_MAX_DRAW_BATCH];
+   GLint base_vertex[VREND_MAX_DRAW_BATCH];
+   const GLvoid *indices[VREND_MAX_DRAW_BATCH];
+   bool need_base_vertex = false;
+   uint32_t i;
+
+   if (ctx->in_error)
+      return;
+
+   for (i = 0; i < num_draws; i++) {
+      if (infos[i].index_bias)
+         need_base_vertex = true;
    }
 
-   if (ctx->sub->current_so && vrend_state.have_tf2) {
-      if (ctx->sub->current_so->xfb_state == XFB_STATE_STARTED) {
-         glPauseTransformFeedback();
-         ctx->sub->current_so->xfb_state = XFB_STATE_PAUSED;
+   /* transform feedback is paused and resumed around each draw, so keep
+      those separate as well as anything the host can't batch */
+   if (num_draws < 2 || num_draws > VREND_MAX_DRAW_BATCH ||
+       !vrend_state.have_multi_draw || ctx->sub->current_so ||
+       (infos[0].indexed && need_base_vertex &&
+        !vrend_state.have_multi_draw_base_vertex)) {
+      for (i = 0; i < num_draws; i++)
+         vrend_draw_vbo(ctx, &infos[i], 0, 0, 0);
+      return;
+   }
+
+   if (!vrend_draw_prepare(ctx, &infos[0], NULL))
+      return;
+
+   if (!infos[0].indexed) {
+      for (i = 0; i < num_draws; i++) {
+         first[i] = infos[i].start;
+         count[i] = infos[i].count;
       }
+      glMultiDrawArrays(infos[0].mode, first, count, num_draws);
+   } else {
+      for (i = 0; i < num_draws; i++) {
+         count[i] = infos[i].count;
+         indices[i] = (GLvoid *)(unsigned long)ctx->sub->ib.offset;
+         base_vertex[i] = infos[i].index_bias;
+      }
+      if (need_base_vertex)
+         glMultiDrawElementsBaseVertex(infos[0].mode, count,
+                                       vrend_draw_index_type(ctx),
+                                       indices, num_draws, base_vertex);
+      else
+         glMultiDrawElements(infos[0].mode, count, vrend_draw_index_type(ctx),
+                             indices, num_draws);
    }
+
+   vrend_draw_finish(ctx, &infos[0]);
 }
 
 void vrend_launch_grid(struct vrend_context *ctx,
@@ -3461,8 +4398,13 @@ void vrend_launch_grid(struct vrend_context *ctx,
 
       if (ctx->sub->prog != prog) {
 	 new_program = true;
+	 ctx->sub->prog_ids[PIPE_SHADER_VERTEX] = 0;
+	 ctx->sub->prog_ids[PIPE_SHADER_FRAGMENT] = 0;
+	 ctx->sub->prog_ids[PIPE_SHADER_GEOMETRY] = 0;
 	 ctx->sub->prog_ids[PIPE_SHADER_COMPUTE] = ctx->sub->shaders[PIPE_SHADER_COMPUTE]->current->id;
 	 ctx->sub->prog = prog;
+	 /* the next draw has to bring back its own program */
+	 ctx->sub->shader_dirty = true;
       }
    }
    vrend_use_program(ctx, ctx->sub->prog->id);
@@ -3764,18 +4706,25 @@ void vrend_object_bind_blend(struct vrend_context *ctx,
 {
    struct pipe_blend_state *state;
 
+   bool dual_src = util_blend_state_is_dual(&ctx->sub->blend_state, 0);
+
    if (handle == 0) {
       memset(&ctx->sub->blend_state, 0, sizeof(ctx->sub->blend_state));
       vrend_blend_enable(ctx, false);
+      /* dual source blending selects a different program */
+      if (dual_src)
+         ctx->sub->shader_dirty = true;
       return;
    }
-   state = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_BLEND);
+   state = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_BLEND);
    if (!state) {
       report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_HANDLE, handle);
       return;
    }
 
    ctx->sub->blend_state = *state;
+   if (dual_src != util_blend_state_is_dual(&ctx->sub->blend_state, 0))
+      ctx->sub->shader_dirty = true;
 
    vrend_hw_emit_blend(ctx, &ctx->sub->blend_state);
 }
@@ -3809,15 +4758,16 @@ void vrend_object_bind_dsa(struct vrend_context *ctx,
    struct pipe_depth_stencil_alpha_state *state;
 
    if (handle == 0) {
+      if (ctx->sub->dsa_state.alpha.enabled)
+         ctx->sub->shader_dirty = true;
       memset(&ctx->sub->dsa_state, 0, sizeof(ctx->sub->dsa_state));
       ctx->sub->dsa = NULL;
       ctx->sub->stencil_state_dirty = true;
-      ctx->sub->shader_dirty = true;
       vrend_hw_emit_dsa(ctx);
       return;
    }
 
-   state = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_DSA);
+   state = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_DSA);
    if (!state) {
       report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_HANDLE, handle);
       return;
@@ -3825,7 +4775,12 @@ void vrend_object_bind_dsa(struct vrend_context *ctx,
 
    if (ctx->sub->dsa != state) {
       ctx->sub->stencil_state_dirty = true;
-      ctx->sub->shader_dirty = true;
+      /* only the alpha test goes into the shader key */
+      if (ctx->sub->dsa_state.alpha.enabled != state->alpha.enabled ||
+          (state->alpha.enabled &&
+           (ctx->sub->dsa_state.alpha.func != state->alpha.func ||
+            ctx->sub->dsa_state.alpha.ref_value != state->alpha.ref_value)))
+         ctx->sub->shader_dirty = true;
    }
    ctx->sub->dsa_state = *state;
    ctx->sub->dsa = state;
@@ -3900,240 +4855,304 @@ static inline GLenum translate_fill(uint32_t mode)
    }
 }
 
+/* counts every GL call made by the rasterizer state emission */
+#define VREND_RS_GL(ctx, call) do { call; (ctx)->rs_gl_calls++; } while (0)
+
+/* Only the GL state that differs from what the sub context last emitted is
+ * touched. The first emission in a sub context is a full one, since the GL
+ * defaults don't match a zeroed pipe_rasterizer_state.
+ */
 static void vrend_hw_emit_rs(struct vrend_context *ctx)
 {
    struct pipe_rasterizer_state *state = &ctx->sub->rs_state;
+   struct pipe_rasterizer_state *hw = &ctx->sub->hw_rs_state;
+   bool full = !ctx->sub->hw_rs_state_valid;
    int i;
 
-   if (vrend_state.use_gles) {
-      if (!state->depth_clip) {
-         report_gles_warn(ctx, GLES_WARN_DEPTH_CLIP, 0);
+#define RS_CHANGED(field) (full || state->field != hw->field)
+
+   ctx->rs_emits++;
+
+   if (RS_CHANGED(depth_clip)) {
+      if (vrend_state.use_gles) {
+         if (!state->depth_clip) {
+            report_gles_warn(ctx, GLES_WARN_DEPTH_CLIP, 0);
+         }
+      } else if (state->depth_clip) {
+         VREND_RS_GL(ctx, glDisable(GL_DEPTH_CLAMP));
+      } else {
+         VREND_RS_GL(ctx, glEnable(GL_DEPTH_CLAMP));
       }
-   } else if (state->depth_clip) {
-      glDisable(GL_DEPTH_CLAMP);
-   } else {
-      glEnable(GL_DEPTH_CLAMP);
    }
 
-   if (vrend_state.use_gles) {
-      /* guest send invalid glPointSize parameter */
-      if (!state->point_size_per_vertex &&
-          state->point_size != 1.0f &&
-          state->point_size != 0.0f) {
-         report_gles_warn(ctx, GLES_WARN_POINT_SIZE, 0);
-      }
-   } else if (state->point_size_per_vertex) {
-      glEnable(GL_PROGRAM_POINT_SIZE);
-   } else {
-      glDisable(GL_PROGRAM_POINT_SIZE);
-      if (state->point_size) {
-         glPointSize(state->point_size);
+   if (RS_CHANGED(point_size_per_vertex) || RS_CHANGED(point_size)) {
+      if (vrend_state.use_gles) {
+         /* guest send invalid glPointSize parameter */
+         if (!state->point_size_per_vertex &&
+             state->point_size != 1.0f &&
+             state->point_size != 0.0f) {
+            report_gles_warn(ctx, GLES_WARN_POINT_SIZE, 0);
+         }
+      } else if (state->point_size_per_vertex) {
+         VREND_RS_GL(ctx, glEnable(GL_PROGRAM_POINT_SIZE));
+      } else {
+         VREND_RS_GL(ctx, glDisable(GL_PROGRAM_POINT_SIZE));
+         if (state->point_size) {
+            VREND_RS_GL(ctx, glPointSize(state->point_size));
+         }
       }
    }
 
    /* line_width < 0 is invalid, the guest sometimes forgot to set it. */
-   glLineWidth(state->line_width <= 0 ? 1.0f : state->line_width);
+   if (RS_CHANGED(line_width))
+      VREND_RS_GL(ctx, glLineWidth(state->line_width <= 0 ? 1.0f : state->line_width));
 
-   if (state->rasterizer_discard != ctx->sub->hw_rs_state.rasterizer_discard) {
-      ctx->sub->hw_rs_state.rasterizer_discard = state->rasterizer_discard;
+   if (RS_CHANGED(rasterizer_discard)) {
       if (state->rasterizer_discard)
-         glEnable(GL_RASTERIZER_DISCARD);
+         VREND_RS_GL(ctx, glEnable(GL_RASTERIZER_DISCARD));
       else
-         glDisable(GL_RASTERIZER_DISCARD);
+         VREND_RS_GL(ctx, glDisable(GL_RASTERIZER_DISCARD));
    }
 
-   if (vrend_state.use_gles == true) {
-      if (translate_fill(state->fill_front) != GL_FILL) {
-         report_gles_warn(ctx, GLES_WARN_POLYGON_MODE, 0);
-      }
-      if (translate_fill(state->fill_back) != GL_FILL) {
-         report_gles_warn(ctx, GLES_WARN_POLYGON_MODE, 0);
-      }
-   } else if (vrend_state.use_core_profile == false) {
-      glPolygonMode(GL_FRONT, translate_fill(state->fill_front));
-      glPolygonMode(GL_BACK, translate_fill(state->fill_back));
-   } else if (state->fill_front == state->fill_back) {
-      glPolygonMode(GL_FRONT_AND_BACK, translate_fill(state->fill_front));
-   } else
-      report_core_warn(ctx, CORE_PROFILE_WARN_POLYGON_MODE, 0);
-
-   if (state->offset_tri) {
-      glEnable(GL_POLYGON_OFFSET_FILL);
-   } else {
-      glDisable(GL_POLYGON_OFFSET_FILL);
+   if (RS_CHANGED(fill_front) || RS_CHANGED(fill_back)) {
+      if (vrend_state.use_gles == true) {
+         if (translate_fill(state->fill_front) != GL_FILL) {
+            report_gles_warn(ctx, GLES_WARN_POLYGON_MODE, 0);
+         }
+         if (translate_fill(state->fill_back) != GL_FILL) {
+            report_gles_warn(ctx, GLES_WARN_POLYGON_MODE, 0);
+         }
+      } else if (vrend_state.use_core_profile == false) {
+         VREND_RS_GL(ctx, glPolygonMode(GL_FRONT, translate_fill(state->fill_front)));
+         VREND_RS_GL(ctx, glPolygonMode(GL_BACK, translate_fill(state->fill_back)));
+      } else if (state->fill_front == state->fill_back) {
+         VREND_RS_GL(ctx, glPolygonMode(GL_FRONT_AND_BACK, translate_fill(state->fill_front)));
+      } else
+         report_core_warn(ctx, CORE_PROFILE_WARN_POLYGON_MODE, 0);
    }
 
-   if (vrend_state.use_gles) {
-      if (state->offset_line) {
-         report_gles_warn(ctx, GLES_WARN_OFFSET_LINE, 0);
+   if (RS_CHANGED(offset_tri)) {
+      if (state->offset_tri) {
+         VREND_RS_GL(ctx, glEnable(GL_POLYGON_OFFSET_FILL));
+      } else {
+         VREND_RS_GL(ctx, glDisable(GL_POLYGON_OFFSET_FILL));
       }
-   } else if (state->offset_line) {
-      glEnable(GL_POLYGON_OFFSET_LINE);
-   } else {
-      glDisable(GL_POLYGON_OFFSET_LINE);
    }
 
-   if (vrend_state.use_gles) {
-      if (state->offset_point) {
-         report_gles_warn(ctx, GLES_WARN_OFFSET_POINT, 0);
+   if (RS_CHANGED(offset_line)) {
+      if (vrend_state.use_gles) {
+         if (state->offset_line) {
+            report_gles_warn(ctx, GLES_WARN_OFFSET_LINE, 0);
+         }
+      } else if (state->offset_line) {
+         VREND_RS_GL(ctx, glEnable(GL_POLYGON_OFFSET_LINE));
+      } else {
+         VREND_RS_GL(ctx, glDisable(GL_POLYGON_OFFSET_LINE));
       }
-   } else if (state->offset_point) {
-      glEnable(GL_POLYGON_OFFSET_POINT);
-   } else {
-      glDisable(GL_POLYGON_OFFSET_POINT);
    }
 
+   if (RS_CHANGED(offset_point)) {
+      if (vrend_state.use_gles) {
+         if (state->offset_point) {
+            report_gles_warn(ctx, GLES_WARN_OFFSET_POINT, 0);
+         }
+      } else if (state->offset_point) {
+         VREND_RS_GL(ctx, glEnable(GL_POLYGON_OFFSET_POINT));
+      } else {
+         VREND_RS_GL(ctx, glDisable(GL_POLYGON_OFFSET_POINT));
+      }
+   }
 
-   if (state->flatshade != ctx->sub->hw_rs_state.flatshade) {
-      ctx->sub->hw_rs_state.flatshade = state->flatshade;
+   if (RS_CHANGED(flatshade)) {
       if (vrend_state.use_core_profile == false) {
          if (state->flatshade) {
-            glShadeModel(GL_FLAT);
+            VREND_RS_GL(ctx, glShadeModel(GL_FLAT));
          } else {
-            glShadeModel(GL_SMOOTH);
+            VREND_RS_GL(ctx, glShadeModel(GL_SMOOTH));
          }
       }
    }
 
-   if (state->flatshade_first != ctx->sub->hw_rs_state.flatshade_first) {
-      ctx->sub->hw_rs_state.flatshade_first = state->flatshade_first;
+   if (RS_CHANGED(flatshade_first)) {
       if (vrend_state.use_gles) {
          if (state->flatshade_first) {
             report_gles_warn(ctx, GLES_WARN_FLATSHADE_FIRST, 0);
          }
       } else if (state->flatshade_first) {
-         glProvokingVertexEXT(GL_FIRST_VERTEX_CONVENTION_EXT);
+         VREND_RS_GL(ctx, glProvokingVertexEXT(GL_FIRST_VERTEX_CONVENTION_EXT));
       } else {
-         glProvokingVertexEXT(GL_LAST_VERTEX_CONVENTION_EXT);
+         VREND_RS_GL(ctx, glProvokingVertexEXT(GL_LAST_VERTEX_CONVENTION_EXT));
       }
    }
-   glPolygonOffset(state->offset_scale, state->offset_units);
+
+   if (RS_CHANGED(offset_scale) || RS_CHANGED(offset_units))
+      VREND_RS_GL(ctx, glPolygonOffset(state->offset_scale, state->offset_units));
 
    if (vrend_state.use_core_profile == false) {
-      if (state->poly_stipple_enable)
-         glEnable(GL_POLYGON_STIPPLE);
-      else
-         glDisable(GL_POLYGON_STIPPLE);
+      if (RS_CHANGED(poly_stipple_enable)) {
+         if (state->poly_stipple_enable)
+            VREND_RS_GL(ctx, glEnable(GL_POLYGON_STIPPLE));
+         else
+            VREND_RS_GL(ctx, glDisable(GL_POLYGON_STIPPLE));
+      }
    } else if (state->poly_stipple_enable) {
       if (!ctx->pstip_inited)
          vrend_init_pstipple_texture(ctx);
    }
 
-   if (state->point_quad_rasterization) {
-      if (vrend_state.use_core_profile == false &&
-          vrend_state.use_gles == false) {
-         glEnable(GL_POINT_SPRITE);
-      }
+   if (RS_CHANGED(point_quad_rasterization) || RS_CHANGED(sprite_coord_mode)) {
+      if (state->point_quad_rasterization) {
+         if (vrend_state.use_core_profile == false &&
+             vrend_state.use_gles == false) {
+            VREND_RS_GL(ctx, glEnable(GL_POINT_SPRITE));
+         }
 
-      if (vrend_state.use_gles == false) {
-         glPointParameteri(GL_POINT_SPRITE_COORD_ORIGIN, state->sprite_coord_mode ? GL_UPPER_LEFT : GL_LOWER_LEFT);
-      }
-   } else {
-      if (vrend_state.use_core_profile == false &&
-          vrend_state.use_gles == false) {
-         glDisable(GL_POINT_SPRITE);
+         if (vrend_state.use_gles == false) {
+            VREND_RS_GL(ctx, glPointParameteri(GL_POINT_SPRITE_COORD_ORIGIN, state->sprite_coord_mode ? GL_UPPER_LEFT : GL_LOWER_LEFT));
+         }
+      } else {
+         if (vrend_state.use_core_profile == false &&
+             vrend_state.use_gles == false) {
+            VREND_RS_GL(ctx, glDisable(GL_POINT_SPRITE));
+         }
       }
    }
 
-   if (state->cull_face != PIPE_FACE_NONE) {
-      switch (state->cull_face) {
-      case PIPE_FACE_FRONT:
-         glCullFace(GL_FRONT);
-         break;
-      case PIPE_FACE_BACK:
-         glCullFace(GL_BACK);
-         break;
-      case PIPE_FACE_FRONT_AND_BACK:
-         glCullFace(GL_FRONT_AND_BACK);
-         break;
-      default:
-         fprintf(stderr, "unhandled cull-face: %x\n", state->cull_face);
-      }
-      glEnable(GL_CULL_FACE);
-   } else
-      glDisable(GL_CULL_FACE);
+   if (RS_CHANGED(cull_face)) {
+      if (state->cull_face != PIPE_FACE_NONE) {
+         switch (state->cull_face) {
+         case PIPE_FACE_FRONT:
+            VREND_RS_GL(ctx, glCullFace(GL_FRONT));
+            break;
+         case PIPE_FACE_BACK:
+            VREND_RS_GL(ctx, glCullFace(GL_BACK));
+            break;
+         case PIPE_FACE_FRONT_AND_BACK:
+            VREND_RS_GL(ctx, glCullFace(GL_FRONT_AND_BACK));
+            break;
+         default:
+            fprintf(stderr, "unhandled cull-face: %x\n", state->cull_face);
+         }
+         /* only the enable changes when going between two culled faces */
+         if (full || hw->cull_face == PIPE_FACE_NONE)
+            VREND_RS_GL(ctx, glEnable(GL_CULL_FACE));
+      } else
+         VREND_RS_GL(ctx, glDisable(GL_CULL_FACE));
+   }
 
    /* two sided lighting handled in shader for core profile */
-   if (vrend_state.use_core_profile == false) {
+   if (vrend_state.use_core_profile == false && RS_CHANGED(light_twoside)) {
       if (state->light_twoside)
-         glEnable(GL_VERTEX_PROGRAM_TWO_SIDE);
+         VREND_RS_GL(ctx, glEnable(GL_VERTEX_PROGRAM_TWO_SIDE));
       else
-         glDisable(GL_VERTEX_PROGRAM_TWO_SIDE);
+         VREND_RS_GL(ctx, glDisable(GL_VERTEX_PROGRAM_TWO_SIDE));
    }
 
-   if (state->clip_plane_enable != ctx->sub->hw_rs_state.clip_plane_enable) {
-      ctx->sub->hw_rs_state.clip_plane_enable = state->clip_plane_enable;
+   if (RS_CHANGED(clip_plane_enable)) {
       for (i = 0; i < 8; i++) {
-         if (state->clip_plane_enable & (1 << i))
-            glEnable(GL_CLIP_PLANE0 + i);
+         uint32_t bit = 1 << i;
+
+         if (!full && !((state->clip_plane_enable ^ hw->clip_plane_enable) & bit))
+            continue;
+         if (state->clip_plane_enable & bit)
+            VREND_RS_GL(ctx, glEnable(GL_CLIP_PLANE0 + i));
          else
-            glDisable(GL_CLIP_PLANE0 + i);
+            VREND_RS_GL(ctx, glDisable(GL_CLIP_PLANE0 + i));
       }
    }
    if (vrend_state.use_core_profile == false) {
-      glLineStipple(state->line_stipple_factor, state->line_stipple_pattern);
-      if (state->line_stipple_enable)
-         glEnable(GL_LINE_STIPPLE);
-      else
-         glDisable(GL_LINE_STIPPLE);
-   } else if (state->line_stipple_enable) {
+      if (RS_CHANGED(line_stipple_factor) || RS_CHANGED(line_stipple_pattern))
+         VREND_RS_GL(ctx, glLineStipple(state->line_stipple_factor, state->line_stipple_pattern));
+      if (RS_CHANGED(line_stipple_enable)) {
+         if (state->line_stipple_enable)
+            VREND_RS_GL(ctx, glEnable(GL_LINE_STIPPLE));
+         else
+            VREND_RS_GL(ctx, glDisable(GL_LINE_STIPPLE));
+      }
+   } else if (state->line_stipple_enable && RS_CHANGED(line_stipple_enable)) {
       if (vrend_state.use_gles)
          report_core_warn(ctx, GLES_WARN_STIPPLE, 0);
       else
          report_core_warn(ctx, CORE_PROFILE_WARN_STIPPLE, 0);
    }
 
-
-   if (vrend_state.use_gles) {
-      if (state->line_smooth) {
-         report_gles_warn(ctx, GLES_WARN_LINE_SMOOTH, 0);
+   if (RS_CHANGED(line_smooth)) {
+      if (vrend_state.use_gles) {
+         if (state->line_smooth) {
+            report_gles_warn(ctx, GLES_WARN_LINE_SMOOTH, 0);
+         }
+      } else if (state->line_smooth) {
+         VREND_RS_GL(ctx, glEnable(GL_LINE_SMOOTH));
+      } else {
+         VREND_RS_GL(ctx, glDisable(GL_LINE_SMOOTH));
       }
-   } else if (state->line_smooth) {
-      glEnable(GL_LINE_SMOOTH);
-   } else {
-      glDisable(GL_LINE_SMOOTH);
    }
 
-   if (vrend_state.use_gles) {
-      if (state->poly_smooth) {
-         report_gles_warn(ctx, GLES_WARN_POLY_SMOOTH, 0);
+   if (RS_CHANGED(poly_smooth)) {
+      if (vrend_state.use_gles) {
+         if (state->poly_smooth) {
+            report_gles_warn(ctx, GLES_WARN_POLY_SMOOTH, 0);
+         }
+      } else if (state->poly_smooth) {
+         VREND_RS_GL(ctx, glEnable(GL_POLYGON_SMOOTH));
+      } else {
+         VREND_RS_GL(ctx, glDisable(GL_POLYGON_SMOOTH));
       }
-   } else if (state->poly_smooth) {
-      glEnable(GL_POLYGON_SMOOTH);
-   } else {
-      glDisable(GL_POLYGON_SMOOTH);
    }
 
    if (vrend_state.use_core_profile == false) {
-      if (state->clamp_vertex_color)
-         glClampColor(GL_CLAMP_VERTEX_COLOR_ARB, GL_TRUE);
-      else
-         glClampColor(GL_CLAMP_VERTEX_COLOR_ARB, GL_FALSE);
+      if (RS_CHANGED(clamp_vertex_color)) {
+         if (state->clamp_vertex_color)
+            VREND_RS_GL(ctx, glClampColor(GL_CLAMP_VERTEX_COLOR_ARB, GL_TRUE));
+         else
+            VREND_RS_GL(ctx, glClampColor(GL_CLAMP_VERTEX_COLOR_ARB, GL_FALSE));
+      }
 
-      if (state->clamp_fragment_color)
-         glClampColor(GL_CLAMP_FRAGMENT_COLOR_ARB, GL_TRUE);
-      else
-         glClampColor(GL_CLAMP_FRAGMENT_COLOR_ARB, GL_FALSE);
-   } else {
+      if (RS_CHANGED(clamp_fragment_color)) {
+         if (state->clamp_fragment_color)
+            VREND_RS_GL(ctx, glClampColor(GL_CLAMP_FRAGMENT_COLOR_ARB, GL_TRUE));
+         else
+            VREND_RS_GL(ctx, glClampColor(GL_CLAMP_FRAGMENT_COLOR_ARB, GL_FALSE));
+      }
+   } else if (RS_CHANGED(clamp_vertex_color) || RS_CHANGED(clamp_fragment_color)) {
       if (state->clamp_vertex_color || state->clamp_fragment_color)
          report_core_warn(ctx, CORE_PROFILE_WARN_CLAMP, 0);
    }
 
    if (vrend_state.have_multisample) {
-      if (state->multisample) {
-         glEnable(GL_MULTISAMPLE);
-         glEnable(GL_SAMPLE_MASK);
-      } else {
-         glDisable(GL_MULTISAMPLE);
-         glDisable(GL_SAMPLE_MASK);
+      if (RS_CHANGED(multisample)) {
+         if (state->multisample) {
+            VREND_RS_GL(ctx, glEnable(GL_MULTISAMPLE));
+            VREND_RS_GL(ctx, glEnable(GL_SAMPLE_MASK));
+         } else {
+            VREND_RS_GL(ctx, glDisable(GL_MULTISAMPLE));
+            VREND_RS_GL(ctx, glDisable(GL_SAMPLE_MASK));
+         }
       }
-      if (vrend_state.have_sample_shading) {
+      if (vrend_state.have_sample_shading && RS_CHANGED(force_persample_interp)) {
          if (state->force_persample_interp)
-            glEnable(GL_SAMPLE_SHADING);
+            VREND_RS_GL(ctx, glEnable(GL_SAMPLE_SHADING));
          else
-            glDisable(GL_SAMPLE_SHADING);
+            VREND_RS_GL(ctx, glDisable(GL_SAMPLE_SHADING));
       }
    }
+
+#undef RS_CHANGED
+
+   *hw = *state;
+   ctx->sub->hw_rs_state_valid = true;
+}
+
+/* the rasterizer state bits that vrend_fill_shader_key looks at */
+static bool vrend_rs_state_changes_shader_key(const struct pipe_rasterizer_state *old_rs,
+                                              const struct pipe_rasterizer_state *rs)
+{
+   return old_rs->poly_stipple_enable != rs->poly_stipple_enable ||
+          old_rs->light_twoside != rs->light_twoside ||
+          old_rs->clip_plane_enable != rs->clip_plane_enable ||
+          old_rs->flatshade != rs->flatshade ||
+          old_rs->point_quad_rasterization != rs->point_quad_rasterization ||
+          old_rs->sprite_coord_enable != rs->sprite_coord_enable;
 }
 
 void vrend_object_bind_rasterizer(struct vrend_context *ctx,
@@ -4143,19 +5162,21 @@ void vrend_object_bind_rasterizer(struct vrend_context *ctx,
 
    if (handle == 0) {
       memset(&ctx->sub->rs_state, 0, sizeof(ctx->sub->rs_state));
+      ctx->sub->shader_dirty = true;
       return;
    }
 
-   state = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_RASTERIZER);
+   state = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_RASTERIZER);
 
    if (!state) {
       report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_HANDLE, handle);
       return;
    }
 
+   if (vrend_rs_state_changes_shader_key(&ctx->sub->rs_state, state))
+      ctx->sub->shader_dirty = true;
    ctx->sub->rs_state = *state;
    ctx->sub->scissor_state_dirty = (1 << 0);
-   ctx->sub->shader_dirty = true;
    vrend_hw_emit_rs(ctx);
 }
 
@@ -4185,7 +5206,7 @@ void vrend_bind_sampler_states(struct vrend_context *ctx,
       if (handles[i] == 0)
          state = NULL;
       else
-         state = vrend_object_lookup(ctx->sub->object_hash, handles[i], VIRGL_OBJECT_SAMPLER_STATE);
+         state = vrend_object_lookup(ctx->sub->object_table, handles[i], VIRGL_OBJECT_SAMPLER_STATE);
 
       ctx->sub->sampler_state[shader_type][i + start_slot] = state;
    }
@@ -4452,6 +5473,108 @@ static void vrend_renderer_use_threaded_sync(void)
 }
 #endif
 
+/* only called once all shaders are destroyed, so nothing is left queued */
+static void vrend_free_compile_thread(void)
+{
+   if (!vrend_state.compile_thread)
+      return;
+
+   pipe_mutex_lock(vrend_state.compile_mutex);
+   vrend_state.stop_compile_thread = true;
+   pipe_mutex_unlock(vrend_state.compile_mutex);
+
+   pipe_condvar_signal(vrend_state.compile_cond);
+   pipe_thread_wait(vrend_state.compile_thread);
+   vrend_state.compile_thread = 0;
+
+   pipe_condvar_destroy(vrend_state.compile_done_cond);
+   pipe_condvar_destroy(vrend_state.compile_cond);
+   pipe_mutex_destroy(vrend_state.compile_mutex);
+}
+
+static int thread_compile(void *arg)
+{
+   virgl_gl_context gl_context = vrend_state.compile_context;
+   struct vrend_shader *shader;
+   GLint param;
+
+   pipe_mutex_lock(vrend_state.compile_mutex);
+   vrend_clicbs->make_current(0, gl_context);
+
+   while (!vrend_state.stop_compile_thread) {
+      if (LIST_IS_EMPTY(&vrend_state.compile_list)) {
+         if (pipe_condvar_wait(vrend_state.compile_cond, vrend_state.compile_mutex) != 0) {
+            fprintf(stderr, "error while waiting on condition\n");
+            break;
+         }
+         continue;
+      }
+
+      shader = LIST_ENTRY(struct vrend_shader, vrend_state.compile_list.next,
+                          compile_head);
+      list_delinit(&shader->compile_head);
+      shader->compile_state = VREND_COMPILE_RUNNING;
+      pipe_mutex_unlock(vrend_state.compile_mutex);
+
+      glShaderSource(shader->id, 1, (const char **)&shader->glsl_prog, NULL);
+      glCompileShader(shader->id);
+      /* query the status to wait for the compile, and finish so the
+         result is visible to the other contexts of the share group */
+      glGetShaderiv(shader->id, GL_COMPILE_STATUS, &param);
+      glFinish();
+
+      pipe_mutex_lock(vrend_state.compile_mutex);
+      shader->compile_state = VREND_COMPILE_SUBMITTED;
+      pipe_condvar_broadcast(vrend_state.compile_done_cond);
+   }
+
+   vrend_clicbs->make_current(0, 0);
+   vrend_clicbs->destroy_gl_context(vrend_state.compile_context);
+   pipe_mutex_unlock(vrend_state.compile_mutex);
+   return 0;
+}
+
+/* Shader compiles are started when the shader object is created and only
+ * waited for when a program using them is linked. This is opt-in since
+ * compile errors get reported at draw time instead of at creation time.
+ */
+static void vrend_renderer_use_async_shader_compile(void)
+{
+   struct virgl_gl_ctx_param ctx_params;
+
+   if (!vrend_state.use_async_shader_compile)
+      return;
+
+   /* the driver does the work for us */
+   if (vrend_state.have_parallel_shader_compile)
+      return;
+
+   ctx_params.shared = true;
+   ctx_params.major_ver = vrend_state.gl_major_ver;
+   ctx_params.minor_ver = vrend_state.gl_minor_ver;
+
+   vrend_state.stop_compile_thread = false;
+   list_inithead(&vrend_state.compile_list);
+
+   vrend_state.compile_context = vrend_clicbs->create_gl_context(0, &ctx_params);
+   if (vrend_state.compile_context == NULL) {
+      fprintf(stderr, "failed to create shader compile opengl context\n");
+      return;
+   }
+
+   pipe_condvar_init(vrend_state.compile_cond);
+   pipe_condvar_init(vrend_state.compile_done_cond);
+   pipe_mutex_init(vrend_state.compile_mutex);
+
+   vrend_state.compile_thread = pipe_thread_create(thread_compile, NULL);
+   if (!vrend_state.compile_thread) {
+      vrend_clicbs->destroy_gl_context(vrend_state.compile_context);
+      pipe_condvar_destroy(vrend_state.compile_done_cond);
+      pipe_condvar_destroy(vrend_state.compile_cond);
+      pipe_mutex_destroy(vrend_state.compile_mutex);
+   }
+}
+
 static void vrend_debug_cb(GLenum source, GLenum type, GLuint id,
                            GLenum severity, GLsizei length,
                            const GLchar* message, const void* userParam)
@@ -4557,6 +5680,52 @@ int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags)
    if (gl_ver >= 40 || epoxy_has_gl_extension("GL_ARB_sample_shading"))
       vrend_state.have_sample_shading = true;
 
+   if (!gles || epoxy_has_gl_extension("GL_EXT_multi_draw_arrays")) {
+      vrend_state.have_multi_draw = true;
+      if ((!gles && gl_ver >= 32) ||
+          epoxy_has_gl_extension("GL_ARB_draw_elements_base_vertex") ||
+          epoxy_has_gl_extension("GL_EXT_draw_elements_base_vertex") ||
+          epoxy_has_gl_extension("GL_OES_draw_elements_base_vertex"))
+         vrend_state.have_multi_draw_base_vertex = true;
+   }
+
+   if ((gles && gl_ver >= 30) || (!gles && gl_ver >= 41) ||
+       epoxy_has_gl_extension("GL_ARB_get_program_binary")) {
+      GLint num_formats = 0;
+      glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+      vrend_state.have_program_binary = num_formats > 0;
+   }
+
+   if (getenv("VIRGL_ASYNC_SHADERS")) {
+      vrend_state.use_async_shader_compile = true;
+      if (epoxy_has_gl_extension("GL_KHR_parallel_shader_compile") ||
+          epoxy_has_gl_extension("GL_ARB_parallel_shader_compile"))
+         vrend_state.have_parallel_shader_compile = true;
+   }
+
+   if ((flags & VREND_USE_ASYNC_READBACK) && gl_ver >= 30)
+      vrend_state.use_async_readback = true;
+
+   if ((!gles && gl_ver >= 44) ||
+       epoxy_has_gl_extension("GL_ARB_buffer_storage") ||
+       epoxy_has_gl_extension("GL_EXT_buffer_storage"))
+      vrend_state.have_buffer_storage = true;
+
+   if (gl_ver >= 30 && !getenv("VIRGL_DISABLE_UPLOAD_RING"))
+      vrend_state.use_upload_ring = true;
+
+   if (vrend_state.have_buffer_storage && !getenv("VIRGL_DISABLE_PERSISTENT_BUFFERS"))
+      vrend_state.use_persistent_buffers = true;
+
+   if (vrend_state.have_program_binary) {
+      char driver_id[512];
+      snprintf(driver_id, sizeof(driver_id), "%s|%s|%s|%s",
+               (const char *)glGetString(GL_VENDOR),
+               (const char *)glGetString(GL_RENDERER),
+               (const char *)glGetString(GL_VERSION), PACKAGE_VERSION);
+      vrend_program_cache_init(driver_id);
+   }
+
    /* callbacks for when we are cleaning up the object table */
    vrend_resource_set_destroy_callback(vrend_destroy_resource_object);
    vrend_object_set_destroy_callback(VIRGL_OBJECT_QUERY, vrend_destroy_query_object);
@@ -4588,6 +5757,12 @@ int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags)
    list_inithead(&vrend_state.fence_wait_list);
    list_inithead(&vrend_state.waiting_query_list);
    list_inithead(&vrend_state.active_ctx_list);
+   list_inithead(&vrend_state.readback_list);
+   list_inithead(&vrend_state.free_pbo_list);
+   list_inithead(&vrend_state.upload_ring.fences);
+
+   vrend_decode_enable_stats(getenv("VIRGL_DECODE_STATS") != NULL);
+
    /* create 0 context */
    vrend_renderer_context_create_internal(0, 0, NULL);
 
@@ -4595,6 +5770,7 @@ int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags)
    if (flags & VREND_USE_THREAD_SYNC) {
       vrend_renderer_use_threaded_sync();
    }
+   vrend_renderer_use_async_shader_compile();
 
    return 0;
 }
@@ -4611,10 +5787,15 @@ vrend_renderer_fini(void)
       vrend_state.eventfd = -1;
    }
 
+   vrend_readback_fini();
+   vrend_upload_ring_fini();
    vrend_decode_reset(false);
    vrend_object_fini_resource_table();
    vrend_decode_reset(true);
 
+   vrend_free_compile_thread();
+   vrend_program_cache_fini();
+
    vrend_state.current_ctx = NULL;
    vrend_state.current_hw_ctx = NULL;
    vrend_state.inited = false;
@@ -4625,8 +5806,11 @@ static void vrend_destroy_sub_context(struct vrend_sub_context *sub)
    int i, j;
    struct vrend_streamout_object *obj, *tmp;
 
-   if (sub->fb_id)
-      glDeleteFramebuffers(1, &sub->fb_id);
+   if (sub->fb_empty_id)
+      glDeleteFramebuffers(1, &sub->fb_empty_id);
+
+   while (!LIST_IS_EMPTY(&sub->fbo_cache))
+      vrend_fbo_destroy(LIST_ENTRY(struct vrend_fbo, sub->fbo_cache.next, head));
 
    if (sub->blit_fb_ids[0])
       glDeleteFramebuffers(2, sub->blit_fb_ids);
@@ -4657,6 +5841,7 @@ static void vrend_destroy_sub_context(struct vrend_sub_context *sub)
    vrend_shader_state_reference(&sub->shaders[PIPE_SHADER_COMPUTE], NULL);
 
    vrend_free_programs(sub);
+   util_hash_table_destroy(sub->program_hash);
    for (i = 0; i < PIPE_SHADER_TYPES; i++) {
       free(sub->consts[i].consts);
       sub->consts[i].consts = NULL;
@@ -4677,7 +5862,7 @@ static void vrend_destroy_sub_context(struct vrend_sub_context *sub)
 
    vrend_resource_reference((struct vrend_resource **)&sub->ib.buffer, NULL);
 
-   vrend_object_fini_ctx_table(sub->object_hash);
+   vrend_object_fini_ctx_table(sub->object_table);
    vrend_clicbs->destroy_gl_context(sub->gl_context);
 
    list_del(&sub->head);
@@ -4690,6 +5875,7 @@ bool vrend_destroy_context(struct vrend_context *ctx)
    bool switch_0 = (ctx == vrend_state.current_ctx);
    struct vrend_context *cur = vrend_state.current_ctx;
    struct vrend_sub_context *sub, *tmp;
+   int i;
    if (switch_0) {
       vrend_state.current_ctx = NULL;
       vrend_state.current_hw_ctx = NULL;
@@ -4717,7 +5903,10 @@ bool vrend_destroy_context(struct vrend_context *ctx)
    LIST_FOR_EACH_ENTRY_SAFE(sub, tmp, &ctx->sub_ctxs, head)
       vrend_destroy_sub_context(sub);
 
-   vrend_object_fini_ctx_table(ctx->res_hash);
+   vrend_resource_foreach(vrend_renderer_detach_res_cb, ctx);
+
+   for (i = 0; i < VREND_SLAB_COUNT; i++)
+      vrend_slab_destroy(ctx->slabs[i]);
 
    list_del(&ctx->ctx_entry);
 
@@ -4729,13 +5918,36 @@ bool vrend_destroy_context(struct vrend_context *ctx)
    return switch_0;
 }
 
+static const size_t vrend_slab_obj_size[VREND_SLAB_COUNT] = {
+   [VREND_SLAB_SURFACE] = sizeof(struct vrend_surface),
+   [VREND_SLAB_SAMPLER_VIEW] = sizeof(struct vrend_sampler_view),
+   [VREND_SLAB_SAMPLER_STATE] = sizeof(struct vrend_sampler_state),
+   [VREND_SLAB_QUERY] = sizeof(struct vrend_query),
+   [VREND_SLAB_SHADER_SELECTOR] = sizeof(struct vrend_shader_selector),
+   [VREND_SLAB_SHADER] = sizeof(struct vrend_shader),
+};
+
+#define VREND_SLAB_OBJS_PER_CHUNK 64
+
 struct vrend_context *vrend_create_context(int id, uint32_t nlen, const char *debug_name)
 {
    struct vrend_context *grctx = CALLOC_STRUCT(vrend_context);
+   int i;
 
    if (!grctx)
       return NULL;
 
+   for (i = 0; i < VREND_SLAB_COUNT; i++) {
+      grctx->slabs[i] = vrend_slab_create(vrend_slab_obj_size[i],
+                                          VREND_SLAB_OBJS_PER_CHUNK);
+      if (!grctx->slabs[i]) {
+         while (i--)
+            vrend_slab_destroy(grctx->slabs[i]);
+         FREE(grctx);
+         return NULL;
+      }
+   }
+
    if (nlen && debug_name) {
       strncpy(grctx->debug_name, debug_name, 64);
    }
@@ -4745,18 +5957,29 @@ struct vrend_context *vrend_create_context(int id, uint32_t nlen, const char *de
    list_inithead(&grctx->sub_ctxs);
    list_inithead(&grctx->active_nontimer_query_list);
 
-   grctx->res_hash = vrend_object_init_ctx_table();
-
    grctx->shader_cfg.use_gles = vrend_state.use_gles;
    grctx->shader_cfg.use_core_profile = vrend_state.use_core_profile;
    grctx->shader_cfg.use_explicit_locations = vrend_state.use_explicit_locations;
    vrend_renderer_create_sub_ctx(grctx, 0);
    vrend_renderer_set_sub_ctx(grctx, 0);
 
-   vrender_get_glsl_version(&grctx->shader_cfg.glsl_version);
+   vrender_get_glsl_version(&grctx->shader_cfg.glsl_version);
+
+   list_addtail(&grctx->ctx_entry, &vrend_state.active_ctx_list);
+   return grctx;
+}
+
+void vrend_renderer_fill_stats(struct vrend_context *ctx,
+                               struct vrend_renderer_stats *stats)
+{
+   int i;
+
+   STATIC_ASSERT(VREND_SLAB_COUNT <= VREND_STATS_MAX_SLABS);
+   for (i = 0; i < VREND_SLAB_COUNT; i++)
+      vrend_slab_get_stats(ctx->slabs[i], &stats->slabs[i]);
 
-   list_addtail(&grctx->ctx_entry, &vrend_state.active_ctx_list);
-   return grctx;
+   stats->rs_emits = ctx->rs_emits;
+   stats->rs_gl_calls = ctx->rs_gl_calls;
 }
 
 int vrend_renderer_resource_attach_iov(int res_handle, struct iovec *iov,
@@ -4791,6 +6014,12 @@ void vrend_renderer_resource_detach_iov(int res_handle,
    if (num_iovs_p)
       *num_iovs_p = res->num_iovs;
 
+   /* the backing is about to go away, land any reads still headed there */
+   if (!LIST_IS_EMPTY(&vrend_state.readback_list)) {
+      vrend_renderer_force_ctx_0();
+      vrend_readback_flush_resource(res);
+   }
+
    res->iov = NULL;
    res->num_iovs = 0;
 }
@@ -4877,6 +6106,45 @@ static int check_resource_valid(struct vrend_renderer_resource_create_args *args
    }
    return 0;
 }
+
+/* expects the buffer to be bound to gr->target */
+static void vrend_create_buffer_storage(struct vrend_resource *gr, uint32_t width)
+{
+   GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT |
+                      GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+   if (vrend_state.use_persistent_buffers && width) {
+      glBufferStorage(gr->target, width, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+      gr->mapped = glMapBufferRange(gr->target, 0, width, flags);
+      if (gr->mapped)
+         return;
+
+      /* immutable storage can't be respecified, start over */
+      fprintf(stderr, "failed to map buffer persistently\n");
+      glDeleteBuffers(1, &gr->id);
+      glGenBuffersARB(1, &gr->id);
+      glBindBufferARB(gr->target, gr->id);
+   }
+   glBufferData(gr->target, width, NULL, GL_STREAM_DRAW);
+}
+
+/* GPU writes only show up in a coherent mapping once the commands have
+ * completed */
+static void vrend_wait_for_gpu(void)
+{
+   GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   GLenum glret;
+
+   if (!sync) {
+      glFinish();
+      return;
+   }
+   do {
+      glret = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+   } while (glret == GL_TIMEOUT_EXPIRED);
+   glDeleteSync(sync);
+}
+
 int vrend_renderer_resource_create(struct vrend_renderer_resource_create_args *args, struct iovec *iov, uint32_t num_iovs)
 {
    struct vrend_resource *gr;
@@ -4919,27 +6187,27 @@ int vrend_renderer_resource_create(struct vrend_renderer_resource_create_args *a
       gr->target = GL_ELEMENT_ARRAY_BUFFER_ARB;
       glGenBuffersARB(1, &gr->id);
       glBindBufferARB(gr->target, gr->id);
-      glBufferData(gr->target, args->width, NULL, GL_STREAM_DRAW);
+      vrend_create_buffer_storage(gr, args->width);
    } else if (args->bind == VREND_RES_BIND_STREAM_OUTPUT) {
       gr->target = GL_TRANSFORM_FEEDBACK_BUFFER;
       glGenBuffersARB(1, &gr->id);
       glBindBuffer(gr->target, gr->id);
-      glBufferData(gr->target, args->width, NULL, GL_STREAM_DRAW);
+      vrend_create_buffer_storage(gr, args->width);
    } else if (args->bind == VREND_RES_BIND_VERTEX_BUFFER) {
       gr->target = GL_ARRAY_BUFFER_ARB;
       glGenBuffersARB(1, &gr->id);
       glBindBufferARB(gr->target, gr->id);
-      glBufferData(gr->target, args->width, NULL, GL_STREAM_DRAW);
+      vrend_create_buffer_storage(gr, args->width);
    } else if (args->bind == VREND_RES_BIND_CONSTANT_BUFFER) {
       gr->target = GL_UNIFORM_BUFFER;
       glGenBuffersARB(1, &gr->id);
       glBindBufferARB(gr->target, gr->id);
-      glBufferData(gr->target, args->width, NULL, GL_STREAM_DRAW);
+      vrend_create_buffer_storage(gr, args->width);
    } else if (args->target == PIPE_BUFFER && args->bind == 0) {
       gr->target = GL_ARRAY_BUFFER_ARB;
       glGenBuffersARB(1, &gr->id);
       glBindBufferARB(gr->target, gr->id);
-      glBufferData(gr->target, args->width, NULL, GL_STREAM_DRAW);
+      vrend_create_buffer_storage(gr, args->width);
    } else if (args->target == PIPE_BUFFER && (args->bind & VREND_RES_BIND_SAMPLER_VIEW)) {
       GLenum internalformat;
 
@@ -4957,7 +6225,7 @@ int vrend_renderer_resource_create(struct vrend_renderer_resource_create_args *a
          glGenBuffersARB(1, &gr->id);
          glBindBufferARB(gr->target, gr->id);
          glGenTextures(1, &gr->tbo_tex_id);
-         glBufferData(gr->target, args->width, NULL, GL_STREAM_DRAW);
+         vrend_create_buffer_storage(gr, args->width);
 
          glBindTexture(gr->target, gr->tbo_tex_id);
          internalformat = tex_conv_table[args->format].internalformat;
@@ -5105,17 +6373,17 @@ static void vrend_destroy_resource_object(void *obj_ptr)
 void vrend_renderer_resource_unref(uint32_t res_handle)
 {
    struct vrend_resource *res;
-   struct vrend_context *ctx;
 
    res = vrend_resource_lookup(res_handle, 0);
    if (!res)
       return;
 
-   /* find in all contexts and detach also */
+   /* detach from all contexts, the resource may outlive its handle */
+   res->ctx_mask = 0;
 
-   /* remove from any contexts */
-   LIST_FOR_EACH_ENTRY(ctx, &vrend_state.active_ctx_list, ctx_entry) {
-      vrend_renderer_detach_res_ctx_p(ctx, res->handle);
+   if (!LIST_IS_EMPTY(&vrend_state.readback_list)) {
+      vrend_renderer_force_ctx_0();
+      vrend_readback_flush_resource(res);
    }
 
    vrend_resource_remove(res->handle);
@@ -5162,29 +6430,23 @@ static void read_transfer_data(struct pipe_resource *res,
                                               box->height) * blsize * box->depth;
    uint32_t bwx = util_format_get_nblocksx(res->format, box->width) * blsize;
    uint32_t bh = util_format_get_nblocksy(res->format, box->height);
-   int d, h;
+   struct vrend_iov_cursor cur;
+   int d;
 
    if ((send_size == size || bh == 1) && !invert && box->depth == 1)
       vrend_read_from_iovec(iov, num_iovs, offset, data, send_size);
    else {
-      if (invert) {
-         for (d = 0; d < box->depth; d++) {
-            uint32_t myoffset = offset + d * src_stride * u_minify(res->height0, level);
-            for (h = bh - 1; h >= 0; h--) {
-               void *ptr = data + (h * bwx) + d * (bh * bwx);
-               vrend_read_from_iovec(iov, num_iovs, myoffset, ptr, bwx);
-               myoffset += src_stride;
-            }
-         }
-      } else {
-         for (d = 0; d < box->depth; d++) {
-            uint32_t myoffset = offset + d * src_stride * u_minify(res->height0, level);
-            for (h = 0; h < bh; h++) {
-               void *ptr = data + (h * bwx) + d * (bh * bwx);
-               vrend_read_from_iovec(iov, num_iovs, myoffset, ptr, bwx);
-               myoffset += src_stride;
-            }
-         }
+      vrend_iov_cursor_init(&cur, iov, num_iovs);
+      for (d = 0; d < box->depth; d++) {
+         uint32_t myoffset = offset + d * src_stride * u_minify(res->height0, level);
+         char *slice = data + d * (bh * bwx);
+         if (invert)
+            vrend_iov_cursor_read_strided(&cur, myoffset, src_stride,
+                                          slice + (bh - 1) * bwx, -(ptrdiff_t)bwx,
+                                          bwx, bh);
+         else
+            vrend_iov_cursor_read_strided(&cur, myoffset, src_stride,
+                                          slice, bwx, bwx, bh);
       }
    }
 }
@@ -5205,30 +6467,195 @@ static void write_transfer_data(struct pipe_resource *res,
                                                 box->height) * blsize * box->depth;
    uint32_t bwx = util_format_get_nblocksx(res->format, box->width) * blsize;
    uint32_t bh = util_format_get_nblocksy(res->format, box->height);
-   int d, h;
+   struct vrend_iov_cursor cur;
+   int d;
    uint32_t stride = dst_stride ? dst_stride : util_format_get_nblocksx(res->format, u_minify(res->width0, level)) * blsize;
 
    if ((send_size == size || bh == 1) && !invert && box->depth == 1) {
       vrend_write_to_iovec(iov, num_iovs, offset, data, send_size);
-   } else if (invert) {
-      for (d = 0; d < box->depth; d++) {
-         uint32_t myoffset = offset + d * stride * u_minify(res->height0, level);
-         for (h = bh - 1; h >= 0; h--) {
-            void *ptr = data + (h * bwx) + d * (bh * bwx);
-            vrend_write_to_iovec(iov, num_iovs, myoffset, ptr, bwx);
-            myoffset += stride;
-         }
-      }
    } else {
+      vrend_iov_cursor_init(&cur, iov, num_iovs);
       for (d = 0; d < box->depth; d++) {
          uint32_t myoffset = offset + d * stride * u_minify(res->height0, level);
-         for (h = 0; h < bh; h++) {
-            void *ptr = data + (h * bwx) + d * (bh * bwx);
-            vrend_write_to_iovec(iov, num_iovs, myoffset, ptr, bwx);
-            myoffset += stride;
-         }
+         char *slice = data + d * (bh * bwx);
+         if (invert)
+            vrend_iov_cursor_write_strided(&cur, myoffset, stride,
+                                           slice + (bh - 1) * bwx, -(ptrdiff_t)bwx,
+                                           bwx, bh);
+         else
+            vrend_iov_cursor_write_strided(&cur, myoffset, stride,
+                                           slice, bwx, bwx, bh);
+      }
+   }
+}
+
+static struct vrend_pbo *vrend_readback_get_pbo(uint32_t size)
+{
+   struct vrend_pbo *pbo = NULL, *iter;
+
+   LIST_FOR_EACH_ENTRY(iter, &vrend_state.free_pbo_list, head) {
+      if (iter->size >= size) {
+         pbo = iter;
+         break;
       }
    }
+
+   /* nothing big enough, grow the most recently used one */
+   if (!pbo && !LIST_IS_EMPTY(&vrend_state.free_pbo_list))
+      pbo = LIST_ENTRY(struct vrend_pbo, vrend_state.free_pbo_list.next, head);
+
+   if (pbo) {
+      list_del(&pbo->head);
+      vrend_state.num_free_pbos--;
+   } else {
+      pbo = CALLOC_STRUCT(vrend_pbo);
+      if (!pbo)
+         return NULL;
+      glGenBuffers(1, &pbo->id);
+   }
+
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo->id);
+   if (pbo->size < size) {
+      glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+      pbo->size = size;
+   }
+   return pbo;
+}
+
+static void vrend_readback_put_pbo(struct vrend_pbo *pbo)
+{
+   if (vrend_state.num_free_pbos >= VREND_READBACK_MAX_FREE_PBOS) {
+      glDeleteBuffers(1, &pbo->id);
+      FREE(pbo);
+      return;
+   }
+   list_add(&pbo->head, &vrend_state.free_pbo_list);
+   vrend_state.num_free_pbos++;
+}
+
+static void vrend_readback_free(struct vrend_readback *rb)
+{
+   list_del(&rb->head);
+   vrend_state.num_readbacks--;
+   if (rb->syncobj)
+      glDeleteSync(rb->syncobj);
+   vrend_readback_put_pbo(rb->pbo);
+   vrend_resource_reference(&rb->res, NULL);
+   FREE(rb);
+}
+
+/* mapping the pack buffer waits for the read if it is still in flight */
+static void vrend_readback_complete(struct vrend_readback *rb)
+{
+   void *data;
+
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo->id);
+   data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rb->size, GL_MAP_READ_BIT);
+   if (data) {
+      write_transfer_data(&rb->res->base, rb->iov, rb->num_iovs,
+                          (char *)data + rb->data_offset, rb->stride, &rb->box,
+                          rb->level, rb->offset, rb->invert);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+   } else
+      fprintf(stderr, "unable to map readback buffer\n");
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   vrend_readback_free(rb);
+}
+
+/* returns with the pack buffer bound, the caller reads to offset 0 and
+ * then calls vrend_readback_end */
+static struct vrend_readback *
+vrend_readback_begin(struct vrend_resource *res, struct iovec *iov, int num_iovs,
+                     const struct vrend_transfer_info *info, uint32_t size)
+{
+   struct vrend_readback *rb;
+
+   rb = CALLOC_STRUCT(vrend_readback);
+   if (!rb)
+      return NULL;
+
+   rb->pbo = vrend_readback_get_pbo(size);
+   if (!rb->pbo) {
+      FREE(rb);
+      return NULL;
+   }
+
+   vrend_resource_reference(&rb->res, res);
+   rb->iov = iov;
+   rb->num_iovs = num_iovs;
+   rb->box = *info->box;
+   rb->level = info->level;
+   rb->stride = info->stride;
+   rb->offset = info->offset;
+   rb->size = size;
+   return rb;
+}
+
+static void vrend_readback_end(struct vrend_readback *rb,
+                               uint32_t data_offset, bool invert)
+{
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   rb->data_offset = data_offset;
+   rb->invert = invert;
+   rb->syncobj = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   /* so polling the sync object makes progress */
+   glFlush();
+
+   rb->seq = ++vrend_state.readback_seq;
+   list_addtail(&rb->head, &vrend_state.readback_list);
+   vrend_state.num_readbacks++;
+
+   /* bound the memory held by guests that read but never fence */
+   if (vrend_state.num_readbacks > VREND_READBACK_MAX_PENDING)
+      vrend_readback_complete(LIST_ENTRY(struct vrend_readback,
+                                         vrend_state.readback_list.next, head));
+}
+
+/* copy out every readback issued up to seq, then any later ones the GPU
+ * has already finished */
+static void vrend_readback_process(uint64_t seq)
+{
+   struct vrend_readback *rb, *stor;
+
+   LIST_FOR_EACH_ENTRY_SAFE(rb, stor, &vrend_state.readback_list, head) {
+      if (rb->seq > seq && rb->syncobj &&
+          glClientWaitSync(rb->syncobj, 0, 0) == GL_TIMEOUT_EXPIRED)
+         break;
+      vrend_readback_complete(rb);
+   }
+}
+
+static void vrend_readback_flush_resource(struct vrend_resource *res)
+{
+   struct vrend_readback *rb, *stor;
+
+   LIST_FOR_EACH_ENTRY_SAFE(rb, stor, &vrend_state.readback_list, head) {
+      if (rb->res == res)
+         vrend_readback_complete(rb);
+   }
+}
+
+static void vrend_readback_fini(void)
+{
+   struct vrend_pbo *pbo, *stor;
+
+   if (LIST_IS_EMPTY(&vrend_state.readback_list) &&
+       LIST_IS_EMPTY(&vrend_state.free_pbo_list))
+      return;
+
+   vrend_renderer_force_ctx_0();
+   while (!LIST_IS_EMPTY(&vrend_state.readback_list))
+      vrend_readback_free(LIST_ENTRY(struct vrend_readback,
+                                     vrend_state.readback_list.next, head));
+
+   LIST_FOR_EACH_ENTRY_SAFE(pbo, stor, &vrend_state.free_pbo_list, head) {
+      list_del(&pbo->head);
+      glDeleteBuffers(1, &pbo->id);
+      FREE(pbo);
+   }
+   vrend_state.num_free_pbos = 0;
 }
 
 static bool check_transfer_bounds(struct vrend_resource *res,
@@ -5280,7 +6707,8 @@ static bool check_transfer_bounds(struct vrend_resource *res,
 
 static bool check_iov_bounds(struct vrend_resource *res,
                              const struct vrend_transfer_info *info,
-                             struct iovec *iov, int num_iovs)
+                             struct iovec *iov, int num_iovs,
+                             GLuint *send_size_p)
 {
    GLuint send_size;
    GLuint iovsize = vrend_get_iovec_size(iov, num_iovs);
@@ -5325,9 +6753,279 @@ static bool check_iov_bounds(struct vrend_resource *res,
    if (iovsize < info->offset + send_size)
       return false;
 
+   *send_size_p = send_size;
+   return true;
+}
+
+static bool vrend_upload_ring_init(void)
+{
+   struct vrend_upload_ring *ring = &vrend_state.upload_ring;
+   GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+   glGenBuffers(1, &ring->id);
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->id);
+   if (vrend_state.have_buffer_storage) {
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, VREND_UPLOAD_RING_SIZE, NULL, flags);
+      ring->map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, VREND_UPLOAD_RING_SIZE, flags);
+   } else
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, VREND_UPLOAD_RING_SIZE, NULL, GL_STREAM_DRAW);
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+   if (vrend_state.have_buffer_storage && !ring->map) {
+      fprintf(stderr, "failed to map upload ring, uploading directly\n");
+      glDeleteBuffers(1, &ring->id);
+      ring->id = 0;
+      vrend_state.use_upload_ring = false;
+      return false;
+   }
+   ring->head = 0;
    return true;
 }
 
+static void vrend_upload_ring_fini(void)
+{
+   struct vrend_upload_ring *ring = &vrend_state.upload_ring;
+   struct vrend_upload_fence *fence, *stor;
+
+   if (!ring->id)
+      return;
+
+   vrend_renderer_force_ctx_0();
+   LIST_FOR_EACH_ENTRY_SAFE(fence, stor, &ring->fences, head) {
+      list_del(&fence->head);
+      glDeleteSync(fence->syncobj);
+      FREE(fence);
+   }
+
+   if (ring->map) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->id);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      ring->map = NULL;
+   }
+   glDeleteBuffers(1, &ring->id);
+   ring->id = 0;
+}
+
+/* drop the regions the GPU is done with, or wait for the oldest one */
+static void vrend_upload_ring_retire(bool wait)
+{
+   struct vrend_upload_ring *ring = &vrend_state.upload_ring;
+   struct vrend_upload_fence *fence, *stor;
+   GLenum glret;
+
+   LIST_FOR_EACH_ENTRY_SAFE(fence, stor, &ring->fences, head) {
+      if (wait) {
+         do {
+            glret = glClientWaitSync(fence->syncobj, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     1000000000);
+         } while (glret == GL_TIMEOUT_EXPIRED);
+         wait = false;
+      } else if (glClientWaitSync(fence->syncobj, 0, 0) == GL_TIMEOUT_EXPIRED)
+         break;
+
+      list_del(&fence->head);
+      glDeleteSync(fence->syncobj);
+      FREE(fence);
+   }
+}
+
+/* returns a write pointer to size bytes of the ring with the ring bound as
+ * the unpack buffer and the offset of the region in offset_p, or NULL if
+ * the upload should go the direct route */
+static void *vrend_upload_ring_map(uint32_t size, uint32_t *offset_p)
+{
+   struct vrend_upload_ring *ring = &vrend_state.upload_ring;
+   uint32_t offset, tail;
+   void *ptr;
+
+   size = align(size, VREND_UPLOAD_RING_ALIGN);
+   if (size > VREND_UPLOAD_RING_SIZE / 2)
+      return NULL;
+
+   if (!ring->id && !vrend_upload_ring_init())
+      return NULL;
+
+   vrend_upload_ring_retire(false);
+   for (;;) {
+      if (LIST_IS_EMPTY(&ring->fences)) {
+         offset = 0;
+         break;
+      }
+
+      /* head never catches up with tail while regions are in flight */
+      tail = LIST_ENTRY(struct vrend_upload_fence, ring->fences.next, head)->start;
+      if (ring->head > tail) {
+         if (ring->head + size <= VREND_UPLOAD_RING_SIZE) {
+            offset = ring->head;
+            break;
+         }
+         if (size < tail) {
+            offset = 0;
+            break;
+         }
+      } else if (ring->head + size < tail) {
+         offset = ring->head;
+         break;
+      }
+      vrend_upload_ring_retire(true);
+   }
+
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->id);
+   if (ring->map)
+      ptr = ring->map + offset;
+   else {
+      /* the fences already keep us off regions that are in use */
+      ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size,
+                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                             GL_MAP_UNSYNCHRONIZED_BIT);
+      if (!ptr) {
+         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+         return NULL;
+      }
+   }
+
+   ring->pending_start = offset;
+   ring->head = offset + size;
+   *offset_p = offset;
+   return ptr;
+}
+
+static void vrend_upload_ring_unmap(void)
+{
+   if (!vrend_state.upload_ring.map)
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+}
+
+/* called once the GL upload from the mapped region has been issued */
+static void vrend_upload_ring_fence(void)
+{
+   struct vrend_upload_ring *ring = &vrend_state.upload_ring;
+   struct vrend_upload_fence *fence;
+
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+   fence = CALLOC_STRUCT(vrend_upload_fence);
+   if (fence)
+      fence->syncobj = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   if (!fence || !fence->syncobj) {
+      /* can't track the region, make sure it is consumed */
+      FREE(fence);
+      glFinish();
+      return;
+   }
+   fence->start = ring->pending_start;
+   list_addtail(&fence->head, &ring->fences);
+}
+
+static bool vrend_can_scatter_upload(struct vrend_resource *res,
+                                     uint32_t stride, int elsize)
+{
+   /* these need a CPU pass over the data or go through glDrawPixels */
+   if (res->y_0_top ||
+       res->base.format == (enum pipe_format)VIRGL_FORMAT_Z24X8_UNORM)
+      return false;
+
+   switch (res->target) {
+   case GL_TEXTURE_2D:
+   case GL_TEXTURE_RECTANGLE_NV:
+   case GL_TEXTURE_CUBE_MAP:
+   case GL_TEXTURE_3D:
+   case GL_TEXTURE_2D_ARRAY:
+   case GL_TEXTURE_CUBE_MAP_ARRAY:
+      break;
+   default:
+      return false;
+   }
+   return (stride % elsize) == 0;
+}
+
+static void vrend_tex_sub_image_rows(struct vrend_resource *res,
+                                     const struct vrend_transfer_info *info,
+                                     int row, int layer, int num_rows,
+                                     GLenum glformat, GLenum gltype,
+                                     const void *data)
+{
+   const struct pipe_box *box = info->box;
+
+   switch (res->target) {
+   case GL_TEXTURE_CUBE_MAP:
+      glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + box->z + layer,
+                      info->level, box->x, box->y + row, box->width, num_rows,
+                      glformat, gltype, data);
+      break;
+   case GL_TEXTURE_3D:
+   case GL_TEXTURE_2D_ARRAY:
+   case GL_TEXTURE_CUBE_MAP_ARRAY:
+      glTexSubImage3D(res->target, info->level, box->x, box->y + row,
+                      box->z + layer, box->width, num_rows, 1,
+                      glformat, gltype, data);
+      break;
+   default:
+      glTexSubImage2D(res->target, info->level, box->x, box->y + row,
+                      box->width, num_rows, glformat, gltype, data);
+      break;
+   }
+}
+
+/* upload straight from the guest pages, one call per run of rows that sit
+ * inside a single iov, only rows straddling two iovs are gathered */
+static void vrend_scatter_tex_upload(struct vrend_resource *res,
+                                     struct iovec *iov, int num_iovs,
+                                     const struct vrend_transfer_info *info,
+                                     uint32_t stride,
+                                     GLenum glformat, GLenum gltype)
+{
+   int elsize = util_format_get_blocksize(res->base.format);
+   uint32_t row_size = info->box->width * elsize;
+   uint64_t layer_size = (uint64_t)stride * u_minify(res->base.height0, info->level);
+   int depth = 1;
+   char *row_tmp = NULL;
+   struct vrend_iov_cursor cur;
+   int d, h, n;
+
+   if (res->target == GL_TEXTURE_3D ||
+       res->target == GL_TEXTURE_2D_ARRAY ||
+       res->target == GL_TEXTURE_CUBE_MAP_ARRAY ||
+       res->target == GL_TEXTURE_CUBE_MAP)
+      depth = info->box->depth;
+
+   glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / elsize);
+
+   vrend_iov_cursor_init(&cur, iov, num_iovs);
+   for (d = 0; d < depth; d++) {
+      for (h = 0; h < info->box->height; h += n) {
+         uint64_t offset = info->offset + d * layer_size + (uint64_t)h * stride;
+         void *ptr;
+         size_t avail = vrend_iov_cursor_span(&cur, offset, &ptr);
+
+         if (!avail)
+            goto out;
+
+         if (avail >= row_size) {
+            n = 1 + (avail - row_size) / stride;
+            n = MIN2(n, info->box->height - h);
+         } else {
+            if (!row_tmp) {
+               row_tmp = malloc(row_size);
+               if (!row_tmp) {
+                  fprintf(stderr, "malloc failed %d\n", row_size);
+                  goto out;
+               }
+            }
+            n = 1;
+            vrend_iov_cursor_read(&cur, offset, row_tmp, row_size);
+            ptr = row_tmp;
+         }
+         vrend_tex_sub_image_rows(res, info, h, d, n, glformat, gltype, ptr);
+      }
+   }
+
+out:
+   glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+   free(row_tmp);
+}
+
 static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
                                              struct vrend_resource *res,
                                              struct iovec *iov, int num_iovs,
@@ -5348,6 +7046,12 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
       d.box = info->box;
       d.target = res->target;
 
+      if (res->mapped) {
+         vrend_read_from_iovec(iov, num_iovs, info->offset,
+                               res->mapped + info->box->x, info->box->width);
+         return 0;
+      }
+
       glBindBufferARB(res->target, res->id);
       if (use_sub_data == 1) {
          vrend_read_from_iovec_cb(iov, num_iovs, info->offset, info->box->width, &iov_buffer_upload, &d);
@@ -5372,6 +7076,9 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
       float depth_scale;
       GLuint send_size = 0;
       uint32_t stride = info->stride;
+      void *ring_ptr = NULL;
+      uint32_t ring_offset;
+      bool scatter = false;
 
       vrend_use_program(ctx, 0);
 
@@ -5389,7 +7096,28 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
             invert = true;
       }
 
-      if (need_temp) {
+      /* stage through the unpack ring so the driver can upload without
+       * stalling us, core profile Z24 needs a CPU pass over the data so
+       * it keeps the temporary */
+      if (vrend_state.use_upload_ring &&
+          !(vrend_state.use_core_profile &&
+            res->base.format == (enum pipe_format)VIRGL_FORMAT_Z24X8_UNORM)) {
+         send_size = util_format_get_nblocks(res->base.format, info->box->width,
+                                             info->box->height) * elsize * info->box->depth;
+         ring_ptr = vrend_upload_ring_map(send_size, &ring_offset);
+      }
+
+      if (ring_ptr) {
+         need_temp = true;
+         read_transfer_data(&res->base, iov, num_iovs, ring_ptr, stride,
+                            info->box, info->level, info->offset, invert);
+         vrend_upload_ring_unmap();
+         data = (char *)(uintptr_t)ring_offset;
+      } else if (need_temp && num_iovs > 1 && !compressed &&
+                 vrend_can_scatter_upload(res, stride, elsize)) {
+         scatter = true;
+         data = NULL;
+      } else if (need_temp) {
          send_size = util_format_get_nblocks(res->base.format, info->box->width,
                                              info->box->height) * elsize * info->box->depth;
          data = malloc(send_size);
@@ -5484,7 +7212,10 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
             else
                vrend_scale_depth(data, send_size, depth_scale);
          }
-         if (res->target == GL_TEXTURE_CUBE_MAP) {
+         if (scatter) {
+            vrend_scatter_tex_upload(res, iov, num_iovs, info, stride,
+                                     glformat, gltype);
+         } else if (res->target == GL_TEXTURE_CUBE_MAP) {
             GLenum ctarget = GL_TEXTURE_CUBE_MAP_POSITIVE_X + info->box->z;
             if (compressed) {
                glCompressedTexSubImage2D(ctarget, info->level, x, y,
@@ -5541,7 +7272,9 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
 
       glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-      if (need_temp)
+      if (ring_ptr)
+         vrend_upload_ring_fence();
+      else if (need_temp && !scatter)
          free(data);
    }
    return 0;
@@ -5562,11 +7295,13 @@ static uint32_t vrend_get_texture_depth(struct vrend_resource *res, uint32_t lev
 static int vrend_transfer_send_getteximage(struct vrend_context *ctx,
                                            struct vrend_resource *res,
                                            struct iovec *iov, int num_iovs,
-                                           const struct vrend_transfer_info *info)
+                                           const struct vrend_transfer_info *info,
+                                           bool async)
 {
    GLenum format, type;
    uint32_t tex_size;
-   char *data;
+   char *data = NULL;
+   struct vrend_readback *rb = NULL;
    int elsize = util_format_get_blocksize(res->base.format);
    int compressed = util_format_is_compressed(res->base.format);
    GLenum target;
@@ -5584,9 +7319,15 @@ static int vrend_transfer_send_getteximage(struct vrend_context *ctx,
       send_offset = util_format_get_nblocks(res->base.format, u_minify(res->base.width0, info->level), u_minify(res->base.height0, info->level)) * util_format_get_blocksize(res->base.format) * info->box->z;
    }
 
-   data = malloc(tex_size);
-   if (!data)
-      return ENOMEM;
+   if (async && !vrend_state.use_gles)
+      rb = vrend_readback_begin(res, iov, num_iovs, info, tex_size);
+
+   if (!rb) {
+      vrend_readback_flush_resource(res);
+      data = malloc(tex_size);
+      if (!data)
+         return ENOMEM;
+   }
 
    switch (elsize) {
    case 1:
@@ -5630,6 +7371,11 @@ static int vrend_transfer_send_getteximage(struct vrend_context *ctx,
 
    glPixelStorei(GL_PACK_ALIGNMENT, 4);
 
+   if (rb) {
+      vrend_readback_end(rb, send_offset, false);
+      return 0;
+   }
+
    write_transfer_data(&res->base, iov, num_iovs, data + send_offset,
                        info->stride, info->box, info->level, info->offset,
                        false);
@@ -5640,7 +7386,8 @@ static int vrend_transfer_send_getteximage(struct vrend_context *ctx,
 static int vrend_transfer_send_readpixels(struct vrend_context *ctx,
                                           struct vrend_resource *res,
                                           struct iovec *iov, int num_iovs,
-                                          const struct vrend_transfer_info *info)
+                                          const struct vrend_transfer_info *info,
+                                          bool async)
 {
    char *myptr = (char*)iov[0].iov_base + info->offset;
    int need_temp = 0;
@@ -5653,6 +7400,7 @@ static int vrend_transfer_send_readpixels(struct vrend_context *ctx,
    uint32_t h = u_minify(res->base.height0, info->level);
    int elsize = util_format_get_blocksize(res->base.format);
    float depth_scale;
+   struct vrend_readback *rb = NULL;
 
    vrend_use_program(ctx, 0);
 
@@ -5665,10 +7413,23 @@ static int vrend_transfer_send_readpixels(struct vrend_context *ctx,
    if (actually_invert && !vrend_state.have_mesa_invert)
       separate_invert = true;
 
-   if (num_iovs > 1 || separate_invert)
+   /* the core profile rescales Z24 depth on the CPU right after the read */
+   if (async && !(res->base.format == (enum pipe_format)VIRGL_FORMAT_Z24X8_UNORM &&
+                  vrend_state.use_core_profile)) {
+      send_size = util_format_get_nblocks(res->base.format, info->box->width, info->box->height) * info->box->depth * util_format_get_blocksize(res->base.format);
+      rb = vrend_readback_begin(res, iov, num_iovs, info, send_size);
+   }
+
+   if (!rb)
+      vrend_readback_flush_resource(res);
+
+   if (rb || num_iovs > 1 || separate_invert)
       need_temp = 1;
 
-   if (need_temp) {
+   if (rb) {
+      /* read tightly packed to the start of the bound pack buffer */
+      data = NULL;
+   } else if (need_temp) {
       send_size = util_format_get_nblocks(res->base.format, info->box->width, info->box->height) * info->box->depth * util_format_get_blocksize(res->base.format);
       data = malloc(send_size);
       if (!data) {
@@ -5750,7 +7511,9 @@ static int vrend_transfer_send_readpixels(struct vrend_context *ctx,
    if (!need_temp && info->stride)
       glPixelStorei(GL_PACK_ROW_LENGTH, 0);
    glPixelStorei(GL_PACK_ALIGNMENT, 4);
-   if (need_temp) {
+   if (rb) {
+      vrend_readback_end(rb, 0, separate_invert);
+   } else if (need_temp) {
       write_transfer_data(&res->base, iov, num_iovs, data,
                           info->stride, info->box, info->level, info->offset,
                           separate_invert);
@@ -5762,7 +7525,8 @@ static int vrend_transfer_send_readpixels(struct vrend_context *ctx,
 static int vrend_renderer_transfer_send_iov(struct vrend_context *ctx,
                                             struct vrend_resource *res,
                                             struct iovec *iov, int num_iovs,
-                                            const struct vrend_transfer_info *info)
+                                            const struct vrend_transfer_info *info,
+                                            bool async)
 {
    if (res->target == 0 && res->ptr) {
       uint32_t send_size = info->box->width * util_format_get_blocksize(res->base.format);
@@ -5778,6 +7542,13 @@ static int vrend_renderer_transfer_send_iov(struct vrend_context *ctx,
       uint32_t send_size = info->box->width * util_format_get_blocksize(res->base.format);
       void *data;
 
+      if (res->mapped) {
+         vrend_wait_for_gpu();
+         vrend_write_to_iovec(iov, num_iovs, info->offset,
+                              res->mapped + info->box->x, send_size);
+         return 0;
+      }
+
       glBindBufferARB(res->target, res->id);
       data = glMapBufferRange(res->target, info->box->x, info->box->width, GL_MAP_READ_BIT);
       if (!data)
@@ -5792,11 +7563,11 @@ static int vrend_renderer_transfer_send_iov(struct vrend_context *ctx,
 
       if (can_readpixels) {
          return vrend_transfer_send_readpixels(ctx, res,
-                                               iov, num_iovs, info);
+                                               iov, num_iovs, info, async);
       }
 
       return vrend_transfer_send_getteximage(ctx, res,
-                                             iov, num_iovs, info);
+                                             iov, num_iovs, info, async);
 
    }
    return 0;
@@ -5809,6 +7580,7 @@ int vrend_renderer_transfer_iov(const struct vrend_transfer_info *info,
    struct vrend_context *ctx;
    struct iovec *iov;
    int num_iovs;
+   GLuint send_size;
 
    if (!info->box)
       return EINVAL;
@@ -5845,17 +7617,28 @@ int vrend_renderer_transfer_iov(const struct vrend_transfer_info *info,
    if (!check_transfer_bounds(res, info))
       return EINVAL;
 
-   if (!check_iov_bounds(res, info, iov, num_iovs))
+   if (!check_iov_bounds(res, info, iov, num_iovs, &send_size))
       return EINVAL;
 
+   if (vrend_trace_enabled())
+      vrend_trace_transfer(transfer_mode == VREND_TRANSFER_WRITE ?
+                           VREND_TRACE_TRANSFER_WRITE : VREND_TRACE_TRANSFER_READ,
+                           info, iov, num_iovs, send_size);
+
    vrend_hw_switch_context(vrend_lookup_renderer_ctx(0), true);
 
-   if (transfer_mode == VREND_TRANSFER_WRITE)
+   if (transfer_mode == VREND_TRANSFER_WRITE) {
+      /* a read still in flight must not land on top of what we upload */
+      vrend_readback_flush_resource(res);
       return vrend_renderer_transfer_write_iov(ctx, res, iov, num_iovs,
                                                info);
-   else
+   } else {
+      /* only the attached backing is guaranteed to stay around until the
+       * next fence, an explicit iovec belongs to the caller */
+      bool async = vrend_state.use_async_readback && iov == res->iov;
       return vrend_renderer_transfer_send_iov(ctx, res, iov, num_iovs,
-                                              info);
+                                              info, async);
+   }
 }
 
 int vrend_transfer_inline_write(struct vrend_context *ctx,
@@ -5863,6 +7646,7 @@ int vrend_transfer_inline_write(struct vrend_context *ctx,
                                 unsigned usage)
 {
    struct vrend_resource *res;
+   GLuint send_size;
 
    res = vrend_renderer_ctx_res_lookup(ctx, info->handle);
    if (!res) {
@@ -5875,7 +7659,7 @@ int vrend_transfer_inline_write(struct vrend_context *ctx,
       return EINVAL;
    }
 
-   if (!check_iov_bounds(res, info, info->iovec, info->iovec_cnt)) {
+   if (!check_iov_bounds(res, info, info->iovec, info->iovec_cnt, &send_size)) {
       report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_CMD_BUFFER, info->handle);
       return EINVAL;
    }
@@ -5884,6 +7668,25 @@ int vrend_transfer_inline_write(struct vrend_context *ctx,
 
 }
 
+bool vrend_state_is_redundant(struct vrend_context *ctx,
+                              enum vrend_state_shadow_type type,
+                              const uint32_t *data, uint32_t length)
+{
+   uint32_t *shadow_length = &ctx->sub->state_shadow[type].length;
+   uint32_t *shadow = ctx->sub->state_shadow[type].data;
+
+   if (length > VREND_STATE_SHADOW_MAX_DWORDS)
+      return false;
+
+   if (*shadow_length == length &&
+       !memcmp(shadow, data, length * sizeof(uint32_t)))
+      return true;
+
+   *shadow_length = length;
+   memcpy(shadow, data, length * sizeof(uint32_t));
+   return false;
+}
+
 void vrend_set_stencil_ref(struct vrend_context *ctx,
                            struct pipe_stencil_ref *ref)
 {
@@ -6022,7 +7825,7 @@ void vrend_set_streamout_targets(struct vrend_context *ctx,
       obj->num_targets = num_targets;
       for (i = 0; i < num_targets; i++) {
          obj->handles[i] = handles[i];
-         target = vrend_object_lookup(ctx->sub->object_hash, handles[i], VIRGL_OBJECT_STREAMOUT_TARGET);
+         target = vrend_object_lookup(ctx->sub->object_table, handles[i], VIRGL_OBJECT_STREAMOUT_TARGET);
          if (!target) {
             report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_HANDLE, handles[i]);
             free(obj);
@@ -6440,6 +8243,7 @@ int vrend_renderer_create_fence(int client_fence_id, uint32_t ctx_id)
 
    fence->ctx_id = ctx_id;
    fence->fence_id = client_fence_id;
+   fence->readback_seq = vrend_state.readback_seq;
    fence->syncobj = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
    if (fence->syncobj == NULL)
@@ -6480,6 +8284,7 @@ void vrend_renderer_check_fences(void)
 {
    struct vrend_fence *fence, *stor;
    uint32_t latest_id = 0;
+   uint64_t readback_seq = 0;
    GLenum glret;
 
    if (!vrend_state.inited)
@@ -6491,9 +8296,14 @@ void vrend_renderer_check_fences(void)
       LIST_FOR_EACH_ENTRY_SAFE(fence, stor, &vrend_state.fence_list, fences) {
          if (fence->fence_id > latest_id)
             latest_id = fence->fence_id;
+         if (fence->readback_seq > readback_seq)
+            readback_seq = fence->readback_seq;
          free_fence_locked(fence);
       }
       pipe_mutex_unlock(vrend_state.fence_mutex);
+
+      if (!LIST_IS_EMPTY(&vrend_state.readback_list))
+         vrend_renderer_force_ctx_0();
    } else {
       vrend_renderer_force_ctx_0();
 
@@ -6501,6 +8311,7 @@ void vrend_renderer_check_fences(void)
          glret = glClientWaitSync(fence->syncobj, 0, 0);
          if (glret == GL_ALREADY_SIGNALED){
             latest_id = fence->fence_id;
+            readback_seq = fence->readback_seq;
             free_fence_locked(fence);
          }
          /* don't bother checking any subsequent ones */
@@ -6510,6 +8321,9 @@ void vrend_renderer_check_fences(void)
       }
    }
 
+   /* the guest may look at the data as soon as it sees the fence */
+   vrend_readback_process(readback_seq);
+
    if (latest_id == 0)
       return;
    vrend_clicbs->write_fence(latest_id);
@@ -6600,15 +8414,17 @@ static void vrend_finish_context_switch(struct vrend_context *ctx)
 void
 vrend_renderer_object_destroy(struct vrend_context *ctx, uint32_t handle)
 {
-   vrend_object_remove(ctx->sub->object_hash, handle, 0);
+   vrend_object_remove(ctx->sub->object_table, handle, 0);
 }
 
 uint32_t vrend_renderer_object_insert(struct vrend_context *ctx, void *data,
                                       uint32_t size, uint32_t handle, enum virgl_object_type type)
 {
-   return vrend_object_insert(ctx->sub->object_hash, data, size, handle, type);
+   return vrend_object_insert(ctx->sub->object_table, data, size, handle, type);
 }
 
+static void vrend_destroy_query(struct vrend_query *query);
+
 int vrend_create_query(struct vrend_context *ctx, uint32_t handle,
                        uint32_t query_type, uint32_t query_index,
                        uint32_t res_handle, uint32_t offset)
@@ -6622,7 +8438,7 @@ int vrend_create_query(struct vrend_context *ctx, uint32_t handle,
       return EINVAL;
    }
 
-   q = CALLOC_STRUCT(vrend_query);
+   q = vrend_slab_alloc(ctx->slabs[VREND_SLAB_QUERY]);
    if (!q)
       return ENOMEM;
 
@@ -6661,7 +8477,7 @@ int vrend_create_query(struct vrend_context *ctx, uint32_t handle,
    ret_handle = vrend_renderer_object_insert(ctx, q, sizeof(struct vrend_query), handle,
                                              VIRGL_OBJECT_QUERY);
    if (!ret_handle) {
-      FREE(q);
+      vrend_destroy_query(q);
       return ENOMEM;
    }
    return 0;
@@ -6672,7 +8488,7 @@ static void vrend_destroy_query(struct vrend_query *query)
    vrend_resource_reference(&query->res, NULL);
    list_del(&query->waiting_queries);
    glDeleteQueries(1, &query->id);
-   free(query);
+   vrend_slab_free(query);
 }
 
 static void vrend_destroy_query_object(void *obj_ptr)
@@ -6685,7 +8501,7 @@ void vrend_begin_query(struct vrend_context *ctx, uint32_t handle)
 {
    struct vrend_query *q;
 
-   q = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_QUERY);
+   q = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_QUERY);
    if (!q)
       return;
 
@@ -6701,7 +8517,7 @@ void vrend_begin_query(struct vrend_context *ctx, uint32_t handle)
 void vrend_end_query(struct vrend_context *ctx, uint32_t handle)
 {
    struct vrend_query *q;
-   q = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_QUERY);
+   q = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_QUERY);
    if (!q)
       return;
 
@@ -6729,7 +8545,7 @@ void vrend_get_query_result(struct vrend_context *ctx, uint32_t handle,
    struct vrend_query *q;
    bool ret;
 
-   q = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_QUERY);
+   q = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_QUERY);
    if (!q)
       return;
 
@@ -6765,7 +8581,7 @@ void vrend_render_condition(struct vrend_context *ctx,
       return;
    }
 
-   q = vrend_object_lookup(ctx->sub->object_hash, handle, VIRGL_OBJECT_QUERY);
+   q = vrend_object_lookup(ctx->sub->object_table, handle, VIRGL_OBJECT_QUERY);
    if (!q)
       return;
 
@@ -6876,6 +8692,7 @@ bool vrend_renderer_fill_caps_common(uint32_t set, uint32_t version,
    } else if (set == 2) {
       memset(caps, 0, sizeof(*caps));
       caps->max_version = 2;
+      caps->v2.capability_bits_v2 |= VIRGL_CAP_V2_TGSI_TOKENS;
    }
 
    gl_ver = epoxy_gl_version();
@@ -7248,6 +9065,9 @@ void vrend_renderer_fill_caps(uint32_t set, uint32_t version,
 
    if (gl_ver >= 43)
       glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &caps->v2.texture_buffer_offset_alignment);
+
+   if (gl_ver >= 43 || epoxy_has_gl_extension("GL_ARB_shader_storage_buffer_object"))
+      glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &caps->v2.shader_buffer_offset_alignment);
 }
 
 GLint64 vrend_renderer_get_timestamp(void)
@@ -7389,17 +9209,26 @@ void vrend_renderer_attach_res_ctx(int ctx_id, int resource_id)
    if (!res)
       return;
 
-   vrend_object_insert_nofree(ctx->res_hash, res, sizeof(*res), resource_id, 1, false);
+   STATIC_ASSERT(VREND_MAX_CTX <= 64);
+   res->ctx_mask |= 1ull << ctx->ctx_id;
 }
 
 static void vrend_renderer_detach_res_ctx_p(struct vrend_context *ctx, int res_handle)
 {
    struct vrend_resource *res;
-   res = vrend_object_lookup(ctx->res_hash, res_handle, 1);
+   res = vrend_resource_lookup(res_handle, 0);
    if (!res)
       return;
 
-   vrend_object_remove(ctx->res_hash, res_handle, 1);
+   res->ctx_mask &= ~(1ull << ctx->ctx_id);
+}
+
+static void vrend_renderer_detach_res_cb(void *data, void *closure)
+{
+   struct vrend_resource *res = data;
+   struct vrend_context *ctx = closure;
+
+   res->ctx_mask &= ~(1ull << ctx->ctx_id);
 }
 
 void vrend_renderer_detach_res_ctx(int ctx_id, int res_handle)
@@ -7412,8 +9241,10 @@ void vrend_renderer_detach_res_ctx(int ctx_id, int res_handle)
 
 static struct vrend_resource *vrend_renderer_ctx_res_lookup(struct vrend_context *ctx, int res_handle)
 {
-   struct vrend_resource *res = vrend_object_lookup(ctx->res_hash, res_handle, 1);
+   struct vrend_resource *res = vrend_resource_lookup(res_handle, 0);
 
+   if (!res || !(res->ctx_mask & (1ull << ctx->ctx_id)))
+      return NULL;
    return res;
 }
 
@@ -7498,13 +9329,17 @@ void vrend_renderer_create_sub_ctx(struct vrend_context *ctx, int sub_ctx_id)
       glBindVertexArray(sub->vaoid);
    }
 
-   glGenFramebuffers(1, &sub->fb_id);
+   glGenFramebuffers(1, &sub->fb_empty_id);
+   sub->fb_id = sub->fb_empty_id;
+   list_inithead(&sub->fbo_cache);
    glGenFramebuffers(2, sub->blit_fb_ids);
 
    list_inithead(&sub->programs);
+   sub->program_hash = util_hash_table_create(program_hash_func, program_compare,
+                                              program_hash_destroy);
    list_inithead(&sub->streamout_list);
 
-   sub->object_hash = vrend_object_init_ctx_table();
+   sub->object_table = vrend_object_init_ctx_table();
 
    ctx->sub = sub;
    list_add(&sub->head, &ctx->sub_ctxs);
@@ -7574,11 +9409,16 @@ void vrend_renderer_reset(void)
       vrend_state.stop_sync_thread = false;
    }
    vrend_reset_fences();
+   vrend_readback_fini();
+   vrend_upload_ring_fini();
    vrend_decode_reset(false);
    vrend_object_fini_resource_table();
    vrend_decode_reset(true);
+   /* the compile context has to share with the new context 0 */
+   vrend_free_compile_thread();
    vrend_object_init_resource_table();
    vrend_renderer_context_create_internal(0, 0, NULL);
+   vrend_renderer_use_async_shader_compile();
 }
 
 int vrend_renderer_get_poll_fd(void)
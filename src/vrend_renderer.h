@@ -29,6 +29,7 @@
 #include "util/u_inlines.h"
 #include "virgl_protocol.h"
 #include "vrend_iov.h"
+#include "vrend_slab.h"
 #include "virgl_hw.h"
 
 typedef void *virgl_gl_context;
@@ -43,6 +44,9 @@ struct virgl_gl_ctx_param {
 extern int vrend_dump_shaders;
 struct vrend_context;
 
+/* context ids are below this, a resource tracks them in a 64 bit mask */
+#define VREND_MAX_CTX 64
+
 struct vrend_resource {
    struct pipe_resource base;
    GLuint id;
@@ -56,8 +60,12 @@ struct vrend_resource {
    bool y_0_top;
 
    GLuint handle;
+   /* bit n is set while the resource is attached to context n */
+   uint64_t ctx_mask;
 
    char *ptr;
+   /* buffers with persistent storage stay mapped for their whole life */
+   char *mapped;
    struct iovec *iov;
    uint32_t num_iovs;
 };
@@ -100,6 +108,7 @@ struct vrend_if_cbs {
 };
 
 #define VREND_USE_THREAD_SYNC 1
+#define VREND_USE_ASYNC_READBACK 2
 
 int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags);
 
@@ -109,7 +118,7 @@ int vrend_create_shader(struct vrend_context *ctx,
                         uint32_t handle,
                         const struct pipe_stream_output_info *stream_output,
                         const char *shd_text, uint32_t offlen, uint32_t num_tokens,
-                        uint32_t type, uint32_t pkt_length);
+                        uint32_t type, bool binary_tokens, uint32_t pkt_length);
 
 void vrend_bind_shader(struct vrend_context *ctx,
                        uint32_t type,
@@ -126,6 +135,13 @@ void vrend_draw_vbo(struct vrend_context *ctx,
                     const struct pipe_draw_info *info,
                     uint32_t cso, uint32_t indirect_handle, uint32_t indirect_draw_count_handle);
 
+/* consecutive draws that only differ in start, count, index bias and
+   index range, issued with one multi draw call where possible */
+#define VREND_MAX_DRAW_BATCH 64
+void vrend_draw_vbo_multi(struct vrend_context *ctx,
+                          const struct pipe_draw_info *infos,
+                          uint32_t num_draws);
+
 void vrend_set_framebuffer_state(struct vrend_context *ctx,
                                  uint32_t nr_cbufs, uint32_t surf_handle[PIPE_MAX_COLOR_BUFS],
                                  uint32_t zsurf_handle);
@@ -278,6 +294,24 @@ void vrend_renderer_blit(struct vrend_context *ctx,
                          const struct pipe_blit_info *info);
 
 void vrend_set_stencil_ref(struct vrend_context *ctx, struct pipe_stencil_ref *ref);
+
+/* last payload of the SET_* commands that guests tend to resend unchanged,
+   kept per sub context so that repeats can be dropped at decode time */
+enum vrend_state_shadow_type {
+   VREND_SHADOW_BLEND_COLOR,
+   VREND_SHADOW_STENCIL_REF,
+   VREND_SHADOW_SCISSOR,
+   VREND_SHADOW_VIEWPORT,
+   VREND_SHADOW_SAMPLE_MASK,
+   VREND_SHADOW_CLIP,
+   VREND_SHADOW_COUNT,
+};
+
+#define VREND_STATE_SHADOW_MAX_DWORDS (1 + 6 * PIPE_MAX_VIEWPORTS)
+
+bool vrend_state_is_redundant(struct vrend_context *ctx,
+                              enum vrend_state_shadow_type type,
+                              const uint32_t *data, uint32_t length);
 void vrend_set_blend_color(struct vrend_context *ctx, struct pipe_blend_color *color);
 void vrend_set_scissor_state(struct vrend_context *ctx,
                              uint32_t start_slot,
@@ -403,6 +437,45 @@ void vrend_renderer_reset(void);
 int vrend_renderer_get_poll_fd(void);
 void vrend_decode_reset(bool ctx_0_only);
 
+/* per context decode statistics, enabled by VIRGL_DECODE_STATS */
+#define VREND_STATS_MAX_CMDS 64
+#define VREND_STATS_MAX_OBJECTS 32
+#define VREND_STATS_BUCKETS 32
+#define VREND_STATS_MAX_SLABS 8
+
+enum vrend_slab_type {
+   VREND_SLAB_SURFACE,
+   VREND_SLAB_SAMPLER_VIEW,
+   VREND_SLAB_SAMPLER_STATE,
+   VREND_SLAB_QUERY,
+   VREND_SLAB_SHADER_SELECTOR,
+   VREND_SLAB_SHADER,
+   VREND_SLAB_COUNT,
+};
+
+struct vrend_renderer_cmd_stats {
+   uint64_t count;
+   uint64_t total_ns;
+   uint64_t elided;
+   uint64_t histogram[VREND_STATS_BUCKETS];
+};
+
+struct vrend_renderer_stats {
+   struct vrend_renderer_cmd_stats cmds[VREND_STATS_MAX_CMDS];
+   struct vrend_renderer_cmd_stats objects[VREND_STATS_MAX_OBJECTS];
+   /* indexed by enum vrend_slab_type */
+   struct vrend_slab_stats slabs[VREND_STATS_MAX_SLABS];
+   uint64_t rs_emits;
+   uint64_t rs_gl_calls;
+};
+
+/* fills in the parts of the stats kept by the renderer context */
+void vrend_renderer_fill_stats(struct vrend_context *ctx,
+                               struct vrend_renderer_stats *stats);
+
+void vrend_decode_enable_stats(bool enable);
+int vrend_renderer_get_stats(uint32_t ctx_id, struct vrend_renderer_stats *stats);
+
 struct gl_version {
    uint32_t major;
    uint32_t minor;
@@ -32,6 +32,7 @@
 #include <math.h>
 #include <errno.h>
 #include "vrend_shader.h"
+#include "vrend_strbuf.h"
 
 extern int vrend_dump_shaders;
 
@@ -89,7 +90,7 @@ struct dump_ctx {
    struct tgsi_shader_info info;
    int prog_type;
    int size;
-   char *glsl_main;
+   struct vrend_strbuf glsl_main;
    uint instno;
 
    int num_interps;
@@ -230,21 +231,23 @@ static inline bool fs_emit_layout(struct dump_ctx *ctx)
    return false;
 }
 
-static char *strcat_realloc(char *str, const char *catstr)
+static bool add_str_to_glsl_main(struct dump_ctx *ctx, const char *buf)
 {
-   char *new = realloc(str, strlen(str) + strlen(catstr) + 1);
-   if (!new) {
-      free(str);
-      return NULL;
-   }
-   strcat(new, catstr);
-   return new;
+   return strbuf_append(&ctx->glsl_main, buf);
 }
 
-static char *add_str_to_glsl_main(struct dump_ctx *ctx, const char *buf)
+static bool emit_buff(struct dump_ctx *ctx, const char *fmt, ...)
+   __attribute__((format(printf, 2, 3)));
+
+static bool emit_buff(struct dump_ctx *ctx, const char *fmt, ...)
 {
-   ctx->glsl_main = strcat_realloc(ctx->glsl_main, buf);
-   return ctx->glsl_main;
+   va_list ap;
+   bool ret;
+
+   va_start(ap, fmt);
+   ret = strbuf_vappendf(&ctx->glsl_main, fmt, ap);
+   va_end(ap);
+   return ret;
 }
 
 static int allocate_temp_range(struct dump_ctx *ctx, int first, int last,
@@ -959,14 +962,10 @@ static char get_swiz_char(int swiz)
 
 static int emit_cbuf_writes(struct dump_ctx *ctx)
 {
-   char buf[255];
    int i;
-   char *sret;
 
    for (i = 1; i < 8; i++) {
-      snprintf(buf, 255, "fsout_c%d = fsout_c0;\n", i);
-      sret = add_str_to_glsl_main(ctx, buf);
-      if (!sret)
+      if (!emit_buff(ctx, "fsout_c%d = fsout_c0;\n", i))
          return ENOMEM;
    }
    return 0;
@@ -974,11 +973,7 @@ static int emit_cbuf_writes(struct dump_ctx *ctx)
 
 static int emit_a8_swizzle(struct dump_ctx *ctx)
 {
-   char buf[255];
-   char *sret;
-   snprintf(buf, 255, "fsout_c0.x = fsout_c0.w;\n");
-   sret = add_str_to_glsl_main(ctx, buf);
-   if (!sret)
+   if (!add_str_to_glsl_main(ctx, "fsout_c0.x = fsout_c0.w;\n"))
       return ENOMEM;
    return 0;
 }
@@ -996,9 +991,7 @@ static const char *atests[PIPE_FUNC_ALWAYS + 1] = {
 
 static int emit_alpha_test(struct dump_ctx *ctx)
 {
-   char buf[255];
    char comp_buf[128];
-   char *sret;
 
    if (!ctx->num_outputs)
            return 0;
@@ -1026,53 +1019,39 @@ static int emit_alpha_test(struct dump_ctx *ctx)
       return EINVAL;
    }
 
-   snprintf(buf, 255, "if (!(%s)) {\n\tdiscard;\n}\n", comp_buf);
-   sret = add_str_to_glsl_main(ctx, buf);
-   if (!sret)
+   if (!emit_buff(ctx, "if (!(%s)) {\n\tdiscard;\n}\n", comp_buf))
       return ENOMEM;
    return 0;
 }
 
 static int emit_pstipple_pass(struct dump_ctx *ctx)
 {
-   char buf[255];
-   char *sret;
-   snprintf(buf, 255, "stip_temp = texture(pstipple_sampler, vec2(gl_FragCoord.x / 32, gl_FragCoord.y / 32)).x;\n");
-   sret = add_str_to_glsl_main(ctx, buf);
-   if (!sret)
+   if (!add_str_to_glsl_main(ctx, "stip_temp = texture(pstipple_sampler, vec2(gl_FragCoord.x / 32, gl_FragCoord.y / 32)).x;\n"))
+      return ENOMEM;
+   if (!add_str_to_glsl_main(ctx, "if (stip_temp > 0) {\n\tdiscard;\n}\n"))
       return ENOMEM;
-   snprintf(buf, 255, "if (stip_temp > 0) {\n\tdiscard;\n}\n");
-   sret = add_str_to_glsl_main(ctx, buf);
-   return sret ? 0 : ENOMEM;
+   return 0;
 }
 
 static int emit_color_select(struct dump_ctx *ctx)
 {
-   char buf[255];
-   char *sret = NULL;
-
    if (!ctx->key->color_two_side || !(ctx->color_in_mask & 0x3))
       return 0;
 
    if (ctx->color_in_mask & 1) {
-      snprintf(buf, 255, "realcolor0 = gl_FrontFacing ? ex_c0 : ex_bc0;\n");
-      sret = add_str_to_glsl_main(ctx, buf);
+      if (!add_str_to_glsl_main(ctx, "realcolor0 = gl_FrontFacing ? ex_c0 : ex_bc0;\n"))
+         return ENOMEM;
    }
    if (ctx->color_in_mask & 2) {
-      snprintf(buf, 255, "realcolor1 = gl_FrontFacing ? ex_c1 : ex_bc1;\n");
-      sret = add_str_to_glsl_main(ctx, buf);
+      if (!add_str_to_glsl_main(ctx, "realcolor1 = gl_FrontFacing ? ex_c1 : ex_bc1;\n"))
+         return ENOMEM;
    }
-   return sret ? 0 : ENOMEM;
+   return 0;
 }
 
 static int emit_prescale(struct dump_ctx *ctx)
 {
-   char buf[255];
-   char *sret;
-
-   snprintf(buf, 255, "gl_Position.y = gl_Position.y * winsys_adjust_y;\n");
-   sret = add_str_to_glsl_main(ctx, buf);
-   if (!sret)
+   if (!add_str_to_glsl_main(ctx, "gl_Position.y = gl_Position.y * winsys_adjust_y;\n"))
       return ENOMEM;
    return 0;
 }
@@ -1102,11 +1081,10 @@ static int prepare_so_movs(struct dump_ctx *ctx)
 
 static int emit_so_movs(struct dump_ctx *ctx)
 {
-   char buf[255];
    int i, j;
    char outtype[15] = {0};
    char writemask[6];
-   char *sret;
+   bool sret = true;
 
    if (ctx->so->num_outputs >= PIPE_MAX_SO_OUTPUTS) {
       fprintf(stderr, "Num outputs exceeded, max is %u\n", PIPE_MAX_SO_OUTPUTS);
@@ -1154,15 +1132,13 @@ static int emit_so_movs(struct dump_ctx *ctx)
       if (ctx->so->output[i].register_index >= 255)
          continue;
 
-      buf[0] = 0;
       if (ctx->outputs[ctx->so->output[i].register_index].name == TGSI_SEMANTIC_CLIPDIST) {
-         snprintf(buf, 255, "tfout%d = %s(clip_dist_temp[%d]%s);\n", i, outtype, ctx->outputs[ctx->so->output[i].register_index].sid,
-                  writemask);
+         sret = emit_buff(ctx, "tfout%d = %s(clip_dist_temp[%d]%s);\n", i, outtype, ctx->outputs[ctx->so->output[i].register_index].sid,
+                          writemask);
       } else {
          if (ctx->write_so_outputs[i])
-            snprintf(buf, 255, "tfout%d = %s(%s%s);\n", i, outtype, ctx->outputs[ctx->so->output[i].register_index].glsl_name, writemask);
+            sret = emit_buff(ctx, "tfout%d = %s(%s%s);\n", i, outtype, ctx->outputs[ctx->so->output[i].register_index].glsl_name, writemask);
       }
-      sret = add_str_to_glsl_main(ctx, buf);
       if (!sret)
          return ENOMEM;
    }
@@ -1171,16 +1147,12 @@ static int emit_so_movs(struct dump_ctx *ctx)
 
 static int emit_clip_dist_movs(struct dump_ctx *ctx)
 {
-   char buf[255];
    int i;
-   char *sret;
    bool has_prop = (ctx->num_clip_dist_prop + ctx->num_cull_dist_prop) > 0;
    int ndists;
    if (ctx->num_clip_dist == 0 && ctx->key->clip_plane_enable) {
       for (i = 0; i < 8; i++) {
-         snprintf(buf, 255, "gl_ClipDistance[%d] = dot(%s, clipp[%d]);\n", i, ctx->has_clipvertex ? "clipv_tmp" : "gl_Position", i);
-         sret = add_str_to_glsl_main(ctx, buf);
-         if (!sret)
+         if (!emit_buff(ctx, "gl_ClipDistance[%d] = dot(%s, clipp[%d]);\n", i, ctx->has_clipvertex ? "clipv_tmp" : "gl_Position", i))
             return ENOMEM;
       }
       return 0;
@@ -1206,10 +1178,8 @@ static int emit_clip_dist_movs(struct dump_ctx *ctx)
             is_cull = true;
       }
       const char *clip_cull = is_cull ? "Cull" : "Clip";
-      snprintf(buf, 255, "gl_%sDistance[%d] = clip_dist_temp[%d].%c;\n", clip_cull,
-               is_cull ? i - ctx->num_clip_dist_prop : i, clipidx, wm);
-      sret = add_str_to_glsl_main(ctx, buf);
-      if (!sret)
+      if (!emit_buff(ctx, "gl_%sDistance[%d] = clip_dist_temp[%d].%c;\n", clip_cull,
+                     is_cull ? i - ctx->num_clip_dist_prop : i, clipidx, wm))
          return ENOMEM;
    }
    return 0;
@@ -1224,15 +1194,12 @@ static int emit_clip_dist_movs(struct dump_ctx *ctx)
 static int emit_buf(struct dump_ctx *ctx, const char *buf)
 {
    int i;
-   char *sret;
    for (i = 0; i < ctx->indent_level; i++) {
-      sret = add_str_to_glsl_main(ctx, "\t");
-      if (!sret)
+      if (!add_str_to_glsl_main(ctx, "\t"))
          return ENOMEM;
    }
 
-   sret = add_str_to_glsl_main(ctx, buf);
-   return sret ? 0 : ENOMEM;
+   return add_str_to_glsl_main(ctx, buf) ? 0 : ENOMEM;
 }
 
 #define EMIT_BUF_WITH_RET(ctx, buf) do {        \
@@ -2029,7 +1996,7 @@ iter_instruction(struct tgsi_iterate_context *iter,
    bool stprefix = false;
    bool override_no_wm[4];
    bool dst_override_no_wm[2];
-   char *sret;
+   bool sret;
    char interpSrc0[255], interpSwizzle0[10];
    int ret;
    bool tg4_has_component = false;
@@ -2991,11 +2958,14 @@ prolog(struct tgsi_iterate_context *iter)
 }
 
 #define STRCAT_WITH_RET(mainstr, buf) do {              \
-      (mainstr) = strcat_realloc((mainstr), (buf));        \
-      if ((mainstr) == NULL) return NULL;               \
+      if (!strbuf_append((mainstr), (buf))) return false;  \
+   } while(0)
+
+#define STRCATF_WITH_RET(mainstr, ...) do {             \
+      if (!strbuf_appendf((mainstr), __VA_ARGS__)) return false;  \
    } while(0)
 
-static char *emit_header(struct dump_ctx *ctx, char *glsl_hdr)
+static bool emit_header(struct dump_ctx *ctx, struct vrend_strbuf *glsl_hdr)
 {
    if (ctx->cfg->use_gles) {
       STRCAT_WITH_RET(glsl_hdr, "#version 300 es\n");
@@ -3051,7 +3021,7 @@ static char *emit_header(struct dump_ctx *ctx, char *glsl_hdr)
       if (ctx->ssbo)
          STRCAT_WITH_RET(glsl_hdr, "#extension GL_ARB_shader_storage_buffer_object : require\n");
    }
-   return glsl_hdr;
+   return true;
 }
 
 char vrend_shader_samplerreturnconv(enum tgsi_return_type type)
@@ -3250,10 +3220,9 @@ const char *get_internalformat_string(int virgl_format, enum tgsi_return_type *s
    }
 }
 
-static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
+static bool emit_ios(struct dump_ctx *ctx, struct vrend_strbuf *glsl_hdr)
 {
    int i;
-   char buf[255];
    char postfix[8];
    const char *prefix = "";
    bool fcolor_emitted[2], bcolor_emitted[2];
@@ -3263,7 +3232,7 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
 
    if (ctx->so && ctx->so->num_outputs >= PIPE_MAX_SO_OUTPUTS) {
       fprintf(stderr, "Num outputs exceeded, max is %u\n", PIPE_MAX_SO_OUTPUTS);
-      return NULL;
+      return false;
    }
 
    if (ctx->key->color_two_side) {
@@ -3275,22 +3244,19 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
          bool upper_left = !(ctx->fs_coord_origin ^ ctx->key->invert_fs_origin);
          char comma = (upper_left && ctx->fs_pixel_center) ? ',' : ' ';
 
-         snprintf(buf, 255, "layout(%s%c%s) in vec4 gl_FragCoord;\n",
-                  upper_left ? "origin_upper_left" : "",
-                  comma,
-                  ctx->fs_pixel_center ? "pixel_center_integer" : "");
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "layout(%s%c%s) in vec4 gl_FragCoord;\n",
+                          upper_left ? "origin_upper_left" : "",
+                          comma,
+                          ctx->fs_pixel_center ? "pixel_center_integer" : "");
       }
       if (ctx->early_depth_stencil) {
-         snprintf(buf, 255, "layout(early_fragment_tests) in;\n");
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "layout(early_fragment_tests) in;\n");
       }
    }
 
    if (ctx->prog_type == TGSI_PROCESSOR_COMPUTE) {
-      snprintf(buf, 255, "layout (local_size_x = %d, local_size_y = %d, local_size_z = %d) in;\n",
-	       ctx->local_cs_block_size[0], ctx->local_cs_block_size[1], ctx->local_cs_block_size[2]);
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "layout (local_size_x = %d, local_size_y = %d, local_size_z = %d) in;\n",
+                       ctx->local_cs_block_size[0], ctx->local_cs_block_size[1], ctx->local_cs_block_size[2]);
    }
 
    if (ctx->prog_type == TGSI_PROCESSOR_GEOMETRY) {
@@ -3299,17 +3265,14 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
       if (ctx->gs_num_invocations)
          snprintf(invocbuf, 25, ", invocations = %d", ctx->gs_num_invocations);
 
-      snprintf(buf, 255, "layout(%s%s) in;\n", prim_to_name(ctx->gs_in_prim),
-               ctx->gs_num_invocations > 1 ? invocbuf : "");
-      STRCAT_WITH_RET(glsl_hdr, buf);
-      snprintf(buf, 255, "layout(%s, max_vertices = %d) out;\n", prim_to_name(ctx->gs_out_prim), ctx->gs_max_out_verts);
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "layout(%s%s) in;\n", prim_to_name(ctx->gs_in_prim),
+                       ctx->gs_num_invocations > 1 ? invocbuf : "");
+      STRCATF_WITH_RET(glsl_hdr, "layout(%s, max_vertices = %d) out;\n", prim_to_name(ctx->gs_out_prim), ctx->gs_max_out_verts);
    }
    for (i = 0; i < ctx->num_inputs; i++) {
       if (!ctx->inputs[i].glsl_predefined_no_emit) {
          if (ctx->prog_type == TGSI_PROCESSOR_VERTEX && ctx->cfg->use_explicit_locations) {
-            snprintf(buf, 255, "layout(location=%d) ", ctx->inputs[i].first);
-            STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "layout(location=%d) ", ctx->inputs[i].first);
          }
          if (ctx->prog_type == TGSI_PROCESSOR_FRAGMENT &&
              (ctx->inputs[i].name == TGSI_SEMANTIC_GENERIC ||
@@ -3324,17 +3287,15 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
             snprintf(postfix, 8, "[%d]", gs_input_prim_to_size(ctx->gs_in_prim));
          } else
             postfix[0] = 0;
-         snprintf(buf, 255, "%sin vec4 %s%s;\n", prefix, ctx->inputs[i].glsl_name, postfix);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "%sin vec4 %s%s;\n", prefix, ctx->inputs[i].glsl_name, postfix);
       }
    }
    if (ctx->write_all_cbufs) {
       for (i = 0; i < 8; i++) {
          if (ctx->cfg->use_gles)
-            snprintf(buf, 255, "layout (location=%d) out vec4 fsout_c%d;\n", i, i);
+            STRCATF_WITH_RET(glsl_hdr, "layout (location=%d) out vec4 fsout_c%d;\n", i, i);
          else
-            snprintf(buf, 255, "out vec4 fsout_c%d;\n", i);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "out vec4 fsout_c%d;\n", i);
       }
    } else {
       for (i = 0; i < ctx->num_outputs; i++) {
@@ -3352,10 +3313,9 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
                prefix = "";
             /* ugly leave spaces to patch interp in later */
             if (ctx->prog_type == TGSI_PROCESSOR_GEOMETRY && ctx->outputs[i].stream)
-               snprintf(buf, 255, "layout (stream = %d) %sout vec4 %s;\n", ctx->outputs[i].stream, prefix, ctx->outputs[i].glsl_name);
+               STRCATF_WITH_RET(glsl_hdr, "layout (stream = %d) %sout vec4 %s;\n", ctx->outputs[i].stream, prefix, ctx->outputs[i].glsl_name);
             else
-               snprintf(buf, 255, "%sout vec4 %s;\n", prefix, ctx->outputs[i].glsl_name);
-            STRCAT_WITH_RET(glsl_hdr, buf);
+               STRCATF_WITH_RET(glsl_hdr, "%sout vec4 %s;\n", prefix, ctx->outputs[i].glsl_name);
          }
       }
    }
@@ -3363,23 +3323,19 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
    if (ctx->prog_type == TGSI_PROCESSOR_VERTEX && ctx->key->color_two_side) {
       for (i = 0; i < 2; i++) {
          if (fcolor_emitted[i] && !bcolor_emitted[i]) {
-            snprintf(buf, 255, "%sout vec4 ex_bc%d;\n", INTERP_PREFIX, i);
-            STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "%sout vec4 ex_bc%d;\n", INTERP_PREFIX, i);
          }
          if (bcolor_emitted[i] && !fcolor_emitted[i]) {
-            snprintf(buf, 255, "%sout vec4 ex_c%d;\n", INTERP_PREFIX, i);
-            STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "%sout vec4 ex_c%d;\n", INTERP_PREFIX, i);
          }
       }
    }
 
    if (ctx->prog_type == TGSI_PROCESSOR_VERTEX) {
-      snprintf(buf, 255, "uniform float winsys_adjust_y;\n");
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "uniform float winsys_adjust_y;\n");
 
       if (ctx->has_clipvertex) {
-         snprintf(buf, 255, "%svec4 clipv_tmp;\n", ctx->has_clipvertex_so ? "out " : "");
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "%svec4 clipv_tmp;\n", ctx->has_clipvertex_so ? "out " : "");
       }
       if (ctx->num_clip_dist || ctx->key->clip_plane_enable) {
          bool has_prop = (ctx->num_clip_dist_prop + ctx->num_cull_dist_prop) > 0;
@@ -3397,25 +3353,20 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
          } else
             snprintf(clip_buf, 64, "out float gl_ClipDistance[%d];\n", num_clip_dists);
          if (ctx->key->clip_plane_enable) {
-            snprintf(buf, 255, "uniform vec4 clipp[8];\n");
-            STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "uniform vec4 clipp[8];\n");
          }
          if (ctx->key->gs_present) {
             ctx->vs_has_pervertex = true;
-            snprintf(buf, 255, "out gl_PerVertex {\n vec4 gl_Position;\n float gl_PointSize;\n%s%s};\n", clip_buf, cull_buf);
-            STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "out gl_PerVertex {\n vec4 gl_Position;\n float gl_PointSize;\n%s%s};\n", clip_buf, cull_buf);
          } else {
-            snprintf(buf, 255, "%s%s", clip_buf, cull_buf);
-            STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "%s%s", clip_buf, cull_buf);
          }
-         snprintf(buf, 255, "vec4 clip_dist_temp[2];\n");
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "vec4 clip_dist_temp[2];\n");
       }
    }
 
    if (ctx->prog_type == TGSI_PROCESSOR_GEOMETRY) {
-      snprintf(buf, 255, "uniform float winsys_adjust_y;\n");
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "uniform float winsys_adjust_y;\n");
       if (ctx->num_in_clip_dist || ctx->key->clip_plane_enable || ctx->key->prev_stage_pervertex_out) {
          int clip_dist, cull_dist;
          char clip_var[64] = {}, cull_var[64] = {};
@@ -3428,8 +3379,7 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
          if (cull_dist)
             snprintf(cull_var, 64, "float gl_CullDistance[%d];\n", cull_dist);
 
-         snprintf(buf, 255, "in gl_PerVertex {\n vec4 gl_Position;\n float gl_PointSize; \n %s%s\n} gl_in[];\n", clip_var, cull_var);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "in gl_PerVertex {\n vec4 gl_Position;\n float gl_PointSize; \n %s%s\n} gl_in[];\n", clip_var, cull_var);
       }
       if (ctx->num_clip_dist) {
          bool has_prop = (ctx->num_clip_dist_prop + ctx->num_cull_dist_prop) > 0;
@@ -3446,21 +3396,17 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
                snprintf(cull_buf, 64, "out float gl_CullDistance[%d];\n", num_cull_dists);
          } else
             snprintf(clip_buf, 64, "out float gl_ClipDistance[%d];\n", num_clip_dists);
-         snprintf(buf, 255, "%s%s\n", clip_buf, cull_buf);
-         STRCAT_WITH_RET(glsl_hdr, buf);
-         snprintf(buf, 255, "vec4 clip_dist_temp[2];\n");
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "%s%s\n", clip_buf, cull_buf);
+         STRCATF_WITH_RET(glsl_hdr, "vec4 clip_dist_temp[2];\n");
       }
    }
 
    if (ctx->prog_type == TGSI_PROCESSOR_FRAGMENT && ctx->num_in_clip_dist) {
       if (ctx->key->prev_stage_num_clip_out) {
-         snprintf(buf, 255, "in float gl_ClipDistance[%d];\n", ctx->key->prev_stage_num_clip_out);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "in float gl_ClipDistance[%d];\n", ctx->key->prev_stage_num_clip_out);
       }
       if (ctx->key->prev_stage_num_cull_out) {
-         snprintf(buf, 255, "in float gl_CullDistance[%d];\n", ctx->key->prev_stage_num_cull_out);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "in float gl_CullDistance[%d];\n", ctx->key->prev_stage_num_cull_out);
       }
    }
 
@@ -3474,49 +3420,39 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
          else
             snprintf(outtype, 6, "vec%d", ctx->so->output[i].num_components);
          if (ctx->so->output[i].stream && ctx->prog_type == TGSI_PROCESSOR_GEOMETRY)
-            snprintf(buf, 255, "layout (stream=%d) out %s tfout%d;\n", ctx->so->output[i].stream, outtype, i);
+            STRCATF_WITH_RET(glsl_hdr, "layout (stream=%d) out %s tfout%d;\n", ctx->so->output[i].stream, outtype, i);
          else
-            snprintf(buf, 255, "out %s tfout%d;\n", outtype, i);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "out %s tfout%d;\n", outtype, i);
       }
    }
    for (i = 0; i < ctx->num_temp_ranges; i++) {
-      snprintf(buf, 255, "vec4 temp%d[%d];\n", ctx->temp_ranges[i].first, ctx->temp_ranges[i].last - ctx->temp_ranges[i].first + 1);
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "vec4 temp%d[%d];\n", ctx->temp_ranges[i].first, ctx->temp_ranges[i].last - ctx->temp_ranges[i].first + 1);
    }
 
    if (ctx->write_mul_temp) {
-      snprintf(buf, 255, "uvec4 mul_temp;\n");
-      STRCAT_WITH_RET(glsl_hdr, buf);
-      snprintf(buf, 255, "uvec4 umul_temp;\n");
-      STRCAT_WITH_RET(glsl_hdr, buf);
-      snprintf(buf, 255, "ivec4 imul_temp;\n");
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "uvec4 mul_temp;\n");
+      STRCATF_WITH_RET(glsl_hdr, "uvec4 umul_temp;\n");
+      STRCATF_WITH_RET(glsl_hdr, "ivec4 imul_temp;\n");
    }
 
    if (ctx->write_interp_temp) {
-      snprintf(buf, 255, "vec4 interp_temp;\n");
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "vec4 interp_temp;\n");
    }
 
    for (i = 0; i < ctx->num_address; i++) {
-      snprintf(buf, 255, "int addr%d;\n", i);
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "int addr%d;\n", i);
    }
    if (ctx->num_consts) {
       const char *cname = tgsi_proc_to_prefix(ctx->prog_type);
-      snprintf(buf, 255, "uniform uvec4 %sconst0[%d];\n", cname, ctx->num_consts);
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "uniform uvec4 %sconst0[%d];\n", cname, ctx->num_consts);
    }
 
    if (ctx->key->color_two_side) {
       if (ctx->color_in_mask & 1) {
-         snprintf(buf, 255, "vec4 realcolor0;\n");
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "vec4 realcolor0;\n");
       }
       if (ctx->color_in_mask & 2) {
-         snprintf(buf, 255, "vec4 realcolor1;\n");
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "vec4 realcolor1;\n");
       }
    }
    if (ctx->num_ubo) {
@@ -3524,12 +3460,10 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
 
       if (ctx->info.dimension_indirect_files & (1 << TGSI_FILE_CONSTANT)) {
          ctx->glsl_ver_required = 150;
-         snprintf(buf, 255, "uniform %subo { vec4 ubocontents[%d]; } %suboarr[%d];\n", cname, ctx->ubo_sizes[0], cname, ctx->num_ubo);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "uniform %subo { vec4 ubocontents[%d]; } %suboarr[%d];\n", cname, ctx->ubo_sizes[0], cname, ctx->num_ubo);
       } else {
          for (i = 0; i < ctx->num_ubo; i++) {
-            snprintf(buf, 255, "uniform %subo%d { vec4 %subo%dcontents[%d]; };\n", cname, ctx->ubo_idx[i], cname, ctx->ubo_idx[i], ctx->ubo_sizes[i]);
-            STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "uniform %subo%d { vec4 %subo%dcontents[%d]; };\n", cname, ctx->ubo_idx[i], cname, ctx->ubo_idx[i], ctx->ubo_sizes[i]);
          }
       }
    }
@@ -3541,11 +3475,10 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
          stc = vrend_shader_samplertypeconv(ctx->sampler_arrays[i].sview_type, &is_shad);
          if (!stc)
             continue;
-         snprintf(buf, 255, "uniform %csampler%s %ssamp%d[%d];\n",
-                  get_return_type_prefix(ctx->sampler_arrays[i].sview_rtype),
-                  stc, sname, ctx->sampler_arrays[i].idx,
-                  ctx->sampler_arrays[i].last - ctx->sampler_arrays[i].first);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "uniform %csampler%s %ssamp%d[%d];\n",
+                          get_return_type_prefix(ctx->sampler_arrays[i].sview_rtype),
+                          stc, sname, ctx->sampler_arrays[i].idx,
+                          ctx->sampler_arrays[i].last - ctx->sampler_arrays[i].first);
       }
    } else {
       nsamp = util_last_bit(ctx->samplers_used);
@@ -3565,16 +3498,13 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
           * so we use a 2D texture with a parameter set to 0.5
           */
          if (ctx->cfg->use_gles && !strcmp(stc, "1D"))
-            snprintf(buf, 255, "uniform %csampler2D %ssamp%d;\n", ptc, sname, i);
+            STRCATF_WITH_RET(glsl_hdr, "uniform %csampler2D %ssamp%d;\n", ptc, sname, i);
          else
-            snprintf(buf, 255, "uniform %csampler%s %ssamp%d;\n", ptc, stc, sname, i);
+            STRCATF_WITH_RET(glsl_hdr, "uniform %csampler%s %ssamp%d;\n", ptc, stc, sname, i);
 
-         STRCAT_WITH_RET(glsl_hdr, buf);
          if (is_shad) {
-            snprintf(buf, 255, "uniform vec4 %sshadmask%d;\n", sname, i);
-            STRCAT_WITH_RET(glsl_hdr, buf);
-            snprintf(buf, 255, "uniform vec4 %sshadadd%d;\n", sname, i);
-            STRCAT_WITH_RET(glsl_hdr, buf);
+            STRCATF_WITH_RET(glsl_hdr, "uniform vec4 %sshadmask%d;\n", sname, i);
+            STRCATF_WITH_RET(glsl_hdr, "uniform vec4 %sshadadd%d;\n", sname, i);
             ctx->shadow_samp_mask |= (1 << i);
          }
       }
@@ -3598,8 +3528,7 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
          ptc = vrend_shader_samplerreturnconv(itype);
          sname = tgsi_proc_to_prefix(ctx->prog_type);
          stc = vrend_shader_samplertypeconv(ctx->images[i].decl.Resource, &is_shad);
-         snprintf(buf, 255, "%s%s%suniform %cimage%s %simg%d;\n", formatstr, writeonly, volatile_str, ptc, stc, sname, i);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "%s%s%suniform %cimage%s %simg%d;\n", formatstr, writeonly, volatile_str, ptc, stc, sname, i);
       }
    }
 
@@ -3611,16 +3540,14 @@ static char *emit_ios(struct dump_ctx *ctx, char *glsl_hdr)
          if ((ctx->ssbo_used & (1 << i)) == 0)
             continue;
          sname = tgsi_proc_to_prefix(ctx->prog_type);
-         snprintf(buf, 255, "layout (binding = %d) buffer %sssbo%d { uvec4 ssbocontents%d[]; };\n", i, sname, i, i);
-         STRCAT_WITH_RET(glsl_hdr, buf);
+         STRCATF_WITH_RET(glsl_hdr, "layout (binding = %d) buffer %sssbo%d { uvec4 ssbocontents%d[]; };\n", i, sname, i, i);
       }
    }
    if (ctx->prog_type == TGSI_PROCESSOR_FRAGMENT &&
        ctx->key->pstipple_tex == true) {
-      snprintf(buf, 255, "uniform sampler2D pstipple_sampler;\nfloat stip_temp;\n");
-      STRCAT_WITH_RET(glsl_hdr, buf);
+      STRCATF_WITH_RET(glsl_hdr, "uniform sampler2D pstipple_sampler;\nfloat stip_temp;\n");
    }
-   return glsl_hdr;
+   return true;
 }
 
 static boolean fill_fragment_interpolants(struct dump_ctx *ctx, struct vrend_shader_info *sinfo)
@@ -3680,7 +3607,7 @@ char *vrend_convert_shader(struct vrend_shader_cfg *cfg,
    struct dump_ctx ctx;
    char *glsl_final = NULL;
    boolean bret;
-   char *glsl_hdr = NULL;
+   struct vrend_strbuf glsl_hdr = { 0 };
 
    memset(&ctx, 0, sizeof(struct dump_ctx));
    ctx.iter.prolog = prolog;
@@ -3714,44 +3641,33 @@ char *vrend_convert_shader(struct vrend_shader_cfg *cfg,
    if (ctx.info.indirect_files & (1 << TGSI_FILE_SAMPLER))
       ctx.uses_gpu_shader5 = true;
 
-   ctx.glsl_main = malloc(4096);
-   if (!ctx.glsl_main)
+   if (!strbuf_alloc(&ctx.glsl_main, 4096))
       goto fail;
 
-   ctx.glsl_main[0] = '\0';
    bret = tgsi_iterate_shader(tokens, &ctx.iter);
    if (bret == FALSE)
       goto fail;
 
-   glsl_hdr = malloc(1024);
-   if (!glsl_hdr)
-      goto fail;
-   glsl_hdr[0] = '\0';
-   glsl_hdr = emit_header(&ctx, glsl_hdr);
-   if (!glsl_hdr)
+   if (!strbuf_alloc(&glsl_hdr, 1024))
       goto fail;
 
-   glsl_hdr = emit_ios(&ctx, glsl_hdr);
-   if (!glsl_hdr)
+   if (!emit_header(&ctx, &glsl_hdr))
       goto fail;
 
-   glsl_final = malloc(strlen(glsl_hdr) + strlen(ctx.glsl_main) + 1);
-   if (!glsl_final)
+   if (!emit_ios(&ctx, &glsl_hdr))
       goto fail;
 
-   glsl_final[0] = '\0';
-
    bret = fill_interpolants(&ctx, sinfo);
    if (bret == FALSE)
       goto fail;
 
-   strcat(glsl_final, glsl_hdr);
-   strcat(glsl_final, ctx.glsl_main);
+   if (!strbuf_append_len(&glsl_hdr, ctx.glsl_main.buf, ctx.glsl_main.size))
+      goto fail;
+   glsl_final = strbuf_steal(&glsl_hdr);
    if (vrend_dump_shaders)
       fprintf(stderr,"GLSL: %s\n", glsl_final);
    free(ctx.temp_ranges);
-   free(ctx.glsl_main);
-   free(glsl_hdr);
+   strbuf_free(&ctx.glsl_main);
    sinfo->num_ucp = ctx.key->clip_plane_enable ? 8 : 0;
    sinfo->has_pervertex_out = ctx.vs_has_pervertex;
    bool has_prop = (ctx.num_clip_dist_prop + ctx.num_cull_dist_prop) > 0;
@@ -3775,9 +3691,8 @@ char *vrend_convert_shader(struct vrend_shader_cfg *cfg,
    sinfo->num_sampler_arrays = ctx.num_sampler_arrays;
    return glsl_final;
  fail:
-   free(ctx.glsl_main);
-   free(glsl_final);
-   free(glsl_hdr);
+   strbuf_free(&ctx.glsl_main);
+   strbuf_free(&glsl_hdr);
    free(ctx.so_names);
    free(ctx.temp_ranges);
    return NULL;
@@ -0,0 +1,171 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/u_memory.h"
+#include "util/u_math.h"
+
+#include "vrend_slab.h"
+
+/* Every object is preceded by a header: it points back to the slab while
+   the object is in use and links the free list while it isn't. The header
+   is padded so that the object keeps malloc alignment. */
+union vrend_slab_header {
+   struct vrend_slab *slab;
+   union vrend_slab_header *next;
+   uint64_t align[2];
+};
+
+struct vrend_slab_chunk {
+   struct vrend_slab_chunk *next;
+   uint64_t align;
+};
+
+struct vrend_slab {
+   size_t obj_size;
+   size_t elem_size;
+   unsigned objs_per_chunk;
+
+   union vrend_slab_header *free_list;
+   struct vrend_slab_chunk *chunks;
+   bool destroyed;
+
+   struct vrend_slab_stats stats;
+};
+
+struct vrend_slab *vrend_slab_create(size_t size, unsigned objs_per_chunk)
+{
+   struct vrend_slab *slab = CALLOC_STRUCT(vrend_slab);
+
+   if (!slab)
+      return NULL;
+
+   slab->obj_size = size;
+   slab->elem_size = sizeof(union vrend_slab_header) +
+                     align(size, sizeof(union vrend_slab_header));
+   slab->objs_per_chunk = MAX2(objs_per_chunk, 1);
+   return slab;
+}
+
+static void vrend_slab_release(struct vrend_slab *slab)
+{
+   struct vrend_slab_chunk *chunk = slab->chunks;
+
+   while (chunk) {
+      struct vrend_slab_chunk *next = chunk->next;
+      FREE(chunk);
+      chunk = next;
+   }
+   FREE(slab);
+}
+
+void vrend_slab_destroy(struct vrend_slab *slab)
+{
+   if (!slab)
+      return;
+
+   if (slab->stats.live) {
+      slab->destroyed = true;
+      return;
+   }
+   vrend_slab_release(slab);
+}
+
+static bool vrend_slab_grow(struct vrend_slab *slab)
+{
+   struct vrend_slab_chunk *chunk;
+   uint8_t *elem;
+   unsigned i;
+
+   chunk = MALLOC(sizeof(*chunk) + slab->elem_size * slab->objs_per_chunk);
+   if (!chunk)
+      return false;
+
+   chunk->next = slab->chunks;
+   slab->chunks = chunk;
+
+   elem = (uint8_t *)(chunk + 1);
+   for (i = 0; i < slab->objs_per_chunk; i++, elem += slab->elem_size) {
+      union vrend_slab_header *hdr = (union vrend_slab_header *)elem;
+      hdr->next = slab->free_list;
+      slab->free_list = hdr;
+   }
+
+   slab->stats.chunks++;
+   slab->stats.footprint += sizeof(*chunk) +
+                            slab->elem_size * slab->objs_per_chunk;
+   return true;
+}
+
+void *vrend_slab_alloc(struct vrend_slab *slab)
+{
+   union vrend_slab_header *hdr;
+
+   if (!slab->free_list && !vrend_slab_grow(slab))
+      return NULL;
+
+   hdr = slab->free_list;
+   slab->free_list = hdr->next;
+   hdr->slab = slab;
+
+   slab->stats.allocs++;
+   slab->stats.live++;
+   slab->stats.peak = MAX2(slab->stats.peak, slab->stats.live);
+
+   memset(hdr + 1, 0, slab->obj_size);
+   return hdr + 1;
+}
+
+void vrend_slab_free(void *ptr)
+{
+   union vrend_slab_header *hdr;
+   struct vrend_slab *slab;
+
+   if (!ptr)
+      return;
+
+   hdr = (union vrend_slab_header *)ptr - 1;
+   slab = hdr->slab;
+
+   hdr->next = slab->free_list;
+   slab->free_list = hdr;
+
+   slab->stats.frees++;
+   slab->stats.live--;
+
+   if (slab->destroyed && !slab->stats.live)
+      vrend_slab_release(slab);
+}
+
+void vrend_slab_get_stats(struct vrend_slab *slab,
+                          struct vrend_slab_stats *stats)
+{
+   if (!slab) {
+      memset(stats, 0, sizeof(*stats));
+      return;
+   }
+   *stats = slab->stats;
+}
@@ -0,0 +1,59 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifndef VREND_SLAB_H
+#define VREND_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fixed size allocator for the small objects a context creates and
+   destroys all the time. Objects come out zeroed and know their slab,
+   so they can be freed without a pointer to the owner. Not thread safe,
+   only the renderer thread allocates and frees. */
+struct vrend_slab;
+
+struct vrend_slab_stats {
+   uint64_t allocs;
+   uint64_t frees;
+   /* chunk mallocs, what is left of the malloc traffic */
+   uint64_t chunks;
+   uint32_t live;
+   uint32_t peak;
+   /* bytes held in chunks, used or not */
+   uint64_t footprint;
+};
+
+struct vrend_slab *vrend_slab_create(size_t size, unsigned objs_per_chunk);
+/* frees all chunks, or leaves that to the last vrend_slab_free if
+   objects are still alive */
+void vrend_slab_destroy(struct vrend_slab *slab);
+
+void *vrend_slab_alloc(struct vrend_slab *slab);
+void vrend_slab_free(void *ptr);
+
+void vrend_slab_get_stats(struct vrend_slab *slab,
+                          struct vrend_slab_stats *stats);
+#endif
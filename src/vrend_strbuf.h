@@ -0,0 +1,154 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+#ifndef VREND_STRBUF_H
+#define VREND_STRBUF_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* growable string that keeps track of its length, so appending is
+   amortized constant time instead of a strlen + realloc of the whole
+   string every time */
+struct vrend_strbuf {
+   char *buf;
+   size_t size;
+   size_t alloc_size;
+   /* set once an allocation failed, all later appends are dropped */
+   bool error_state;
+};
+
+static inline bool strbuf_alloc(struct vrend_strbuf *sb, size_t initial_size)
+{
+   sb->buf = malloc(initial_size);
+   sb->size = 0;
+   sb->alloc_size = initial_size;
+   sb->error_state = !sb->buf;
+   if (sb->buf)
+      sb->buf[0] = '\0';
+   return !sb->error_state;
+}
+
+static inline void strbuf_free(struct vrend_strbuf *sb)
+{
+   free(sb->buf);
+   sb->buf = NULL;
+   sb->size = sb->alloc_size = 0;
+}
+
+/* hand the string over to the caller, leaving the buffer empty */
+static inline char *strbuf_steal(struct vrend_strbuf *sb)
+{
+   char *str = sb->error_state ? NULL : sb->buf;
+
+   if (!str)
+      free(sb->buf);
+   sb->buf = NULL;
+   sb->size = sb->alloc_size = 0;
+   return str;
+}
+
+static inline bool strbuf_grow(struct vrend_strbuf *sb, size_t len)
+{
+   size_t new_size;
+   char *new_buf;
+
+   if (sb->error_state)
+      return false;
+   if (sb->size + len + 1 <= sb->alloc_size)
+      return true;
+
+   new_size = sb->alloc_size ? sb->alloc_size : 64;
+   while (new_size < sb->size + len + 1)
+      new_size *= 2;
+
+   new_buf = realloc(sb->buf, new_size);
+   if (!new_buf) {
+      sb->error_state = true;
+      return false;
+   }
+   sb->buf = new_buf;
+   sb->alloc_size = new_size;
+   return true;
+}
+
+static inline bool strbuf_append_len(struct vrend_strbuf *sb, const char *str,
+                                     size_t len)
+{
+   if (!strbuf_grow(sb, len))
+      return false;
+   memcpy(sb->buf + sb->size, str, len);
+   sb->size += len;
+   sb->buf[sb->size] = '\0';
+   return true;
+}
+
+static inline bool strbuf_append(struct vrend_strbuf *sb, const char *str)
+{
+   return strbuf_append_len(sb, str, strlen(str));
+}
+
+static inline bool strbuf_vappendf(struct vrend_strbuf *sb, const char *fmt,
+                                   va_list ap)
+{
+   va_list cp;
+   int len;
+
+   if (sb->error_state)
+      return false;
+
+   va_copy(cp, ap);
+   len = vsnprintf(sb->buf + sb->size, sb->alloc_size - sb->size, fmt, cp);
+   va_end(cp);
+   if (len < 0) {
+      sb->error_state = true;
+      return false;
+   }
+
+   if (sb->size + len + 1 > sb->alloc_size) {
+      if (!strbuf_grow(sb, len))
+         return false;
+      vsnprintf(sb->buf + sb->size, sb->alloc_size - sb->size, fmt, ap);
+   }
+   sb->size += len;
+   return true;
+}
+
+static inline bool strbuf_appendf(struct vrend_strbuf *sb, const char *fmt, ...)
+   __attribute__((format(printf, 2, 3)));
+
+static inline bool strbuf_appendf(struct vrend_strbuf *sb, const char *fmt, ...)
+{
+   va_list ap;
+   bool ret;
+
+   va_start(ap, fmt);
+   ret = strbuf_vappendf(sb, fmt, ap);
+   va_end(ap);
+   return ret;
+}
+
+#endif
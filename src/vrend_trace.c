@@ -0,0 +1,134 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <epoxy/gl.h>
+
+#include "pipe/p_state.h"
+#include "vrend_renderer.h"
+#include "vrend_trace.h"
+
+static FILE *trace_file;
+
+static void trace_write(const void *buf, size_t size)
+{
+   if (!size || !trace_file)
+      return;
+
+   if (fwrite(buf, 1, size, trace_file) != size) {
+      fprintf(stderr, "failed to write command trace, capture stopped\n");
+      fclose(trace_file);
+      trace_file = NULL;
+   }
+}
+
+bool vrend_trace_init(const char *filename)
+{
+   struct vrend_trace_header header;
+
+   vrend_trace_fini();
+
+   trace_file = fopen(filename, "wb");
+   if (!trace_file) {
+      fprintf(stderr, "failed to open command trace %s\n", filename);
+      return false;
+   }
+
+   header.magic = VREND_TRACE_MAGIC;
+   header.version = VREND_TRACE_VERSION;
+   trace_write(&header, sizeof(header));
+   return trace_file != NULL;
+}
+
+void vrend_trace_fini(void)
+{
+   if (!trace_file)
+      return;
+
+   fclose(trace_file);
+   trace_file = NULL;
+}
+
+bool vrend_trace_enabled(void)
+{
+   return trace_file != NULL;
+}
+
+void vrend_trace_record(enum vrend_trace_type type,
+                        const void *args, uint32_t args_size,
+                        const void *data, uint32_t data_size)
+{
+   struct vrend_trace_record record;
+
+   if (!trace_file)
+      return;
+
+   record.type = type;
+   record.size = args_size + data_size;
+   trace_write(&record, sizeof(record));
+   trace_write(args, args_size);
+   trace_write(data, data_size);
+}
+
+static void trace_iov_cb(void *cookie, unsigned int doff, void *src, int len)
+{
+   trace_write(src, len);
+}
+
+void vrend_trace_transfer(enum vrend_trace_type type,
+                          const struct vrend_transfer_info *info,
+                          const struct iovec *iov, int num_iovs,
+                          uint32_t data_size)
+{
+   struct vrend_trace_transfer args;
+   struct vrend_trace_record record;
+
+   if (!trace_file)
+      return;
+
+   args.handle = info->handle;
+   args.ctx_id = info->ctx_id;
+   args.level = info->level;
+   args.stride = info->stride;
+   args.layer_stride = info->layer_stride;
+   args.box[0] = info->box->x;
+   args.box[1] = info->box->y;
+   args.box[2] = info->box->z;
+   args.box[3] = info->box->width;
+   args.box[4] = info->box->height;
+   args.box[5] = info->box->depth;
+   args.data_size = data_size;
+   args.offset = info->offset;
+
+   record.type = type;
+   record.size = sizeof(args);
+   if (type == VREND_TRACE_TRANSFER_WRITE)
+      record.size += data_size;
+
+   trace_write(&record, sizeof(record));
+   trace_write(&args, sizeof(args));
+   if (type == VREND_TRACE_TRANSFER_WRITE)
+      vrend_read_from_iovec_cb(iov, num_iovs, info->offset, data_size,
+                               trace_iov_cb, NULL);
+}
@@ -0,0 +1,152 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+#ifndef VREND_TRACE_H
+#define VREND_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vrend_iov.h"
+
+/* Command stream capture.  When VIRGL_TRACE_FILE names a writable file
+   every call into the renderer that changes its state is appended to it,
+   so that the stream can be re-issued later by virgl_replay.  The trace
+   is written in host byte order:
+
+     struct vrend_trace_header
+     { struct vrend_trace_record, <size> bytes of payload }*
+
+   The payload of each record starts with the matching struct below,
+   followed by the variable sized data it describes. */
+
+#define VREND_TRACE_MAGIC   0x43525456 /* "VTRC" */
+#define VREND_TRACE_VERSION 1
+
+enum vrend_trace_type {
+   VREND_TRACE_CTX_CREATE = 1,
+   VREND_TRACE_CTX_DESTROY,
+   VREND_TRACE_RES_CREATE,
+   VREND_TRACE_RES_UNREF,
+   VREND_TRACE_RES_ATTACH_IOV,
+   VREND_TRACE_RES_DETACH_IOV,
+   VREND_TRACE_CTX_ATTACH_RES,
+   VREND_TRACE_CTX_DETACH_RES,
+   VREND_TRACE_SUBMIT_CMD,
+   VREND_TRACE_TRANSFER_WRITE,
+   VREND_TRACE_TRANSFER_READ,
+   VREND_TRACE_CREATE_FENCE,
+   VREND_TRACE_RESET,
+   VREND_TRACE_NUM_TYPES,
+};
+
+struct vrend_trace_header {
+   uint32_t magic;
+   uint32_t version;
+};
+
+struct vrend_trace_record {
+   uint32_t type;
+   uint32_t size;
+};
+
+/* followed by nlen bytes of name */
+struct vrend_trace_ctx_create {
+   uint32_t handle;
+   uint32_t nlen;
+};
+
+/* CTX_DESTROY, RES_UNREF and RES_DETACH_IOV */
+struct vrend_trace_handle {
+   uint32_t handle;
+};
+
+struct vrend_trace_res_create {
+   uint32_t handle;
+   uint32_t target;
+   uint32_t format;
+   uint32_t bind;
+   uint32_t width;
+   uint32_t height;
+   uint32_t depth;
+   uint32_t array_size;
+   uint32_t last_level;
+   uint32_t nr_samples;
+   uint32_t flags;
+   uint32_t iov_size;
+};
+
+struct vrend_trace_attach_iov {
+   uint32_t handle;
+   uint32_t iov_size;
+};
+
+/* CTX_ATTACH_RES and CTX_DETACH_RES */
+struct vrend_trace_ctx_res {
+   uint32_t ctx_id;
+   uint32_t handle;
+};
+
+/* followed by ndw command dwords */
+struct vrend_trace_submit_cmd {
+   uint32_t ctx_id;
+   uint32_t ndw;
+};
+
+/* For writes this is followed by data_size bytes that were read from the
+   backing store starting at offset, for reads data_size is the number of
+   bytes the renderer will write and no data follows. */
+struct vrend_trace_transfer {
+   uint32_t handle;
+   uint32_t ctx_id;
+   uint32_t level;
+   uint32_t stride;
+   uint32_t layer_stride;
+   uint32_t box[6];
+   uint32_t data_size;
+   uint64_t offset;
+};
+
+struct vrend_trace_fence {
+   uint32_t fence_id;
+   uint32_t ctx_id;
+};
+
+struct vrend_transfer_info;
+
+bool vrend_trace_init(const char *filename);
+void vrend_trace_fini(void);
+bool vrend_trace_enabled(void);
+
+void vrend_trace_record(enum vrend_trace_type type,
+                        const void *args, uint32_t args_size,
+                        const void *data, uint32_t data_size);
+
+/* data_size bytes of the transfer payload are taken from iov at
+   info->offset, iov is ignored for reads */
+void vrend_trace_transfer(enum vrend_trace_type type,
+                          const struct vrend_transfer_info *info,
+                          const struct iovec *iov, int num_iovs,
+                          uint32_t data_size);
+
+#endif
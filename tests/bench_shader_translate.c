@@ -0,0 +1,372 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Translate TGSI text dumps to GLSL without a GL context, over a matrix
+ * of shader configs and keys, and report the translator throughput,
+ * per shader latency and peak heap usage.
+ *
+ * usage: bench_shader_translate [-n iterations] [-o glsl_out_dir] [tgsi_dir]
+ *
+ * Without a directory the built-in large shader is used. The exit code is
+ * non-zero when any translation fails, and -o writes the generated GLSL so
+ * the output of two builds can be diffed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+#include "pipe/p_shader_tokens.h"
+#include "tgsi/tgsi_text.h"
+#include "vrend_shader.h"
+
+#include "large_shader.h"
+
+/* referenced by the translator, normally lives in vrend_renderer.c */
+int vrend_dump_shaders;
+
+/* heap accounting, the allocation functions are wrapped at link time */
+static size_t heap_cur, heap_peak;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+char *__real_strdup(const char *s);
+
+static void heap_add(void *ptr)
+{
+   if (!ptr)
+      return;
+   heap_cur += malloc_usable_size(ptr);
+   if (heap_cur > heap_peak)
+      heap_peak = heap_cur;
+}
+
+static void heap_sub(void *ptr)
+{
+   size_t size;
+
+   if (!ptr)
+      return;
+   size = malloc_usable_size(ptr);
+   heap_cur = heap_cur > size ? heap_cur - size : 0;
+}
+
+void *__wrap_malloc(size_t size)
+{
+   void *ptr = __real_malloc(size);
+   heap_add(ptr);
+   return ptr;
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+   void *ptr = __real_calloc(nmemb, size);
+   heap_add(ptr);
+   return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+   void *new_ptr;
+
+   heap_sub(ptr);
+   new_ptr = __real_realloc(ptr, size);
+   heap_add(new_ptr ? new_ptr : ptr);
+   return new_ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+   heap_sub(ptr);
+   __real_free(ptr);
+}
+
+char *__wrap_strdup(const char *s)
+{
+   char *ptr = __real_strdup(s);
+   heap_add(ptr);
+   return ptr;
+}
+
+struct bench_cfg {
+   const char *name;
+   struct vrend_shader_cfg cfg;
+};
+
+static const struct bench_cfg cfgs[] = {
+   { "gl130", { .glsl_version = 130 } },
+   { "core140", { .glsl_version = 140, .use_core_profile = true } },
+   { "core150", { .glsl_version = 150, .use_core_profile = true, .use_explicit_locations = true } },
+   { "core330", { .glsl_version = 330, .use_core_profile = true, .use_explicit_locations = true } },
+   { "gles300", { .glsl_version = 300, .use_gles = true, .use_core_profile = true } },
+};
+
+struct bench_key {
+   const char *name;
+   struct vrend_shader_key key;
+};
+
+static const struct bench_key keys[] = {
+   { "default", { .invert_fs_origin = true } },
+   { "alpha", { .add_alpha_test = true, .alpha_test = PIPE_FUNC_GREATER, .alpha_ref_val = 0.5f } },
+   { "stipple", { .pstipple_tex = true, .flatshade = true } },
+   { "twoside", { .color_two_side = true, .clip_plane_enable = 0xff } },
+   { "gs", { .gs_present = true, .coord_replace = 0xff, .cbufs_are_a8_bitmask = 1 } },
+};
+
+struct bench_shader {
+   char *name;
+   char *text;
+   struct tgsi_token *tokens;
+   size_t num_tokens;
+};
+
+static double now_us(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+   double da = *(const double *)a, db = *(const double *)b;
+   return da < db ? -1 : da > db;
+}
+
+static char *read_file(const char *path)
+{
+   FILE *fp;
+   char *buf;
+   long len;
+
+   fp = fopen(path, "rb");
+   if (!fp)
+      return NULL;
+   fseek(fp, 0, SEEK_END);
+   len = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+   buf = malloc(len + 1);
+   if (buf && fread(buf, 1, len, fp) != (size_t)len) {
+      free(buf);
+      buf = NULL;
+   }
+   if (buf)
+      buf[len] = '\0';
+   fclose(fp);
+   return buf;
+}
+
+static int load_shaders(const char *dirname, struct bench_shader **shaders)
+{
+   struct dirent **names;
+   struct stat st;
+   char path[4096];
+   int n, i, count = 0;
+
+   n = scandir(dirname, &names, NULL, alphasort);
+   if (n < 0) {
+      fprintf(stderr, "cannot read %s: %s\n", dirname, strerror(errno));
+      return -1;
+   }
+
+   *shaders = calloc(n, sizeof(struct bench_shader));
+   for (i = 0; i < n; i++) {
+      snprintf(path, sizeof(path), "%s/%s", dirname, names[i]->d_name);
+      if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+         (*shaders)[count].text = read_file(path);
+         if ((*shaders)[count].text)
+            (*shaders)[count++].name = strdup(names[i]->d_name);
+      }
+      free(names[i]);
+   }
+   free(names);
+   return count;
+}
+
+static void free_sinfo(struct vrend_shader_info *sinfo)
+{
+   int i;
+
+   if (sinfo->so_names)
+      for (i = 0; i < sinfo->so_info.num_outputs; i++)
+         free(sinfo->so_names[i]);
+   free(sinfo->so_names);
+   free(sinfo->interpinfo);
+   free(sinfo->sampler_arrays);
+}
+
+static void write_glsl(const char *outdir, const struct bench_shader *shader,
+                       const struct bench_cfg *cfg, const struct bench_key *key,
+                       const char *glsl)
+{
+   char path[4096];
+   FILE *fp;
+
+   snprintf(path, sizeof(path), "%s/%s.%s.%s.glsl", outdir, shader->name,
+            cfg->name, key->name);
+   fp = fopen(path, "w");
+   if (!fp) {
+      fprintf(stderr, "cannot write %s: %s\n", path, strerror(errno));
+      return;
+   }
+   fputs(glsl, fp);
+   fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+   struct bench_shader *shaders;
+   const char *outdir = NULL;
+   int num_shaders, iterations = 10;
+   int num_cfgs = sizeof(cfgs) / sizeof(cfgs[0]);
+   int num_keys = sizeof(keys) / sizeof(keys[0]);
+   double *lat, parse_us = 0, convert_us = 0;
+   size_t num_lat = 0, glsl_bytes = 0, tgsi_bytes = 0;
+   int failures = 0;
+   int opt, s, c, k, it;
+
+   while ((opt = getopt(argc, argv, "n:o:")) != -1) {
+      switch (opt) {
+      case 'n':
+         iterations = atoi(optarg);
+         break;
+      case 'o':
+         outdir = optarg;
+         break;
+      default:
+         fprintf(stderr, "usage: %s [-n iterations] [-o glsl_out_dir] [tgsi_dir]\n", argv[0]);
+         return EXIT_FAILURE;
+      }
+   }
+   if (iterations < 1)
+      iterations = 1;
+
+   if (optind < argc) {
+      num_shaders = load_shaders(argv[optind], &shaders);
+      if (num_shaders <= 0) {
+         fprintf(stderr, "no shaders found in %s\n", argv[optind]);
+         return EXIT_FAILURE;
+      }
+   } else {
+      num_shaders = 1;
+      shaders = calloc(1, sizeof(struct bench_shader));
+      shaders[0].name = strdup("large_frag");
+      shaders[0].text = strdup(large_frag);
+   }
+
+   lat = calloc((size_t)num_shaders * num_cfgs * num_keys * iterations, sizeof(double));
+   if (!lat)
+      return EXIT_FAILURE;
+
+   for (s = 0; s < num_shaders; s++) {
+      /* each token takes at least one character of text */
+      shaders[s].num_tokens = strlen(shaders[s].text) + 64;
+      shaders[s].tokens = calloc(shaders[s].num_tokens, sizeof(struct tgsi_token));
+      tgsi_bytes += strlen(shaders[s].text);
+   }
+
+   heap_cur = heap_peak = 0;
+   for (it = 0; it < iterations; it++) {
+      for (s = 0; s < num_shaders; s++) {
+         struct bench_shader *shader = &shaders[s];
+         double t0, t1;
+
+         t0 = now_us();
+         if (!tgsi_text_translate(shader->text, shader->tokens, shader->num_tokens)) {
+            if (it == 0) {
+               fprintf(stderr, "%s: failed to parse TGSI\n", shader->name);
+               failures++;
+            }
+            continue;
+         }
+         t1 = now_us();
+         parse_us += t1 - t0;
+
+         for (c = 0; c < num_cfgs; c++) {
+            for (k = 0; k < num_keys; k++) {
+               struct vrend_shader_cfg cfg = cfgs[c].cfg;
+               struct vrend_shader_key key = keys[k].key;
+               struct vrend_shader_info sinfo;
+               double start;
+               char *glsl;
+
+               memset(&sinfo, 0, sizeof(sinfo));
+               start = now_us();
+               glsl = vrend_convert_shader(&cfg, shader->tokens, &key, &sinfo);
+               t1 = now_us();
+               convert_us += t1 - start;
+               lat[num_lat++] = t1 - start;
+
+               if (!glsl) {
+                  if (it == 0) {
+                     fprintf(stderr, "%s: translation failed for %s/%s\n",
+                             shader->name, cfgs[c].name, keys[k].name);
+                     failures++;
+                  }
+               } else {
+                  glsl_bytes += strlen(glsl);
+                  if (it == 0 && outdir)
+                     write_glsl(outdir, shader, &cfgs[c], &keys[k], glsl);
+               }
+               free(glsl);
+               free_sinfo(&sinfo);
+            }
+         }
+      }
+   }
+
+   qsort(lat, num_lat, sizeof(double), cmp_double);
+
+   printf("shaders: %d, configs: %d, keys: %d, iterations: %d\n",
+          num_shaders, num_cfgs, num_keys, iterations);
+   printf("tgsi parse:  %10.1f ms total, %8.2f MB/s\n", parse_us / 1e3,
+          parse_us > 0 ? tgsi_bytes * (double)iterations / parse_us : 0.0);
+   printf("translation: %10.1f ms total, %8.1f shaders/s, %8.2f MB/s GLSL\n",
+          convert_us / 1e3, convert_us > 0 ? num_lat / (convert_us / 1e6) : 0.0,
+          convert_us > 0 ? glsl_bytes / convert_us : 0.0);
+   if (num_lat)
+      printf("latency us:  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+             lat[num_lat / 2], lat[num_lat * 9 / 10], lat[num_lat * 99 / 100],
+             lat[num_lat - 1]);
+   printf("peak heap:   %zu KiB\n", heap_peak / 1024);
+   printf("failures:    %d\n", failures);
+
+   for (s = 0; s < num_shaders; s++) {
+      free(shaders[s].name);
+      free(shaders[s].text);
+      free(shaders[s].tokens);
+   }
+   free(shaders);
+   free(lat);
+   return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
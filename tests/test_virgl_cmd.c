@@ -33,6 +33,9 @@
 #include "virgl_protocol.h"
 #include "util/u_memory.h"
 
+#include "pipe/p_shader_tokens.h"
+#include "tgsi/tgsi_text.h"
+#include "tgsi/tgsi_parse.h"
 #include "large_shader.h"
 /* test creating objects with same ID causes context err */
 START_TEST(virgl_test_overlap_obj_id)
@@ -1014,6 +1017,551 @@ START_TEST(virgl_test_large_shader)
 }
 END_TEST
 
+/* draw a full screen triangle with the large fragment shader, either
+ * sent as text or as binary tokens, and read back what it rendered */
+static void render_large_shader(bool use_tokens, int tw, int th, uint32_t *pixels)
+{
+   static const float tri[3][4] = {
+      { -1.0, -1.0, 0.0, 1.0 },
+      {  3.0, -1.0, 0.0, 1.0 },
+      { -1.0,  3.0, 0.0, 1.0 },
+   };
+   struct virgl_context ctx;
+   struct virgl_resource res;
+   struct virgl_resource vbo;
+   struct virgl_surface surf;
+   struct pipe_framebuffer_state fb_state;
+   struct pipe_vertex_element ve;
+   struct pipe_vertex_buffer vbuf;
+   struct pipe_shader_state vs, fs;
+   struct pipe_blend_state blend;
+   struct pipe_depth_stencil_alpha_state dsa;
+   struct pipe_rasterizer_state rasterizer;
+   struct pipe_viewport_state vp;
+   struct pipe_draw_info info;
+   union pipe_color_union color;
+   struct virgl_box box;
+   struct tgsi_token *tokens = NULL;
+   int num_tokens = strlen(large_frag);
+   int ctx_handle = 1;
+   int ret;
+
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+
+   ret = testvirgl_create_backed_simple_2d_res(&res, 1, tw, th);
+   ck_assert_int_eq(ret, 0);
+   virgl_renderer_ctx_attach_resource(ctx.ctx_id, res.handle);
+
+   memset(&surf, 0, sizeof(surf));
+   surf.base.format = PIPE_FORMAT_B8G8R8X8_UNORM;
+   surf.handle = ctx_handle++;
+   surf.base.texture = &res.base;
+   virgl_encoder_create_surface(&ctx, surf.handle, &res, &surf.base);
+
+   fb_state.nr_cbufs = 1;
+   fb_state.zsbuf = NULL;
+   fb_state.cbufs[0] = &surf.base;
+   virgl_encoder_set_framebuffer_state(&ctx, &fb_state);
+
+   /* something the shader is unlikely to produce */
+   color.f[0] = 0.25;
+   color.f[1] = 0.5;
+   color.f[2] = 0.75;
+   color.f[3] = 1.0;
+   virgl_encode_clear(&ctx, PIPE_CLEAR_COLOR0, &color, 0.0, 0);
+
+   memset(&ve, 0, sizeof(ve));
+   ve.src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   virgl_encoder_create_vertex_elements(&ctx, ctx_handle, 1, &ve);
+   virgl_encode_bind_object(&ctx, ctx_handle++, VIRGL_OBJECT_VERTEX_ELEMENTS);
+
+   ret = testvirgl_create_backed_simple_buffer(&vbo, 2, sizeof(tri), PIPE_BIND_VERTEX_BUFFER);
+   ck_assert_int_eq(ret, 0);
+   virgl_renderer_ctx_attach_resource(ctx.ctx_id, vbo.handle);
+
+   box.x = 0;
+   box.y = 0;
+   box.z = 0;
+   box.w = sizeof(tri);
+   box.h = 1;
+   box.d = 1;
+   virgl_encoder_inline_write(&ctx, &vbo, 0, 0, (struct pipe_box *)&box, tri, box.w, 0);
+
+   vbuf.stride = sizeof(tri[0]);
+   vbuf.buffer_offset = 0;
+   vbuf.buffer = &vbo.base;
+   virgl_encoder_set_vertex_buffers(&ctx, 1, &vbuf);
+
+   memset(&vs, 0, sizeof(vs));
+   virgl_encode_shader_state(&ctx, ctx_handle, PIPE_SHADER_VERTEX, &vs,
+                             "VERT\n"
+                             "DCL IN[0]\n"
+                             "DCL OUT[0], POSITION\n"
+                             "  0: MOV OUT[0], IN[0]\n"
+                             "  1: END\n");
+   virgl_encode_bind_shader(&ctx, ctx_handle++, PIPE_SHADER_VERTEX);
+
+   memset(&fs, 0, sizeof(fs));
+   if (use_tokens) {
+      tokens = calloc(num_tokens, sizeof(struct tgsi_token));
+      ck_assert(tgsi_text_translate(large_frag, tokens, num_tokens));
+      fs.tokens = tokens;
+      virgl_encode_shader_tokens(&ctx, ctx_handle, PIPE_SHADER_FRAGMENT, &fs);
+   } else {
+      virgl_encode_shader_state(&ctx, ctx_handle, PIPE_SHADER_FRAGMENT, &fs,
+                                large_frag);
+   }
+   virgl_encode_bind_shader(&ctx, ctx_handle++, PIPE_SHADER_FRAGMENT);
+
+   memset(&blend, 0, sizeof(blend));
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   virgl_encode_blend_state(&ctx, ctx_handle, &blend);
+   virgl_encode_bind_object(&ctx, ctx_handle++, VIRGL_OBJECT_BLEND);
+
+   memset(&dsa, 0, sizeof(dsa));
+   virgl_encode_dsa_state(&ctx, ctx_handle, &dsa);
+   virgl_encode_bind_object(&ctx, ctx_handle++, VIRGL_OBJECT_DSA);
+
+   memset(&rasterizer, 0, sizeof(rasterizer));
+   rasterizer.cull_face = PIPE_FACE_NONE;
+   rasterizer.half_pixel_center = 1;
+   rasterizer.bottom_edge_rule = 1;
+   rasterizer.depth_clip = 1;
+   virgl_encode_rasterizer_state(&ctx, ctx_handle, &rasterizer);
+   virgl_encode_bind_object(&ctx, ctx_handle++, VIRGL_OBJECT_RASTERIZER);
+
+   vp.scale[0] = tw / 2.0f;
+   vp.scale[1] = th / 2.0f;
+   vp.scale[2] = 0.5f;
+   vp.translate[0] = tw / 2.0f;
+   vp.translate[1] = th / 2.0f;
+   vp.translate[2] = 0.5f;
+   virgl_encoder_set_viewport_states(&ctx, 0, 1, &vp);
+
+   memset(&info, 0, sizeof(info));
+   info.count = 3;
+   info.mode = PIPE_PRIM_TRIANGLES;
+   virgl_encoder_draw_vbo(&ctx, &info);
+
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+
+   box.x = 0;
+   box.y = 0;
+   box.z = 0;
+   box.w = tw;
+   box.h = th;
+   box.d = 1;
+   ret = virgl_renderer_transfer_read_iov(res.handle, ctx.ctx_id, 0, 0, 0, &box, 0, NULL, 0);
+   ck_assert_int_eq(ret, 0);
+   memcpy(pixels, res.iovs[0].iov_base, tw * th * 4);
+
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, res.handle);
+   testvirgl_destroy_backed_res(&vbo);
+   testvirgl_destroy_backed_res(&res);
+   free(tokens);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+}
+
+/* send the large shader as text and as binary tokens */
+START_TEST(virgl_test_large_shader_tokens)
+{
+   int ret;
+   struct virgl_context ctx;
+   struct pipe_shader_state fs;
+   struct tgsi_token *tokens;
+   union virgl_caps *caps;
+   uint32_t max_ver, max_size;
+   int num_tokens = strlen(large_frag);
+   int tw = 64, th = 64;
+   uint32_t *text_pixels, *token_pixels;
+
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+
+   virgl_renderer_get_cap_set(2, &max_ver, &max_size);
+   ck_assert_int_ge(max_size, sizeof(struct virgl_caps_v2));
+   caps = calloc(1, max_size);
+   virgl_renderer_fill_caps(2, max_ver, caps);
+   ck_assert(caps->v2.capability_bits_v2 & VIRGL_CAP_V2_TGSI_TOKENS);
+   free(caps);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+
+   /* both paths have to end up as the same shader */
+   text_pixels = calloc(tw * th, 4);
+   token_pixels = calloc(tw * th, 4);
+   render_large_shader(false, tw, th, text_pixels);
+   render_large_shader(true, tw, th, token_pixels);
+   ck_assert(memcmp(text_pixels, token_pixels, tw * th * 4) == 0);
+   free(text_pixels);
+   free(token_pixels);
+
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+
+   tokens = calloc(num_tokens, sizeof(struct tgsi_token));
+   ck_assert(tgsi_text_translate(large_frag, tokens, num_tokens));
+
+   memset(&fs, 0, sizeof(fs));
+   fs.tokens = tokens;
+
+   /* tokens for a different stage than the object must be rejected */
+   virgl_encode_shader_tokens(&ctx, 3, PIPE_SHADER_VERTEX, &fs);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, EINVAL);
+   ctx.cbuf->cdw = 0;
+
+   /* and so must a body that runs into garbage */
+   ((struct tgsi_header *)tokens)->BodySize += 16;
+   virgl_encode_shader_tokens(&ctx, 4, PIPE_SHADER_FRAGMENT, &fs);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, EINVAL);
+   ctx.cbuf->cdw = 0;
+
+   free(tokens);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+}
+END_TEST
+
+/* emit one packet of a shader that is sent in pieces */
+static void encode_shader_part(struct virgl_context *ctx, uint32_t handle,
+                               uint32_t type, uint32_t offlen,
+                               uint32_t num_tokens,
+                               const void *data, uint32_t ndw)
+{
+   virgl_encoder_write_dword(ctx->cbuf, VIRGL_CMD0(VIRGL_CCMD_CREATE_OBJECT,
+                                                   VIRGL_OBJECT_SHADER, 5 + ndw));
+   virgl_encoder_write_dword(ctx->cbuf, handle);
+   virgl_encoder_write_dword(ctx->cbuf, type);
+   virgl_encoder_write_dword(ctx->cbuf, offlen);
+   virgl_encoder_write_dword(ctx->cbuf, num_tokens);
+   virgl_encoder_write_dword(ctx->cbuf, 0);
+   virgl_encoder_write_block(ctx->cbuf, data, ndw * 4);
+}
+
+/* a shader sent in pieces has to keep the encoding of its first packet */
+START_TEST(virgl_test_shader_mixed_continuation)
+{
+   static const char text[] =
+      "FRAG\n"
+      "DCL IN[0], COLOR, LINEAR\n"
+      "DCL OUT[0], COLOR\n"
+      "  0: MOV OUT[0], IN[0]\n"
+      "  1: END\n";
+   uint32_t buf[64];
+   struct tgsi_token tokens[64];
+   struct virgl_context ctx;
+   uint32_t tok_type = PIPE_SHADER_FRAGMENT | VIRGL_OBJ_SHADER_TYPE_TOKENS;
+   uint32_t text_size = (sizeof(text) + 3) & ~3;
+   uint32_t num_tokens, size;
+   int ret;
+
+   ck_assert(tgsi_text_translate(text, tokens, 64));
+   num_tokens = tgsi_num_tokens(tokens);
+   size = num_tokens * 4;
+   ck_assert_int_gt(num_tokens, 4);
+
+   /* split in two, both as tokens */
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+   encode_shader_part(&ctx, 1, tok_type, VIRGL_OBJ_SHADER_OFFSET_VAL(size),
+                      num_tokens, tokens, 4);
+   encode_shader_part(&ctx, 1, tok_type,
+                      VIRGL_OBJ_SHADER_OFFSET_VAL(16) | VIRGL_OBJ_SHADER_OFFSET_CONT,
+                      num_tokens, tokens + 4, num_tokens - 4);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+
+   /* tokens continued as text */
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+   encode_shader_part(&ctx, 1, tok_type, VIRGL_OBJ_SHADER_OFFSET_VAL(size),
+                      num_tokens, tokens, 4);
+   encode_shader_part(&ctx, 1, PIPE_SHADER_FRAGMENT,
+                      VIRGL_OBJ_SHADER_OFFSET_VAL(16) | VIRGL_OBJ_SHADER_OFFSET_CONT,
+                      num_tokens, tokens + 4, num_tokens - 4);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, EINVAL);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+
+   /* text continued as tokens */
+   memset(buf, 0, sizeof(buf));
+   memcpy(buf, text, sizeof(text));
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+   encode_shader_part(&ctx, 1, PIPE_SHADER_FRAGMENT,
+                      VIRGL_OBJ_SHADER_OFFSET_VAL(sizeof(text)),
+                      300, buf, 4);
+   encode_shader_part(&ctx, 1, tok_type,
+                      VIRGL_OBJ_SHADER_OFFSET_VAL(16) | VIRGL_OBJ_SHADER_OFFSET_CONT,
+                      300, buf + 4, text_size / 4 - 4);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, EINVAL);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+}
+END_TEST
+
+START_TEST(virgl_test_decode_stats)
+{
+   struct virgl_context ctx;
+   struct virgl_resource res;
+   struct virgl_surface surf;
+   struct pipe_framebuffer_state fb_state;
+   union pipe_color_union color;
+   struct virgl_renderer_stats *stats;
+   uint64_t sum = 0;
+   int ret;
+   int i;
+
+   stats = calloc(1, sizeof(*stats));
+   ck_assert_ptr_ne(stats, NULL);
+
+   /* statistics are not collected unless asked for */
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+   ret = virgl_renderer_get_stats(ctx.ctx_id, stats);
+   ck_assert_int_eq(ret, EINVAL);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+
+   setenv("VIRGL_DECODE_STATS", "1", 1);
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+
+   ret = testvirgl_create_backed_simple_2d_res(&res, 1, 50, 50);
+   ck_assert_int_eq(ret, 0);
+   virgl_renderer_ctx_attach_resource(ctx.ctx_id, res.handle);
+
+   memset(&surf, 0, sizeof(surf));
+   surf.base.format = PIPE_FORMAT_B8G8R8X8_UNORM;
+   surf.handle = 1;
+   surf.base.texture = &res.base;
+   virgl_encoder_create_surface(&ctx, surf.handle, &res, &surf.base);
+
+   fb_state.nr_cbufs = 1;
+   fb_state.zsbuf = NULL;
+   fb_state.cbufs[0] = &surf.base;
+   virgl_encoder_set_framebuffer_state(&ctx, &fb_state);
+
+   memset(&color, 0, sizeof(color));
+   virgl_encode_clear(&ctx, PIPE_CLEAR_COLOR0, &color, 0.0, 0);
+   virgl_encode_clear(&ctx, PIPE_CLEAR_COLOR0, &color, 0.0, 0);
+
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+
+   ret = virgl_renderer_get_stats(ctx.ctx_id, stats);
+   ck_assert_int_eq(ret, 0);
+   ck_assert_int_eq(stats->cmds[VIRGL_CCMD_CREATE_OBJECT].count, 1);
+   ck_assert_int_eq(stats->objects[VIRGL_OBJECT_SURFACE].count, 1);
+   ck_assert_int_eq(stats->cmds[VIRGL_CCMD_SET_FRAMEBUFFER_STATE].count, 1);
+   ck_assert_int_eq(stats->cmds[VIRGL_CCMD_CLEAR].count, 2);
+
+   for (i = 0; i < VIRGL_RENDERER_STATS_BUCKETS; i++)
+      sum += stats->cmds[VIRGL_CCMD_CLEAR].histogram[i];
+   ck_assert_int_eq(sum, 2);
+
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, res.handle);
+   testvirgl_destroy_backed_res(&res);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+   unsetenv("VIRGL_DECODE_STATS");
+   free(stats);
+}
+END_TEST
+
+START_TEST(virgl_test_redundant_state)
+{
+   struct virgl_context ctx;
+   struct virgl_renderer_stats *stats;
+   struct pipe_blend_color color = {{ 0.0, 0.5, 1.0, 1.0 }};
+   struct pipe_stencil_ref ref = {{ 1, 2 }};
+   int ret;
+
+   stats = calloc(1, sizeof(*stats));
+   ck_assert_ptr_ne(stats, NULL);
+
+   setenv("VIRGL_DECODE_STATS", "1", 1);
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+
+   /* the second blend color and the third stencil ref repeat the state */
+   virgl_encoder_set_blend_color(&ctx, &color);
+   virgl_encoder_set_blend_color(&ctx, &color);
+   virgl_encoder_set_stencil_ref(&ctx, &ref);
+   ref.ref_value[1] = 3;
+   virgl_encoder_set_stencil_ref(&ctx, &ref);
+   virgl_encoder_set_stencil_ref(&ctx, &ref);
+   virgl_encoder_set_sample_mask(&ctx, 0xf);
+
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+   ctx.cbuf->cdw = 0;
+
+   /* a new sub context starts without any shadowed state */
+   virgl_encoder_create_sub_ctx(&ctx, 2);
+   virgl_encoder_set_sub_ctx(&ctx, 2);
+   virgl_encoder_set_blend_color(&ctx, &color);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+
+   ret = virgl_renderer_get_stats(ctx.ctx_id, stats);
+   ck_assert_int_eq(ret, 0);
+   ck_assert_int_eq(stats->cmds[VIRGL_CCMD_SET_BLEND_COLOR].count, 3);
+   ck_assert_int_eq(stats->cmds[VIRGL_CCMD_SET_BLEND_COLOR].elided, 1);
+   ck_assert_int_eq(stats->cmds[VIRGL_CCMD_SET_STENCIL_REF].count, 3);
+   ck_assert_int_eq(stats->cmds[VIRGL_CCMD_SET_STENCIL_REF].elided, 1);
+   ck_assert_int_eq(stats->cmds[VIRGL_CCMD_SET_SAMPLE_MASK].elided, 0);
+
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+   unsetenv("VIRGL_DECODE_STATS");
+   free(stats);
+}
+END_TEST
+
+START_TEST(virgl_test_rasterizer_diff)
+{
+   struct virgl_context ctx;
+   struct virgl_renderer_stats *stats;
+   struct pipe_rasterizer_state rs_a, rs_b;
+   uint64_t full_calls, toggle_calls;
+   int ret;
+   int i;
+
+   stats = calloc(1, sizeof(*stats));
+   ck_assert_ptr_ne(stats, NULL);
+
+   setenv("VIRGL_DECODE_STATS", "1", 1);
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+
+   /* two states that differ in the culled face and line width only */
+   memset(&rs_a, 0, sizeof(rs_a));
+   rs_a.cull_face = PIPE_FACE_BACK;
+   rs_a.line_width = 1.0f;
+   rs_a.depth_clip = 1;
+   rs_b = rs_a;
+   rs_b.cull_face = PIPE_FACE_FRONT;
+   rs_b.line_width = 2.0f;
+
+   virgl_encode_rasterizer_state(&ctx, 1, &rs_a);
+   virgl_encode_rasterizer_state(&ctx, 2, &rs_b);
+   virgl_encode_bind_object(&ctx, 1, VIRGL_OBJECT_RASTERIZER);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+   ctx.cbuf->cdw = 0;
+
+   /* the first bind sets up everything */
+   ret = virgl_renderer_get_stats(ctx.ctx_id, stats);
+   ck_assert_int_eq(ret, 0);
+   ck_assert_int_eq(stats->rs_emits, 1);
+   full_calls = stats->rs_gl_calls;
+   ck_assert(full_calls > 0);
+
+   /* binding the same state again doesn't touch GL */
+   virgl_encode_bind_object(&ctx, 1, VIRGL_OBJECT_RASTERIZER);
+   virgl_encode_bind_object(&ctx, 2, VIRGL_OBJECT_RASTERIZER);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+   ctx.cbuf->cdw = 0;
+
+   ret = virgl_renderer_get_stats(ctx.ctx_id, stats);
+   ck_assert_int_eq(ret, 0);
+   toggle_calls = stats->rs_gl_calls - full_calls;
+   ck_assert(toggle_calls > 0);
+   ck_assert(toggle_calls < full_calls);
+
+   /* every further toggle costs the same few calls */
+   for (i = 0; i < 8; i++)
+      virgl_encode_bind_object(&ctx, i & 1 ? 2 : 1, VIRGL_OBJECT_RASTERIZER);
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+
+   ret = virgl_renderer_get_stats(ctx.ctx_id, stats);
+   ck_assert_int_eq(ret, 0);
+   ck_assert_int_eq(stats->rs_emits, 11);
+   ck_assert_int_eq(stats->rs_gl_calls, full_calls + 9 * toggle_calls);
+
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+   unsetenv("VIRGL_DECODE_STATS");
+   free(stats);
+}
+END_TEST
+
+/* the read lands in the backing once a later fence has been written */
+START_TEST(virgl_test_async_readback)
+{
+    struct virgl_context ctx;
+    struct virgl_resource res;
+    struct virgl_surface surf;
+    struct pipe_framebuffer_state fb_state;
+    union pipe_color_union color;
+    struct virgl_box box;
+    int ret;
+    int i;
+
+    ret = testvirgl_init_ctx_cmdbuf_flags(&ctx, VIRGL_RENDERER_ASYNC_READBACK);
+    ck_assert_int_eq(ret, 0);
+
+    ret = testvirgl_create_backed_simple_2d_res(&res, 1, 50, 50);
+    ck_assert_int_eq(ret, 0);
+
+    virgl_renderer_ctx_attach_resource(ctx.ctx_id, res.handle);
+
+    memset(&surf, 0, sizeof(surf));
+    surf.base.format = PIPE_FORMAT_B8G8R8X8_UNORM;
+    surf.handle = 1;
+    surf.base.texture = &res.base;
+
+    virgl_encoder_create_surface(&ctx, surf.handle, &res, &surf.base);
+
+    fb_state.nr_cbufs = 1;
+    fb_state.zsbuf = NULL;
+    fb_state.cbufs[0] = &surf.base;
+    virgl_encoder_set_framebuffer_state(&ctx, &fb_state);
+
+    /* clear buffer to green */
+    color.f[0] = 0.0;
+    color.f[1] = 1.0;
+    color.f[2] = 0.0;
+    color.f[3] = 1.0;
+    virgl_encode_clear(&ctx, PIPE_CLEAR_COLOR0, &color, 0.0, 0);
+
+    virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+
+    box.x = 0;
+    box.y = 0;
+    box.z = 0;
+    box.w = 5;
+    box.h = 1;
+    box.d = 1;
+    ret = virgl_renderer_transfer_read_iov(res.handle, ctx.ctx_id, 0, 50, 0, &box, 0, NULL, 0);
+    ck_assert_int_eq(ret, 0);
+
+    testvirgl_reset_fence();
+    ret = virgl_renderer_create_fence(1, ctx.ctx_id);
+    ck_assert_int_eq(ret, 0);
+
+    do {
+	virgl_renderer_poll();
+	if (testvirgl_get_last_fence() >= 1)
+	    break;
+	nanosleep((struct timespec[]){{0, 50000}}, NULL);
+    } while(1);
+
+    for (i = 0; i < 5; i++) {
+	uint32_t *ptr = res.iovs[0].iov_base;
+	ck_assert_int_eq(ptr[i], 0xff00ff00);
+    }
+
+    virgl_renderer_ctx_detach_resource(ctx.ctx_id, res.handle);
+
+    testvirgl_destroy_backed_res(&res);
+
+    testvirgl_fini_ctx_cmdbuf(&ctx);
+}
+END_TEST
+
 static Suite *virgl_init_suite(void)
 {
   Suite *s;
@@ -1025,6 +1573,12 @@ static Suite *virgl_init_suite(void)
   tcase_add_test(tc_core, virgl_test_blit_simple);
   tcase_add_test(tc_core, virgl_test_overlap_obj_id);
   tcase_add_test(tc_core, virgl_test_large_shader);
+  tcase_add_test(tc_core, virgl_test_large_shader_tokens);
+  tcase_add_test(tc_core, virgl_test_shader_mixed_continuation);
+  tcase_add_test(tc_core, virgl_test_decode_stats);
+  tcase_add_test(tc_core, virgl_test_redundant_state);
+  tcase_add_test(tc_core, virgl_test_rasterizer_diff);
+  tcase_add_test(tc_core, virgl_test_async_readback);
   tcase_add_test(tc_core, virgl_test_render_simple);
   tcase_add_test(tc_core, virgl_test_render_geom_simple);
   tcase_add_test(tc_core, virgl_test_render_xfb);
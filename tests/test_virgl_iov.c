@@ -0,0 +1,357 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* iovec helper tests, these run without a renderer */
+#include <check.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vrend_iov.h"
+
+#define BACKING_SIZE 256
+
+struct upload_data {
+  unsigned char dst[BACKING_SIZE];
+  unsigned dst_x;
+  int calls;
+};
+
+/* what iov_buffer_upload does, with the array standing in for the buffer */
+static void upload_cb(void *cookie, unsigned int doff, void *src, int len)
+{
+  struct upload_data *d = cookie;
+
+  ck_assert_int_le(d->dst_x + doff + len, BACKING_SIZE);
+  memcpy(d->dst + d->dst_x + doff, src, len);
+  d->calls++;
+}
+
+/* split the backing at uneven sizes, with an empty iov in the middle */
+static int init_iovs(struct iovec *iovs, unsigned char *backing)
+{
+  static const size_t sizes[] = { 100, 37, 0, 64, 55 };
+  size_t pos = 0;
+  unsigned i;
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    iovs[i].iov_base = backing + pos;
+    iovs[i].iov_len = sizes[i];
+    pos += sizes[i];
+  }
+  ck_assert_int_eq(pos, BACKING_SIZE);
+  return i;
+}
+
+/* uploading a multi-iov buffer from a nonzero offset has to hand each piece
+ * to the callback with its offset from the start of the upload */
+START_TEST(virgl_test_iov_read_cb_offset)
+{
+  unsigned char backing[BACKING_SIZE];
+  struct iovec iovs[5];
+  struct upload_data d;
+  int niovs, i;
+  size_t offset, count, ret;
+
+  for (i = 0; i < BACKING_SIZE; i++)
+    backing[i] = i;
+  niovs = init_iovs(iovs, backing);
+
+  for (offset = 0; offset < BACKING_SIZE; offset += 7) {
+    for (count = 1; offset + count <= BACKING_SIZE; count += 13) {
+      memset(&d, 0, sizeof(d));
+      d.dst_x = BACKING_SIZE - count;
+
+      ret = vrend_read_from_iovec_cb(iovs, niovs, offset, count, upload_cb, &d);
+      ck_assert_int_eq(ret, count);
+      ck_assert(memcmp(d.dst + d.dst_x, backing + offset, count) == 0);
+      for (i = 0; i < (int)d.dst_x; i++)
+        ck_assert_int_eq(d.dst[i], 0);
+    }
+  }
+}
+END_TEST
+
+/* a read that starts and ends in the same iov is a single piece */
+START_TEST(virgl_test_iov_read_cb_single_piece)
+{
+  unsigned char backing[BACKING_SIZE];
+  struct iovec iovs[5];
+  struct upload_data d;
+  int niovs;
+  size_t ret;
+
+  memset(backing, 0xaa, sizeof(backing));
+  niovs = init_iovs(iovs, backing);
+
+  memset(&d, 0, sizeof(d));
+  ret = vrend_read_from_iovec_cb(iovs, niovs, 110, 20, upload_cb, &d);
+  ck_assert_int_eq(ret, 20);
+  ck_assert_int_eq(d.calls, 1);
+
+  /* 137..200 is the iov after the empty one */
+  memset(&d, 0, sizeof(d));
+  ret = vrend_read_from_iovec_cb(iovs, niovs, 130, 20, upload_cb, &d);
+  ck_assert_int_eq(ret, 20);
+  ck_assert_int_eq(d.calls, 2);
+}
+END_TEST
+
+/* split size bytes of mem into at most max_iovs iovs of random length,
+ * empty ones included */
+static int random_iovs(struct iovec *iovs, int max_iovs,
+                       unsigned char *mem, size_t size)
+{
+  size_t pos = 0;
+  int n = 0;
+
+  while (n < max_iovs - 1 && pos < size) {
+    size_t len = rand() % 4 ? rand() % (size - pos + 1) : 0;
+
+    iovs[n].iov_base = mem + pos;
+    iovs[n].iov_len = len;
+    pos += len;
+    n++;
+  }
+  iovs[n].iov_base = mem + pos;
+  iovs[n].iov_len = size - pos;
+  return n + 1;
+}
+
+/* same split over another buffer */
+static void mirror_iovs(struct iovec *dst, const struct iovec *src, int n,
+                        unsigned char *from, unsigned char *to)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    dst[i].iov_base = to + ((unsigned char *)src[i].iov_base - from);
+    dst[i].iov_len = src[i].iov_len;
+  }
+}
+
+/* the strided cursor copies against row by row vrend_read_from_iovec and
+ * vrend_write_to_iovec, with both row orders in the linear buffer */
+START_TEST(virgl_test_iov_cursor_random)
+{
+  unsigned char mem[4096], ref[4096];
+  unsigned char a[64 * 16], b[64 * 16];
+  struct iovec iovs[16], ref_iovs[16];
+  struct vrend_iov_cursor cur;
+  int it, niovs;
+  unsigned h;
+
+  srand(1);
+  for (it = 0; it < 5000; it++) {
+    size_t total = 1 + rand() % sizeof(mem);
+    size_t size = 1 + rand() % 64;
+    size_t stride = size + rand() % 64;
+    unsigned rows = 1 + rand() % 16;
+    size_t offset = rand() % total;
+    bool invert = rand() % 2;
+    ptrdiff_t buf_stride = invert ? -(ptrdiff_t)size : (ptrdiff_t)size;
+    unsigned char *first = invert ? b + (rows - 1) * size : b;
+    size_t ret;
+
+    if (offset + (rows - 1) * stride + size > total)
+      continue;
+
+    for (h = 0; h < total; h++)
+      mem[h] = rand();
+    niovs = random_iovs(iovs, 16, mem, total);
+
+    for (h = 0; h < rows; h++) {
+      unsigned row = invert ? rows - 1 - h : h;
+      vrend_read_from_iovec(iovs, niovs, offset + h * stride,
+                            (char *)a + row * size, size);
+    }
+    vrend_iov_cursor_init(&cur, iovs, niovs);
+    ret = vrend_iov_cursor_read_strided(&cur, offset, stride, (char *)first,
+                                        buf_stride, size, rows);
+    ck_assert_int_eq(ret, rows * size);
+    ck_assert(memcmp(a, b, rows * size) == 0);
+
+    for (h = 0; h < rows * size; h++)
+      b[h] = rand();
+    memcpy(ref, mem, total);
+    mirror_iovs(ref_iovs, iovs, niovs, mem, ref);
+    for (h = 0; h < rows; h++) {
+      unsigned row = invert ? rows - 1 - h : h;
+      vrend_write_to_iovec(ref_iovs, niovs, offset + h * stride,
+                           (char *)b + row * size, size);
+    }
+    vrend_iov_cursor_init(&cur, iovs, niovs);
+    ret = vrend_iov_cursor_write_strided(&cur, offset, stride, (char *)first,
+                                         buf_stride, size, rows);
+    ck_assert_int_eq(ret, rows * size);
+    ck_assert(memcmp(mem, ref, total) == 0);
+  }
+}
+END_TEST
+
+/* a cursor that already walked past an iov has to find it again */
+START_TEST(virgl_test_iov_cursor_backward)
+{
+  unsigned char backing[BACKING_SIZE];
+  unsigned char buf[16];
+  struct iovec iovs[5];
+  struct vrend_iov_cursor cur;
+  void *ptr;
+  int niovs, i;
+
+  for (i = 0; i < BACKING_SIZE; i++)
+    backing[i] = i;
+  niovs = init_iovs(iovs, backing);
+  vrend_iov_cursor_init(&cur, iovs, niovs);
+
+  ck_assert_int_eq(vrend_iov_cursor_read(&cur, 240, (char *)buf, 16), 16);
+  ck_assert(memcmp(buf, backing + 240, 16) == 0);
+
+  /* back into the first iov, and across the next boundary */
+  ck_assert_int_eq(vrend_iov_cursor_read(&cur, 92, (char *)buf, 16), 16);
+  ck_assert(memcmp(buf, backing + 92, 16) == 0);
+
+  ck_assert_int_eq(vrend_iov_cursor_span(&cur, 0, &ptr), 100);
+  ck_assert_ptr_eq(ptr, backing);
+
+  /* back within the same iov */
+  ck_assert_int_eq(vrend_iov_cursor_span(&cur, 210, &ptr), 46);
+  ck_assert_int_eq(vrend_iov_cursor_span(&cur, 201, &ptr), 55);
+  ck_assert_ptr_eq(ptr, backing + 201);
+}
+END_TEST
+
+/* empty iovs at the start, in the middle and at the end are skipped */
+START_TEST(virgl_test_iov_cursor_zero_len)
+{
+  unsigned char backing[32];
+  unsigned char buf[32];
+  struct iovec iovs[6] = {
+    { backing, 0 },
+    { backing, 10 },
+    { backing + 10, 0 },
+    { backing + 10, 0 },
+    { backing + 10, 22 },
+    { backing + 32, 0 },
+  };
+  struct vrend_iov_cursor cur;
+  void *ptr;
+  int i;
+
+  for (i = 0; i < 32; i++)
+    backing[i] = i + 1;
+  vrend_iov_cursor_init(&cur, iovs, 6);
+
+  ck_assert_int_eq(vrend_iov_cursor_span(&cur, 0, &ptr), 10);
+  ck_assert_ptr_eq(ptr, backing);
+  ck_assert_int_eq(vrend_iov_cursor_span(&cur, 10, &ptr), 22);
+  ck_assert_ptr_eq(ptr, backing + 10);
+  ck_assert_int_eq(vrend_iov_cursor_span(&cur, 32, &ptr), 0);
+
+  memset(buf, 0, sizeof(buf));
+  ck_assert_int_eq(vrend_iov_cursor_read(&cur, 4, (char *)buf, 32), 28);
+  ck_assert(memcmp(buf, backing + 4, 28) == 0);
+
+  /* nothing but empty iovs */
+  vrend_iov_cursor_init(&cur, iovs + 2, 2);
+  ck_assert_int_eq(vrend_iov_cursor_span(&cur, 0, &ptr), 0);
+  ck_assert_int_eq(vrend_iov_cursor_read(&cur, 0, (char *)buf, 1), 0);
+}
+END_TEST
+
+/* a negative buf_stride walks the linear buffer bottom up, like the
+ * inverted transfers do */
+START_TEST(virgl_test_iov_cursor_negative_stride)
+{
+  unsigned char backing[BACKING_SIZE];
+  unsigned char buf[4 * 8];
+  struct iovec iovs[5];
+  struct vrend_iov_cursor cur;
+  int niovs, i, row;
+
+  for (i = 0; i < BACKING_SIZE; i++)
+    backing[i] = i;
+  niovs = init_iovs(iovs, backing);
+
+  /* four rows of 8 bytes, 38 apart, the first two cross the 100 and 137
+   * boundaries */
+  vrend_iov_cursor_init(&cur, iovs, niovs);
+  ck_assert_int_eq(vrend_iov_cursor_read_strided(&cur, 96, 38,
+                                                 (char *)buf + 3 * 8, -8,
+                                                 8, 4), 32);
+  for (row = 0; row < 4; row++)
+    ck_assert(memcmp(buf + (3 - row) * 8, backing + 96 + row * 38, 8) == 0);
+
+  for (i = 0; i < (int)sizeof(buf); i++)
+    buf[i] = 0xff - i;
+  vrend_iov_cursor_init(&cur, iovs, niovs);
+  ck_assert_int_eq(vrend_iov_cursor_write_strided(&cur, 96, 38,
+                                                  (char *)buf + 3 * 8, -8,
+                                                  8, 4), 32);
+  for (row = 0; row < 4; row++)
+    ck_assert(memcmp(backing + 96 + row * 38, buf + (3 - row) * 8, 8) == 0);
+  ck_assert_int_eq(backing[95], 95);
+  ck_assert_int_eq(backing[104], 104);
+
+  /* rows past the end are short */
+  vrend_iov_cursor_init(&cur, iovs, niovs);
+  ck_assert_int_eq(vrend_iov_cursor_read_strided(&cur, 200, 40,
+                                                 (char *)buf + 3 * 8, -8,
+                                                 8, 4), 16);
+}
+END_TEST
+
+static Suite *virgl_init_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("virgl_iov");
+  tc_core = tcase_create("iov");
+
+  tcase_add_test(tc_core, virgl_test_iov_read_cb_offset);
+  tcase_add_test(tc_core, virgl_test_iov_read_cb_single_piece);
+  tcase_add_test(tc_core, virgl_test_iov_cursor_random);
+  tcase_add_test(tc_core, virgl_test_iov_cursor_backward);
+  tcase_add_test(tc_core, virgl_test_iov_cursor_zero_len);
+  tcase_add_test(tc_core, virgl_test_iov_cursor_negative_stride);
+
+  suite_add_tcase(s, tc_core);
+  return s;
+}
+
+int main(void)
+{
+  Suite *s;
+  SRunner *sr;
+  int number_failed;
+
+  s = virgl_init_suite();
+  sr = srunner_create(s);
+
+  srunner_run_all(sr, CK_NORMAL);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
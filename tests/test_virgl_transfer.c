@@ -25,6 +25,7 @@
 /* transfer and iov related tests */
 #include <check.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/uio.h>
 #include <errno.h>
 #include <virglrenderer.h>
@@ -319,6 +320,150 @@ START_TEST(virgl_test_transfer_1d)
 }
 END_TEST
 
+/* the upload ring takes over any upload that fits it, these tests turn it
+ * off so texture writes from several iovs go through the scattered path */
+static void scatter_init(void)
+{
+    setenv("VIRGL_DISABLE_UPLOAD_RING", "1", 1);
+    testvirgl_init_single_ctx_nr();
+}
+
+static void scatter_fini(void)
+{
+    testvirgl_fini_single_ctx();
+    unsetenv("VIRGL_DISABLE_UPLOAD_RING");
+}
+
+/* write box from a backing split after each of iov_sizes, with rows stride
+ * bytes apart and layers stride * height apart, then read every layer back
+ * and compare */
+static void check_scattered_write(struct virgl_renderer_resource_create_args *args,
+                                  const struct virgl_box *box, uint32_t stride,
+                                  const uint32_t *iov_sizes, int niovs)
+{
+    uint32_t layer_size = stride * args->height;
+    uint32_t size = layer_size * box->d;
+    /* a stride 0 read packs the rows of the box tightly */
+    uint32_t rb_stride = box->w * 4;
+    uint32_t rb_size = args->width * 4 * args->height;
+    struct iovec iovs[8], rb_iov;
+    unsigned char *data, *rb;
+    uint32_t pos = 0;
+    int ret, i, x, y, z;
+
+    ck_assert_int_lt(niovs, 8);
+    data = malloc(size);
+    rb = calloc(1, rb_size);
+    ck_assert_ptr_ne(data, NULL);
+    ck_assert_ptr_ne(rb, NULL);
+    for (i = 0; i < (int)size; i++)
+        data[i] = i * 7;
+
+    for (i = 0; i < niovs; i++) {
+        iovs[i].iov_base = data + pos;
+        iovs[i].iov_len = iov_sizes[i];
+        pos += iov_sizes[i];
+    }
+    ck_assert_int_lt(pos, size);
+    iovs[niovs].iov_base = data + pos;
+    iovs[niovs].iov_len = size - pos;
+
+    ret = virgl_renderer_resource_create(args, NULL, 0);
+    ck_assert_int_eq(ret, 0);
+    rb_iov.iov_base = rb;
+    rb_iov.iov_len = rb_size;
+    virgl_renderer_resource_attach_iov(args->handle, &rb_iov, 1);
+    virgl_renderer_ctx_attach_resource(1, args->handle);
+
+    ret = virgl_renderer_transfer_write_iov(args->handle, 1, 0, stride, 0,
+                                            (struct virgl_box *)box, 0,
+                                            iovs, niovs + 1);
+    ck_assert_int_eq(ret, 0);
+
+    for (z = 0; z < (int)box->d; z++) {
+        struct virgl_box rbox = *box;
+
+        rbox.z = box->z + z;
+        rbox.d = 1;
+        memset(rb, 0, rb_size);
+        ret = virgl_renderer_transfer_read_iov(args->handle, 1, 0, 0, 0, &rbox, 0, NULL, 0);
+        ck_assert_int_eq(ret, 0);
+
+        for (y = 0; y < (int)box->h; y++) {
+            const unsigned char *src = data + z * layer_size + y * stride;
+            const unsigned char *dst = rb + y * rb_stride;
+
+            /* the X channel isn't preserved */
+            for (x = 0; x < (int)box->w * 4; x++) {
+                if (x % 4 != 3)
+                    ck_assert_int_eq(dst[x], src[x]);
+            }
+        }
+    }
+
+    virgl_renderer_ctx_detach_resource(1, args->handle);
+    virgl_renderer_resource_detach_iov(args->handle, NULL, NULL);
+    virgl_renderer_resource_unref(args->handle);
+    free(rb);
+    free(data);
+}
+
+/* the first row is split between the first two iovs */
+START_TEST(virgl_test_transfer_2d_scattered_iov)
+{
+    struct virgl_renderer_resource_create_args args;
+    struct virgl_box box = { .w = 50, .h = 4, .d = 1 };
+    static const uint32_t iov_sizes[] = { 150, 333 };
+
+    testvirgl_init_simple_2d_resource(&args, 1);
+    check_scattered_write(&args, &box, 50 * 4, iov_sizes, 2);
+}
+END_TEST
+
+/* rows narrower than the stride, the second row is split */
+START_TEST(virgl_test_transfer_2d_scattered_iov_stride)
+{
+    struct virgl_renderer_resource_create_args args;
+    struct virgl_box box = { .x = 5, .y = 3, .w = 30, .h = 6, .d = 1 };
+    static const uint32_t iov_sizes[] = { 300, 700 };
+
+    testvirgl_init_simple_2d_resource(&args, 1);
+    check_scattered_write(&args, &box, 256, iov_sizes, 2);
+}
+END_TEST
+
+/* layers of a 3d texture, with rows split inside and between layers */
+START_TEST(virgl_test_transfer_3d_scattered_iov)
+{
+    struct virgl_renderer_resource_create_args args;
+    struct virgl_box box = { .x = 2, .y = 1, .z = 1, .w = 12, .h = 10, .d = 3 };
+    static const uint32_t iov_sizes[] = { 1000, 1500 };
+
+    testvirgl_init_simple_2d_resource(&args, 1);
+    args.target = PIPE_TEXTURE_3D;
+    args.width = 16;
+    args.height = 16;
+    args.depth = 4;
+    check_scattered_write(&args, &box, 16 * 4, iov_sizes, 2);
+}
+END_TEST
+
+/* all layers of an array texture, with a stride larger than a row */
+START_TEST(virgl_test_transfer_2d_array_scattered_iov)
+{
+    struct virgl_renderer_resource_create_args args;
+    struct virgl_box box = { .w = 16, .h = 16, .d = 3 };
+    static const uint32_t iov_sizes[] = { 77, 1300, 2 };
+
+    testvirgl_init_simple_2d_resource(&args, 1);
+    args.target = PIPE_TEXTURE_2D_ARRAY;
+    args.width = 16;
+    args.height = 16;
+    args.array_size = 3;
+    check_scattered_write(&args, &box, 80, iov_sizes, 3);
+}
+END_TEST
+
 START_TEST(virgl_test_transfer_1d_bad_iov)
 {
     struct virgl_renderer_resource_create_args res;
@@ -449,6 +594,53 @@ START_TEST(virgl_test_transfer_buffer_bad_layer_stride)
 }
 END_TEST
 
+/* write a buffer from a backing split over several iovs, starting at a
+ * nonzero offset in the backing and in the buffer, and read it back */
+START_TEST(virgl_test_transfer_buffer_multi_iov_offset)
+{
+    struct virgl_renderer_resource_create_args res;
+    unsigned char data[256], expected[256];
+    struct iovec iovs[3] = {
+        { .iov_base = data, .iov_len = 100 },
+        { .iov_base = data + 100, .iov_len = 37 },
+        { .iov_base = data + 137, .iov_len = 119 },
+    };
+    struct virgl_box box = { .x = 40, .w = 150, .h = 1, .d = 1 };
+    int offset = 60;
+    int ret;
+    int i;
+
+    testvirgl_init_simple_buffer_sized(&res, 1, sizeof(data));
+    res.bind = PIPE_BIND_VERTEX_BUFFER;
+    ret = virgl_renderer_resource_create(&res, NULL, 0);
+    ck_assert_int_eq(ret, 0);
+
+    virgl_renderer_ctx_attach_resource(1, res.handle);
+
+    for (i = 0; i < (int)sizeof(data); i++)
+        data[i] = i;
+    memcpy(expected, data, sizeof(data));
+
+    ret = virgl_renderer_transfer_write_iov(res.handle, 1, 0, 0, 0, &box, offset, iovs, 3);
+    ck_assert_int_eq(ret, 0);
+
+    memset(data, 0, sizeof(data));
+    ret = virgl_renderer_transfer_read_iov(res.handle, 1, 0, 0, 0, &box, offset, iovs, 3);
+    ck_assert_int_eq(ret, 0);
+
+    for (i = 0; i < (int)sizeof(data); i++) {
+        if (i >= offset && i < offset + box.w)
+            ck_assert_int_eq(data[i], expected[i]);
+        else
+            ck_assert_int_eq(data[i], 0);
+    }
+
+    virgl_renderer_ctx_detach_resource(1, res.handle);
+
+    virgl_renderer_resource_unref(1);
+}
+END_TEST
+
 START_TEST(virgl_test_transfer_2d_array_bad_layer_stride)
 {
     struct virgl_renderer_resource_create_args res;
@@ -753,6 +945,7 @@ static Suite *virgl_init_suite(void)
   tcase_add_test(tc_core, virgl_test_transfer_1d_bad_layer_stride);
   tcase_add_test(tc_core, virgl_test_transfer_2d_bad_layer_stride);
   tcase_add_test(tc_core, virgl_test_transfer_buffer_bad_layer_stride);
+  tcase_add_test(tc_core, virgl_test_transfer_buffer_multi_iov_offset);
   tcase_add_test(tc_core, virgl_test_transfer_2d_array_bad_layer_stride);
   tcase_add_test(tc_core, virgl_test_transfer_2d_bad_level);
   tcase_add_test(tc_core, virgl_test_transfer_2d_bad_stride);
@@ -768,6 +961,15 @@ static Suite *virgl_init_suite(void)
   tcase_add_loop_test(tc_core, virgl_test_transfer_inline_invalid, 0, PIPE_MAX_TEXTURE_TYPES);
   tcase_add_loop_test(tc_core, virgl_test_transfer_inline_valid_large, 0, PIPE_MAX_TEXTURE_TYPES);
 
+  suite_add_tcase(s, tc_core);
+
+  tc_core = tcase_create("transfer_scattered");
+  tcase_add_checked_fixture(tc_core, scatter_init, scatter_fini);
+  tcase_add_test(tc_core, virgl_test_transfer_2d_scattered_iov);
+  tcase_add_test(tc_core, virgl_test_transfer_2d_scattered_iov_stride);
+  tcase_add_test(tc_core, virgl_test_transfer_3d_scattered_iov);
+  tcase_add_test(tc_core, virgl_test_transfer_2d_array_scattered_iov);
+
   suite_add_tcase(s, tc_core);
   return s;
 
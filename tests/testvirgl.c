@@ -110,13 +110,13 @@ void testvirgl_reset_fence(void)
    testvirgl_last_fence = 0;
 }
 
-int testvirgl_init_single_ctx(void)
+int testvirgl_init_single_ctx_flags(int flags)
 {
     int ret;
 
     test_cbs.version = 1;
     test_cbs.write_fence = testvirgl_write_fence;
-    ret = virgl_renderer_init(&mystruct, VIRGL_RENDERER_USE_EGL, &test_cbs);
+    ret = virgl_renderer_init(&mystruct, VIRGL_RENDERER_USE_EGL | flags, &test_cbs);
     ck_assert_int_eq(ret, 0);
     if (ret)
 	return ret;
@@ -126,6 +126,11 @@ int testvirgl_init_single_ctx(void)
 
 }
 
+int testvirgl_init_single_ctx(void)
+{
+    return testvirgl_init_single_ctx_flags(0);
+}
+
 void testvirgl_init_single_ctx_nr(void)
 {
     testvirgl_init_single_ctx();
@@ -143,10 +148,10 @@ static void testvirgl_flush(struct virgl_context *ctx)
     ctx->cbuf->cdw = 0;
 }
 
-int testvirgl_init_ctx_cmdbuf(struct virgl_context *ctx)
+int testvirgl_init_ctx_cmdbuf_flags(struct virgl_context *ctx, int flags)
 {
     int ret;
-    ret = testvirgl_init_single_ctx();
+    ret = testvirgl_init_single_ctx_flags(flags);
     if (ret)
 	return ret;
 
@@ -167,6 +172,11 @@ int testvirgl_init_ctx_cmdbuf(struct virgl_context *ctx)
     return 0;
 }
 
+int testvirgl_init_ctx_cmdbuf(struct virgl_context *ctx)
+{
+    return testvirgl_init_ctx_cmdbuf_flags(ctx, 0);
+}
+
 void testvirgl_fini_ctx_cmdbuf(struct virgl_context *ctx)
 {
     FREE(ctx->cbuf->buf);
@@ -61,6 +61,7 @@ void testvirgl_init_simple_buffer_sized(struct virgl_renderer_resource_create_ar
 void testvirgl_init_simple_1d_resource(struct virgl_renderer_resource_create_args *args, int handle);
 void testvirgl_init_simple_2d_resource(struct virgl_renderer_resource_create_args *res, int handle);
 int testvirgl_init_single_ctx(void);
+int testvirgl_init_single_ctx_flags(int flags);
 void testvirgl_init_single_ctx_nr(void);
 void testvirgl_fini_single_ctx(void);
 
@@ -68,6 +69,7 @@ uint32_t testvirgl_get_last_fence(void);
 void testvirgl_reset_fence(void);
 
 int testvirgl_init_ctx_cmdbuf(struct virgl_context *ctx);
+int testvirgl_init_ctx_cmdbuf_flags(struct virgl_context *ctx, int flags);
 void testvirgl_fini_ctx_cmdbuf(struct virgl_context *ctx);
 
 int testvirgl_create_backed_simple_1d_res(struct virgl_resource *res,
@@ -229,45 +229,24 @@ static void virgl_emit_shader_streamout(struct virgl_context *ctx,
    }
 }
 
-int virgl_encode_shader_state(struct virgl_context *ctx,
-                              uint32_t handle,
-                              uint32_t type,
-                              const struct pipe_shader_state *shader,
-                              const char *shad_str)
+static void virgl_encode_shader_data(struct virgl_context *ctx,
+                                     uint32_t handle,
+                                     uint32_t type,
+                                     const struct pipe_shader_state *shader,
+                                     const char *data, uint32_t shader_len,
+                                     uint32_t num_tokens)
 {
-   char *str, *sptr;
-   uint32_t shader_len, len;
-   int ret;
-   int num_tokens;
-   int str_total_size = 65536;
+   const char *sptr;
+   uint32_t len;
    uint32_t left_bytes, base_hdr_size, strm_hdr_size, thispass;
    bool first_pass;
 
-   if (!shad_str) {
-       num_tokens = tgsi_num_tokens(shader->tokens);
-       str = CALLOC(1, str_total_size);
-       if (!str)
-          return -1;
-
-       ret = tgsi_dump_str(shader->tokens, TGSI_DUMP_FLOAT_AS_HEX, str, str_total_size);
-       if (ret == -1) {
-          fprintf(stderr, "Failed to translate shader in available space\n");
-          FREE(str);
-          return -1;
-       }
-   } else {
-       num_tokens = 300;
-       str = (char *)shad_str;
-   }
-
-   shader_len = strlen(str) + 1;
-
    left_bytes = shader_len;
 
    base_hdr_size = 5;
    strm_hdr_size = shader->stream_output.num_outputs ? shader->stream_output.num_outputs * 2 + 4 : 0;
    first_pass = true;
-   sptr = str;
+   sptr = data;
    while (left_bytes) {
       uint32_t length, offlen;
       int hdr_len = base_hdr_size + (first_pass ? strm_hdr_size : 0);
@@ -282,7 +261,7 @@ int virgl_encode_shader_state(struct virgl_context *ctx,
       if (first_pass)
          offlen = VIRGL_OBJ_SHADER_OFFSET_VAL(shader_len);
       else
-         offlen = VIRGL_OBJ_SHADER_OFFSET_VAL((uintptr_t)sptr - (uintptr_t)str) | VIRGL_OBJ_SHADER_OFFSET_CONT;
+         offlen = VIRGL_OBJ_SHADER_OFFSET_VAL((uintptr_t)sptr - (uintptr_t)data) | VIRGL_OBJ_SHADER_OFFSET_CONT;
 
       virgl_emit_shader_header(ctx, handle, len, type, offlen, num_tokens);
 
@@ -294,12 +273,57 @@ int virgl_encode_shader_state(struct virgl_context *ctx,
       first_pass = false;
       left_bytes -= length;
    }
+}
+
+int virgl_encode_shader_state(struct virgl_context *ctx,
+                              uint32_t handle,
+                              uint32_t type,
+                              const struct pipe_shader_state *shader,
+                              const char *shad_str)
+{
+   char *str;
+   int ret;
+   int num_tokens;
+   int str_total_size = 65536;
+
+   if (!shad_str) {
+       num_tokens = tgsi_num_tokens(shader->tokens);
+       str = CALLOC(1, str_total_size);
+       if (!str)
+          return -1;
+
+       ret = tgsi_dump_str(shader->tokens, TGSI_DUMP_FLOAT_AS_HEX, str, str_total_size);
+       if (ret == -1) {
+          fprintf(stderr, "Failed to translate shader in available space\n");
+          FREE(str);
+          return -1;
+       }
+   } else {
+       num_tokens = 300;
+       str = (char *)shad_str;
+   }
+
+   virgl_encode_shader_data(ctx, handle, type, shader, str, strlen(str) + 1, num_tokens);
 
    if (str != shad_str)
        FREE(str);
    return 0;
 }
 
+/* send the shader as binary tokens, needs VIRGL_CAP_V2_TGSI_TOKENS */
+int virgl_encode_shader_tokens(struct virgl_context *ctx,
+                               uint32_t handle,
+                               uint32_t type,
+                               const struct pipe_shader_state *shader)
+{
+   uint32_t num_tokens = tgsi_num_tokens(shader->tokens);
+
+   virgl_encode_shader_data(ctx, handle, type | VIRGL_OBJ_SHADER_TYPE_TOKENS, shader,
+                            (const char *)shader->tokens,
+                            num_tokens * sizeof(struct tgsi_token), num_tokens);
+   return 0;
+}
+
 
 int virgl_encode_clear(struct virgl_context *ctx,
                       unsigned buffers,
@@ -74,6 +74,11 @@ extern int virgl_encode_shader_state(struct virgl_context *ctx,
 				     const struct pipe_shader_state *shader,
 				     const char *shad_str);
 
+extern int virgl_encode_shader_tokens(struct virgl_context *ctx,
+                                      uint32_t handle,
+                                      uint32_t type,
+                                      const struct pipe_shader_state *shader);
+
 int virgl_encode_stream_output_info(struct virgl_context *ctx,
                                    uint32_t handle,
                                    uint32_t type,
@@ -0,0 +1,532 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Re-issue a command trace captured with VIRGL_TRACE_FILE as fast as the
+   renderer accepts it and report frames per second together with the CPU
+   time spent in each kind of call. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "virglrenderer.h"
+#include "vrend_trace.h"
+
+struct virgl_box {
+   uint32_t x, y, z;
+   uint32_t w, h, d;
+};
+
+struct replay_stat {
+   uint64_t count;
+   uint64_t cpu_ns;
+};
+
+struct replay_backing {
+   struct iovec iov;
+   bool attached;
+};
+
+static const char *trace_type_names[VREND_TRACE_NUM_TYPES] = {
+   [VREND_TRACE_CTX_CREATE] = "ctx_create",
+   [VREND_TRACE_CTX_DESTROY] = "ctx_destroy",
+   [VREND_TRACE_RES_CREATE] = "resource_create",
+   [VREND_TRACE_RES_UNREF] = "resource_unref",
+   [VREND_TRACE_RES_ATTACH_IOV] = "attach_iov",
+   [VREND_TRACE_RES_DETACH_IOV] = "detach_iov",
+   [VREND_TRACE_CTX_ATTACH_RES] = "ctx_attach_resource",
+   [VREND_TRACE_CTX_DETACH_RES] = "ctx_detach_resource",
+   [VREND_TRACE_SUBMIT_CMD] = "submit_cmd",
+   [VREND_TRACE_TRANSFER_WRITE] = "transfer_write",
+   [VREND_TRACE_TRANSFER_READ] = "transfer_read",
+   [VREND_TRACE_CREATE_FENCE] = "create_fence",
+   [VREND_TRACE_RESET] = "reset",
+};
+
+static struct replay_stat type_stats[VREND_TRACE_NUM_TYPES];
+/* the opcode is the low byte of each command header */
+#define REPLAY_MAX_CMDS 256
+
+static struct replay_stat cmd_stats[REPLAY_MAX_CMDS];
+static bool split_cmds;
+
+static struct replay_backing *backings;
+static uint32_t num_backings;
+
+static void *read_buf;
+static uint32_t read_buf_size;
+
+static uint32_t last_fence;
+static uint32_t fences_issued;
+
+static void replay_write_fence(void *cookie, uint32_t fence_id)
+{
+   last_fence = fence_id;
+}
+
+static struct virgl_renderer_callbacks replay_cbs = {
+   .version = 1,
+   .write_fence = replay_write_fence,
+};
+
+static uint64_t cpu_time_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t wall_time_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct replay_backing *get_backing(uint32_t handle)
+{
+   if (handle >= num_backings) {
+      uint32_t new_num = num_backings ? num_backings : 64;
+      struct replay_backing *new_backings;
+
+      while (new_num <= handle)
+         new_num *= 2;
+      new_backings = realloc(backings, new_num * sizeof(*backings));
+      if (!new_backings)
+         return NULL;
+      memset(new_backings + num_backings, 0,
+             (new_num - num_backings) * sizeof(*backings));
+      backings = new_backings;
+      num_backings = new_num;
+   }
+   return &backings[handle];
+}
+
+/* the guest memory the trace was captured with is not available, so give
+   each resource zeroed backing storage of the same size */
+static struct iovec *alloc_backing(uint32_t handle, uint32_t size)
+{
+   struct replay_backing *backing = get_backing(handle);
+
+   if (!backing || !size)
+      return NULL;
+
+   free(backing->iov.iov_base);
+   backing->iov.iov_base = calloc(1, size);
+   backing->iov.iov_len = size;
+   backing->attached = backing->iov.iov_base != NULL;
+   return backing->attached ? &backing->iov : NULL;
+}
+
+static void free_backing(uint32_t handle)
+{
+   struct replay_backing *backing;
+
+   if (handle >= num_backings)
+      return;
+
+   backing = &backings[handle];
+   free(backing->iov.iov_base);
+   memset(backing, 0, sizeof(*backing));
+}
+
+static void free_all_backings(void)
+{
+   uint32_t i;
+
+   for (i = 0; i < num_backings; i++)
+      free(backings[i].iov.iov_base);
+   free(backings);
+   backings = NULL;
+   num_backings = 0;
+}
+
+static void replay_submit(const struct vrend_trace_submit_cmd *rec,
+                          uint32_t *cmds)
+{
+   uint32_t i = 0;
+
+   if (!split_cmds) {
+      virgl_renderer_submit_cmd(cmds, rec->ctx_id, rec->ndw);
+      return;
+   }
+
+   /* submit the commands one by one so that they can be timed per opcode */
+   while (i < rec->ndw) {
+      uint32_t len = cmds[i] >> 16;
+      uint32_t cmd = cmds[i] & 0xff;
+      uint64_t start;
+
+      if (i + len + 1 > rec->ndw)
+         break;
+
+      start = cpu_time_ns();
+      virgl_renderer_submit_cmd(cmds + i, rec->ctx_id, len + 1);
+      cmd_stats[cmd].count++;
+      cmd_stats[cmd].cpu_ns += cpu_time_ns() - start;
+      i += len + 1;
+   }
+}
+
+static void replay_transfer(uint32_t type, const struct vrend_trace_transfer *rec,
+                            void *data)
+{
+   struct virgl_box box = {
+      rec->box[0], rec->box[1], rec->box[2],
+      rec->box[3], rec->box[4], rec->box[5]
+   };
+   struct iovec iov;
+
+   /* the payload was captured starting at the transfer offset */
+   if (type == VREND_TRACE_TRANSFER_WRITE) {
+      iov.iov_base = data;
+      iov.iov_len = rec->data_size;
+      virgl_renderer_transfer_write_iov(rec->handle, rec->ctx_id, rec->level,
+                                        rec->stride, rec->layer_stride,
+                                        &box, 0, &iov, 1);
+      return;
+   }
+
+   if (rec->data_size > read_buf_size) {
+      free(read_buf);
+      read_buf = malloc(rec->data_size);
+      read_buf_size = read_buf ? rec->data_size : 0;
+      if (!read_buf)
+         return;
+   }
+   iov.iov_base = read_buf;
+   iov.iov_len = rec->data_size;
+   virgl_renderer_transfer_read_iov(rec->handle, rec->ctx_id, rec->level,
+                                    rec->stride, rec->layer_stride,
+                                    &box, 0, &iov, 1);
+}
+
+static bool replay_record(uint32_t type, uint8_t *payload, uint32_t size)
+{
+   switch (type) {
+   case VREND_TRACE_CTX_CREATE: {
+      struct vrend_trace_ctx_create *rec = (void *)payload;
+      if (size < sizeof(*rec) || size - sizeof(*rec) < rec->nlen)
+         return false;
+      virgl_renderer_context_create(rec->handle, rec->nlen,
+                                    (const char *)(rec + 1));
+      break;
+   }
+   case VREND_TRACE_CTX_DESTROY: {
+      struct vrend_trace_handle *rec = (void *)payload;
+      if (size < sizeof(*rec))
+         return false;
+      virgl_renderer_context_destroy(rec->handle);
+      break;
+   }
+   case VREND_TRACE_RES_CREATE: {
+      struct vrend_trace_res_create *rec = (void *)payload;
+      struct virgl_renderer_resource_create_args args;
+      struct iovec *iov;
+      if (size < sizeof(*rec))
+         return false;
+      args.handle = rec->handle;
+      args.target = rec->target;
+      args.format = rec->format;
+      args.bind = rec->bind;
+      args.width = rec->width;
+      args.height = rec->height;
+      args.depth = rec->depth;
+      args.array_size = rec->array_size;
+      args.last_level = rec->last_level;
+      args.nr_samples = rec->nr_samples;
+      args.flags = rec->flags;
+      iov = alloc_backing(rec->handle, rec->iov_size);
+      if (virgl_renderer_resource_create(&args, iov, iov ? 1 : 0))
+         free_backing(rec->handle);
+      break;
+   }
+   case VREND_TRACE_RES_UNREF: {
+      struct vrend_trace_handle *rec = (void *)payload;
+      if (size < sizeof(*rec))
+         return false;
+      virgl_renderer_resource_unref(rec->handle);
+      free_backing(rec->handle);
+      break;
+   }
+   case VREND_TRACE_RES_ATTACH_IOV: {
+      struct vrend_trace_attach_iov *rec = (void *)payload;
+      struct iovec *iov;
+      if (size < sizeof(*rec))
+         return false;
+      iov = alloc_backing(rec->handle, rec->iov_size);
+      if (iov && virgl_renderer_resource_attach_iov(rec->handle, iov, 1))
+         free_backing(rec->handle);
+      break;
+   }
+   case VREND_TRACE_RES_DETACH_IOV: {
+      struct vrend_trace_handle *rec = (void *)payload;
+      struct iovec *iov = NULL;
+      int num_iovs = 0;
+      if (size < sizeof(*rec))
+         return false;
+      virgl_renderer_resource_detach_iov(rec->handle, &iov, &num_iovs);
+      free_backing(rec->handle);
+      break;
+   }
+   case VREND_TRACE_CTX_ATTACH_RES:
+   case VREND_TRACE_CTX_DETACH_RES: {
+      struct vrend_trace_ctx_res *rec = (void *)payload;
+      if (size < sizeof(*rec))
+         return false;
+      if (type == VREND_TRACE_CTX_ATTACH_RES)
+         virgl_renderer_ctx_attach_resource(rec->ctx_id, rec->handle);
+      else
+         virgl_renderer_ctx_detach_resource(rec->ctx_id, rec->handle);
+      break;
+   }
+   case VREND_TRACE_SUBMIT_CMD: {
+      struct vrend_trace_submit_cmd *rec = (void *)payload;
+      if (size < sizeof(*rec) ||
+          (size - sizeof(*rec)) / sizeof(uint32_t) < rec->ndw)
+         return false;
+      replay_submit(rec, (uint32_t *)(rec + 1));
+      break;
+   }
+   case VREND_TRACE_TRANSFER_WRITE:
+   case VREND_TRACE_TRANSFER_READ: {
+      struct vrend_trace_transfer *rec = (void *)payload;
+      if (size < sizeof(*rec))
+         return false;
+      if (type == VREND_TRACE_TRANSFER_WRITE &&
+          size - sizeof(*rec) < rec->data_size)
+         return false;
+      replay_transfer(type, rec, rec + 1);
+      break;
+   }
+   case VREND_TRACE_CREATE_FENCE: {
+      struct vrend_trace_fence *rec = (void *)payload;
+      if (size < sizeof(*rec))
+         return false;
+      virgl_renderer_create_fence(rec->fence_id, rec->ctx_id);
+      fences_issued = rec->fence_id;
+      /* retire finished fences without waiting for them */
+      virgl_renderer_poll();
+      break;
+   }
+   case VREND_TRACE_RESET:
+      virgl_renderer_reset();
+      free_all_backings();
+      break;
+   default:
+      return false;
+   }
+   return true;
+}
+
+static uint8_t *load_trace(const char *filename, size_t *size_p)
+{
+   struct vrend_trace_header *header;
+   uint8_t *buf = NULL;
+   size_t size = 0, alloc = 0, ret;
+   FILE *f;
+
+   f = fopen(filename, "rb");
+   if (!f) {
+      fprintf(stderr, "failed to open trace %s\n", filename);
+      return NULL;
+   }
+
+   do {
+      if (size == alloc) {
+         uint8_t *new_buf;
+         alloc = alloc ? alloc * 2 : 1 << 20;
+         new_buf = realloc(buf, alloc);
+         if (!new_buf) {
+            fprintf(stderr, "out of memory loading trace\n");
+            free(buf);
+            fclose(f);
+            return NULL;
+         }
+         buf = new_buf;
+      }
+      ret = fread(buf + size, 1, alloc - size, f);
+      size += ret;
+   } while (ret);
+   fclose(f);
+
+   header = (struct vrend_trace_header *)buf;
+   if (size < sizeof(*header) || header->magic != VREND_TRACE_MAGIC ||
+       header->version != VREND_TRACE_VERSION) {
+      fprintf(stderr, "%s is not a virgl command trace\n", filename);
+      free(buf);
+      return NULL;
+   }
+
+   *size_p = size;
+   return buf;
+}
+
+static int replay_trace(uint8_t *trace, size_t size, uint64_t *frames)
+{
+   int cookie;
+   size_t pos = sizeof(struct vrend_trace_header);
+   int ctx = VIRGL_RENDERER_USE_EGL;
+
+   if (getenv("VTEST_USE_GLX"))
+      ctx = VIRGL_RENDERER_USE_GLX;
+
+   /* don't record the replay into the trace being replayed */
+   unsetenv("VIRGL_TRACE_FILE");
+
+   if (virgl_renderer_init(&cookie, ctx, &replay_cbs)) {
+      fprintf(stderr, "failed to initialise renderer.\n");
+      return -1;
+   }
+
+   last_fence = 0;
+   fences_issued = 0;
+
+   while (pos + sizeof(struct vrend_trace_record) <= size) {
+      struct vrend_trace_record *rec = (void *)(trace + pos);
+      uint64_t start;
+
+      pos += sizeof(*rec);
+      if (rec->size > size - pos) {
+         fprintf(stderr, "truncated trace record at offset %zu\n", pos);
+         break;
+      }
+
+      start = cpu_time_ns();
+      if (!replay_record(rec->type, trace + pos, rec->size)) {
+         fprintf(stderr, "invalid trace record %u at offset %zu\n",
+                 rec->type, pos);
+         break;
+      }
+      type_stats[rec->type].count++;
+      type_stats[rec->type].cpu_ns += cpu_time_ns() - start;
+
+      if (rec->type == VREND_TRACE_CREATE_FENCE)
+         (*frames)++;
+      pos += rec->size;
+   }
+
+   /* the frame rate includes waiting for the GPU to finish the last frame */
+   while (last_fence != fences_issued) {
+      virgl_renderer_poll();
+      usleep(100);
+   }
+
+   virgl_renderer_cleanup(&cookie);
+   free_all_backings();
+   return 0;
+}
+
+static void print_stat(const char *name, const struct replay_stat *stat,
+                       uint64_t total_ns)
+{
+   printf("%-24s %10llu %12.3f %10.3f %6.1f%%\n", name,
+          (unsigned long long)stat->count, stat->cpu_ns / 1e6,
+          stat->count ? stat->cpu_ns / 1e3 / stat->count : 0.0,
+          total_ns ? 100.0 * stat->cpu_ns / total_ns : 0.0);
+}
+
+static void usage(const char *prog)
+{
+   fprintf(stderr, "usage: %s [-n loops] [-s] trace\n"
+           "  -n loops  replay the trace this many times (default 1)\n"
+           "  -s        submit commands one by one and time them per opcode\n",
+           prog);
+}
+
+int main(int argc, char **argv)
+{
+   uint8_t *trace;
+   size_t size;
+   uint64_t frames = 0, start, elapsed, total_cpu = 0;
+   int loops = 1;
+   int opt, i;
+
+   while ((opt = getopt(argc, argv, "n:s")) != -1) {
+      switch (opt) {
+      case 'n':
+         loops = atoi(optarg);
+         break;
+      case 's':
+         split_cmds = true;
+         break;
+      default:
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   if (optind != argc - 1 || loops < 1) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   trace = load_trace(argv[optind], &size);
+   if (!trace)
+      return 1;
+
+   start = wall_time_ns();
+   for (i = 0; i < loops; i++) {
+      if (replay_trace(trace, size, &frames)) {
+         free(trace);
+         return 1;
+      }
+   }
+   elapsed = wall_time_ns() - start;
+   free(trace);
+   free(read_buf);
+
+   for (i = 0; i < VREND_TRACE_NUM_TYPES; i++)
+      total_cpu += type_stats[i].cpu_ns;
+
+   printf("%d loop(s), %llu frames in %.3f s: %.2f frames/sec\n", loops,
+          (unsigned long long)frames, elapsed / 1e9,
+          elapsed ? frames * 1e9 / elapsed : 0.0);
+
+   printf("\n%-24s %10s %12s %10s %7s\n", "call", "count", "cpu ms",
+          "avg us", "share");
+   for (i = 0; i < VREND_TRACE_NUM_TYPES; i++) {
+      if (type_stats[i].count)
+         print_stat(trace_type_names[i], &type_stats[i], total_cpu);
+   }
+
+   if (split_cmds) {
+      char name[32];
+
+      printf("\n%-24s %10s %12s %10s %7s\n", "opcode", "count", "cpu ms",
+             "avg us", "share");
+      for (i = 0; i < REPLAY_MAX_CMDS; i++) {
+         if (!cmd_stats[i].count)
+            continue;
+         snprintf(name, sizeof(name), "ccmd %d", i);
+         print_stat(name, &cmd_stats[i], total_cpu);
+      }
+   }
+   return 0;
+}
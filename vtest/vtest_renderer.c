@@ -145,8 +145,68 @@ end:
     return ret;
 }
 
+static void vtest_print_cmd_stats(const char *name, int idx,
+                                  const struct virgl_renderer_cmd_stats *stat)
+{
+  int i;
+
+  fprintf(stderr, "%-8s %3d %10llu %10llu %12.3f %10.3f  ", name, idx,
+          (unsigned long long)stat->count, (unsigned long long)stat->elided,
+          stat->total_ns / 1e6, stat->total_ns / 1e3 / stat->count);
+  for (i = 0; i < VIRGL_RENDERER_STATS_BUCKETS; i++) {
+    if (stat->histogram[i])
+      fprintf(stderr, " 2^%d:%llu", i, (unsigned long long)stat->histogram[i]);
+  }
+  fprintf(stderr, "\n");
+}
+
+static void vtest_dump_stats(void)
+{
+  static const char *slab_names[VIRGL_RENDERER_SLAB_COUNT] = {
+    "surface", "sampler view", "sampler state", "query", "shader selector",
+    "shader",
+  };
+  struct virgl_renderer_stats *stats;
+  int i;
+
+  stats = malloc(sizeof(*stats));
+  if (!stats)
+    return;
+
+  if (virgl_renderer_get_stats(ctx_id, stats) == 0) {
+    fprintf(stderr, "%-12s %10s %10s %12s %10s   %s\n", "command", "count",
+            "elided", "total ms", "avg us", "latency histogram (log2 ns)");
+    for (i = 0; i < VIRGL_RENDERER_STATS_MAX_CMDS; i++) {
+      if (stats->cmds[i].count)
+        vtest_print_cmd_stats("ccmd", i, &stats->cmds[i]);
+    }
+    for (i = 0; i < VIRGL_RENDERER_STATS_MAX_OBJECTS; i++) {
+      if (stats->objects[i].count)
+        vtest_print_cmd_stats("object", i, &stats->objects[i]);
+    }
+    fprintf(stderr, "%-16s %10s %10s %8s %8s %8s %12s\n", "slab", "allocs",
+            "frees", "chunks", "live", "peak", "bytes");
+    for (i = 0; i < VIRGL_RENDERER_SLAB_COUNT; i++) {
+      if (!stats->slabs[i].allocs)
+        continue;
+      fprintf(stderr, "%-16s %10llu %10llu %8llu %8u %8u %12llu\n",
+              slab_names[i], (unsigned long long)stats->slabs[i].allocs,
+              (unsigned long long)stats->slabs[i].frees,
+              (unsigned long long)stats->slabs[i].chunks,
+              stats->slabs[i].live, stats->slabs[i].peak,
+              (unsigned long long)stats->slabs[i].footprint);
+    }
+    if (stats->rs_emits)
+      fprintf(stderr, "rasterizer binds %llu, %llu GL calls\n",
+              (unsigned long long)stats->rs_emits,
+              (unsigned long long)stats->rs_gl_calls);
+  }
+  free(stats);
+}
+
 void vtest_destroy_renderer(void)
 {
+  vtest_dump_stats();
   virgl_renderer_context_destroy(ctx_id);
   virgl_renderer_cleanup(&renderer);
   renderer.in_fd = -1;